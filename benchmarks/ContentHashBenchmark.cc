@@ -0,0 +1,75 @@
+/**
+ * Compares the throughput of ContentHash::Compute with that of memcpy over
+ * the same buffers, from header sized to large generated sources.
+ *
+ *   make -C benchmarks ContentHashBenchmark
+ *   ./ContentHashBenchmark [TotalBytes] [Iterations]
+ *
+ * Each size is run over about TotalBytes of data, so the small buffers stay
+ * in the cache the way a header just read does, and the large ones do not.
+ */
+
+#include "ContentHash.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+/* Seconds taken by Run, the best of Iterations runs. */
+template <typename FnT>
+static double
+TimeBest(unsigned Iterations, FnT Run) {
+  double Best = 1e30;
+  for (unsigned I = 0; I < Iterations; ++I) {
+    auto Start = std::chrono::steady_clock::now();
+    Run();
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    if (Elapsed.count() < Best)
+      Best = Elapsed.count();
+  }
+  return Best;
+}
+
+int
+main(int argc, char **argv) {
+  size_t TotalBytes = argc > 1 ? std::atoll(argv[1]) : 256 << 20;
+  unsigned Iterations = argc > 2 ? std::atoi(argv[2]) : 5;
+
+  static const size_t Sizes[] = {1 << 10, 4 << 10, 64 << 10, 1 << 20,
+                                 16 << 20};
+
+  std::mt19937 Random(42);
+  std::string Source(Sizes[sizeof(Sizes) / sizeof(Sizes[0]) - 1], '\0');
+  for (char &C : Source)
+    C = char(' ' + Random() % 95);
+  std::string Dest(Source.size(), '\0');
+
+  std::printf("%10s %12s %12s %8s\n", "size", "hash GB/s", "memcpy GB/s",
+              "ratio");
+  for (size_t Size : Sizes) {
+    size_t Rounds = TotalBytes / Size ? TotalBytes / Size : 1;
+    double Bytes = double(Rounds) * Size;
+
+    uint64_t Checksum = 0;
+    double HashTime = TimeBest(Iterations, [&] {
+      for (size_t R = 0; R < Rounds; ++R)
+        Checksum += ContentHash::Compute(Source.data(), Size).Low;
+    });
+    double CopyTime = TimeBest(Iterations, [&] {
+      for (size_t R = 0; R < Rounds; ++R) {
+        std::memcpy(&Dest[0], Source.data(), Size);
+        // Keep the copy from being optimized away.
+        Checksum += uint8_t(Dest[R % Size]);
+      }
+    });
+
+    std::printf("%10zu %12.2f %12.2f %8.2f (%llx)\n", Size,
+                Bytes / HashTime / 1e9, Bytes / CopyTime / 1e9,
+                CopyTime / HashTime, (unsigned long long)Checksum);
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * Measures what 64-bit source locations cost over the default 32-bit ones:
+ * the size of the location types and of the SourceManager tables, and the
+ * time to map locations back to their file and offset. Build it twice, with
+ * and without SOURCE_LOCATION_64, and compare the output:
+ *
+ *   make -C benchmarks SourceLocationBenchmark32 SourceLocationBenchmark64
+ *   ./SourceLocationBenchmark32 [NumFiles] [NumLookups]
+ *   ./SourceLocationBenchmark64 [NumFiles] [NumLookups]
+ *
+ * Locations are looked up in random order, so most lookups miss the
+ * lookup cache and search the offset table, as for diagnostics and
+ * -E output of tokens from many headers.
+ */
+
+#include "SourceManager.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+int
+main(int argc, char **argv) {
+  unsigned NumFiles = argc > 1 ? std::atoi(argv[1]) : 20000;
+  unsigned NumLookups = argc > 2 ? std::atoi(argv[2]) : 4000000;
+
+  SourceManager SourceMgr(true);
+  std::mt19937 Random(42);
+
+  // Files of a few KB, each with its own contents so no buffer is shared.
+  std::vector<FileID> FIDs;
+  std::vector<unsigned> Sizes;
+  for (unsigned I = 0; I < NumFiles; ++I) {
+    std::string Buffer = "// file " + std::to_string(I) + "\n";
+    Buffer.resize(1024 + Random() % 8192, 'x');
+    Sizes.push_back(Buffer.size());
+    FileContentCache &Content = SourceMgr.CreateContentCache(Buffer);
+    FIDs.push_back(SourceMgr.CreateFileID(Content, SourceLocation(), 0));
+  }
+
+  std::vector<SourceLocation> Locs(NumLookups);
+  for (SourceLocation &Loc : Locs) {
+    unsigned File = Random() % NumFiles;
+    Loc = SourceMgr.GetComposedLoc(FIDs[File], Random() % Sizes[File]);
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+  uint64_t Checksum = 0;
+  for (SourceLocation Loc : Locs) {
+    std::pair<FileID, unsigned> LocInfo = SourceMgr.GetDecomposedLoc(Loc);
+    Checksum += LocInfo.first + LocInfo.second;
+  }
+  std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+
+  std::printf("%d-bit locations\n", int(8 * sizeof(SourceLocation::UIntTy)));
+  std::printf("sizeof(SourceLocation):      %zu\n", sizeof(SourceLocation));
+  std::printf("sizeof(SourceLocationEntry): %zu\n",
+              sizeof(SourceLocationEntry));
+  std::printf("entry offset table:          %zu bytes for %u files\n",
+              NumFiles * sizeof(SourceLocation::UIntTy), NumFiles);
+  std::printf("location array:              %zu bytes for %u locations\n",
+              Locs.size() * sizeof(SourceLocation), NumLookups);
+  std::printf("GetDecomposedLoc:            %.2f ns per lookup (%llx)\n",
+              Elapsed.count() * 1e9 / NumLookups,
+              (unsigned long long)Checksum);
+  return 0;
+}
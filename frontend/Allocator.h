@@ -0,0 +1,77 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "Mixins.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+/**
+ * Bump pointer allocator. Allocations are carved out of large slabs and are
+ * never freed individually; all the memory is released at once when the
+ * allocator is destroyed. Destructors of the allocated objects are not run.
+ */
+class BumpAllocator : private NonCopyable<BumpAllocator> {
+  static constexpr size_t SlabSize = 4096 * 4;
+
+  std::vector<void *> Slabs;
+
+  /** Free space left in the current slab. */
+  char *CurPtr = nullptr;
+  char *End = nullptr;
+
+  size_t BytesAllocated = 0;
+
+public:
+  BumpAllocator() = default;
+  ~BumpAllocator() {
+    for (void *Slab : Slabs)
+      std::free(Slab);
+  }
+
+  void *Allocate(size_t Size, size_t Alignment) {
+    assert(Alignment && !(Alignment & (Alignment - 1)) &&
+           "Alignment is not a power of two!");
+    BytesAllocated += Size;
+
+    uintptr_t Aligned = (reinterpret_cast<uintptr_t>(CurPtr) + Alignment - 1) &
+                        ~(Alignment - 1);
+    if (CurPtr && Aligned + Size <= reinterpret_cast<uintptr_t>(End)) {
+      CurPtr = reinterpret_cast<char *>(Aligned + Size);
+      return reinterpret_cast<void *>(Aligned);
+    }
+
+    // Oversized allocations get a slab of their own, so the current slab can
+    // still be used for the following small ones.
+    size_t PaddedSize = Size + Alignment - 1;
+    if (PaddedSize > SlabSize) {
+      void *Slab = std::malloc(PaddedSize);
+      Slabs.push_back(Slab);
+      return reinterpret_cast<void *>(
+          (reinterpret_cast<uintptr_t>(Slab) + Alignment - 1) &
+          ~(Alignment - 1));
+    }
+
+    char *Slab = static_cast<char *>(std::malloc(SlabSize));
+    Slabs.push_back(Slab);
+    End = Slab + SlabSize;
+
+    Aligned = (reinterpret_cast<uintptr_t>(Slab) + Alignment - 1) &
+              ~(Alignment - 1);
+    CurPtr = reinterpret_cast<char *>(Aligned + Size);
+    return reinterpret_cast<void *>(Aligned);
+  }
+
+  /** Allocate uninitialized space for Num objects of type T. */
+  template <typename T>
+  T *Allocate(size_t Num = 1) {
+    return static_cast<T *>(Allocate(Num * sizeof(T), alignof(T)));
+  }
+
+  size_t GetBytesAllocated() const { return BytesAllocated; }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef BIT_VECTOR_H
+#define BIT_VECTOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Dense vector of bits, stored 64 to a word. Unlike std::vector<bool>, the
+ * words are accessible for counting and scanning many bits at once.
+ */
+class BitVector {
+  std::vector<uint64_t> Words;
+  size_t NumBits = 0;
+
+  static constexpr unsigned BitsPerWord = 64;
+
+public:
+  size_t size() const { return NumBits; }
+  bool empty() const { return NumBits == 0; }
+
+  /** Grow or shrink to N bits, new bits are clear. */
+  void resize(size_t N) {
+    // Clear the bits past the end in the last word, growing exposes them.
+    if (N > NumBits && NumBits % BitsPerWord)
+      Words.back() &= (uint64_t(1) << (NumBits % BitsPerWord)) - 1;
+    Words.resize((N + BitsPerWord - 1) / BitsPerWord, 0);
+    NumBits = N;
+  }
+
+  void clear() {
+    Words.clear();
+    NumBits = 0;
+  }
+
+  bool Test(size_t Index) const {
+    assert(Index < NumBits && "Bit index out of range!");
+    return (Words[Index / BitsPerWord] >> (Index % BitsPerWord)) & 1;
+  }
+
+  void Set(size_t Index) {
+    assert(Index < NumBits && "Bit index out of range!");
+    Words[Index / BitsPerWord] |= uint64_t(1) << (Index % BitsPerWord);
+  }
+
+  /**
+   * Test and Set for bits set by one thread while others test them: a reader
+   * that sees the bit set also sees what was written before setting it.
+   */
+  bool TestAcquire(size_t Index) const {
+    assert(Index < NumBits && "Bit index out of range!");
+    uint64_t Word =
+        __atomic_load_n(&Words[Index / BitsPerWord], __ATOMIC_ACQUIRE);
+    return (Word >> (Index % BitsPerWord)) & 1;
+  }
+
+  void SetRelease(size_t Index) {
+    assert(Index < NumBits && "Bit index out of range!");
+    __atomic_fetch_or(&Words[Index / BitsPerWord],
+                      uint64_t(1) << (Index % BitsPerWord), __ATOMIC_RELEASE);
+  }
+
+  void Reset(size_t Index) {
+    assert(Index < NumBits && "Bit index out of range!");
+    Words[Index / BitsPerWord] &= ~(uint64_t(1) << (Index % BitsPerWord));
+  }
+
+  /** Number of set bits. */
+  size_t Count() const {
+    size_t Result = 0;
+    for (size_t I = 0; I < Words.size(); ++I) {
+      uint64_t Word = Words[I];
+      if (I == Words.size() - 1 && NumBits % BitsPerWord)
+        Word &= (uint64_t(1) << (NumBits % BitsPerWord)) - 1;
+      Result += __builtin_popcountll(Word);
+    }
+    return Result;
+  }
+};
+
+#endif
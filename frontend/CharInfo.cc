@@ -0,0 +1,136 @@
+#include "CharInfo.h"
+
+/**
+ * Character classes of the ASCII range, indexed by the unsigned value of the
+ * character. Bytes outside the range have no class.
+ */
+uint16_t InfoTable[256] = {
+    0, // NUL
+    0, // SOH
+    0, // STX
+    0, // ETX
+    0, // EOT
+    0, // ENQ
+    0, // ACK
+    0, // BEL
+    0, // BS
+    CHAR_HORZ_WS, // HT
+    CHAR_VERT_WS, // LF
+    CHAR_HORZ_WS, // VT
+    CHAR_HORZ_WS, // FF
+    CHAR_VERT_WS, // CR
+    0, // SO
+    0, // SI
+    0, // DLE
+    0, // DC1
+    0, // DC2
+    0, // DC3
+    0, // DC4
+    0, // NAK
+    0, // SYN
+    0, // ETB
+    0, // CAN
+    0, // EM
+    0, // SUB
+    0, // ESC
+    0, // FS
+    0, // GS
+    0, // RS
+    0, // US
+    CHAR_SPACE, // ' '
+    CHAR_RAWDEL, // '!'
+    CHAR_RAWDEL, // '"'
+    CHAR_RAWDEL, // '#'
+    CHAR_PUNCT, // '$'
+    CHAR_RAWDEL, // '%'
+    CHAR_RAWDEL, // '&'
+    CHAR_RAWDEL, // '\''
+    CHAR_PUNCT, // '('
+    CHAR_PUNCT, // ')'
+    CHAR_RAWDEL, // '*'
+    CHAR_RAWDEL, // '+'
+    CHAR_RAWDEL, // ','
+    CHAR_RAWDEL, // '-'
+    CHAR_PERIOD, // '.'
+    CHAR_RAWDEL, // '/'
+    CHAR_DIGIT, // '0'
+    CHAR_DIGIT, // '1'
+    CHAR_DIGIT, // '2'
+    CHAR_DIGIT, // '3'
+    CHAR_DIGIT, // '4'
+    CHAR_DIGIT, // '5'
+    CHAR_DIGIT, // '6'
+    CHAR_DIGIT, // '7'
+    CHAR_DIGIT, // '8'
+    CHAR_DIGIT, // '9'
+    CHAR_RAWDEL, // ':'
+    CHAR_RAWDEL, // ';'
+    CHAR_RAWDEL, // '<'
+    CHAR_RAWDEL, // '='
+    CHAR_RAWDEL, // '>'
+    CHAR_RAWDEL, // '?'
+    CHAR_PUNCT, // '@'
+    CHAR_XLETTER | CHAR_UPPER, // 'A'
+    CHAR_XLETTER | CHAR_UPPER, // 'B'
+    CHAR_XLETTER | CHAR_UPPER, // 'C'
+    CHAR_XLETTER | CHAR_UPPER, // 'D'
+    CHAR_XLETTER | CHAR_UPPER, // 'E'
+    CHAR_XLETTER | CHAR_UPPER, // 'F'
+    CHAR_UPPER, // 'G'
+    CHAR_UPPER, // 'H'
+    CHAR_UPPER, // 'I'
+    CHAR_UPPER, // 'J'
+    CHAR_UPPER, // 'K'
+    CHAR_UPPER, // 'L'
+    CHAR_UPPER, // 'M'
+    CHAR_UPPER, // 'N'
+    CHAR_UPPER, // 'O'
+    CHAR_UPPER, // 'P'
+    CHAR_UPPER, // 'Q'
+    CHAR_UPPER, // 'R'
+    CHAR_UPPER, // 'S'
+    CHAR_UPPER, // 'T'
+    CHAR_UPPER, // 'U'
+    CHAR_UPPER, // 'V'
+    CHAR_UPPER, // 'W'
+    CHAR_UPPER, // 'X'
+    CHAR_UPPER, // 'Y'
+    CHAR_UPPER, // 'Z'
+    CHAR_RAWDEL, // '['
+    CHAR_PUNCT, // '\\'
+    CHAR_RAWDEL, // ']'
+    CHAR_RAWDEL, // '^'
+    CHAR_UNDER, // '_'
+    CHAR_PUNCT, // '`'
+    CHAR_XLETTER | CHAR_LOWER, // 'a'
+    CHAR_XLETTER | CHAR_LOWER, // 'b'
+    CHAR_XLETTER | CHAR_LOWER, // 'c'
+    CHAR_XLETTER | CHAR_LOWER, // 'd'
+    CHAR_XLETTER | CHAR_LOWER, // 'e'
+    CHAR_XLETTER | CHAR_LOWER, // 'f'
+    CHAR_LOWER, // 'g'
+    CHAR_LOWER, // 'h'
+    CHAR_LOWER, // 'i'
+    CHAR_LOWER, // 'j'
+    CHAR_LOWER, // 'k'
+    CHAR_LOWER, // 'l'
+    CHAR_LOWER, // 'm'
+    CHAR_LOWER, // 'n'
+    CHAR_LOWER, // 'o'
+    CHAR_LOWER, // 'p'
+    CHAR_LOWER, // 'q'
+    CHAR_LOWER, // 'r'
+    CHAR_LOWER, // 's'
+    CHAR_LOWER, // 't'
+    CHAR_LOWER, // 'u'
+    CHAR_LOWER, // 'v'
+    CHAR_LOWER, // 'w'
+    CHAR_LOWER, // 'x'
+    CHAR_LOWER, // 'y'
+    CHAR_LOWER, // 'z'
+    CHAR_RAWDEL, // '{'
+    CHAR_RAWDEL, // '|'
+    CHAR_RAWDEL, // '}'
+    CHAR_RAWDEL, // '~'
+    0, // DEL
+};
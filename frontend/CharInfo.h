@@ -53,6 +53,21 @@ inline bool IsVerticalWhitespace(unsigned char C) {
   return (InfoTable[C] & (CHAR_VERT_WS));
 }
 
-inline bool IsPreprocessingNumber(unsigned char C) {}
+/**
+ * Returns true if this character can continue an identifier:
+ *  [a-zA-Z0-9_]
+ */
+inline bool IsAsciiIdentifierContinue(unsigned char C) {
+  return (InfoTable[C] & (CHAR_UPPER | CHAR_LOWER | CHAR_DIGIT | CHAR_UNDER));
+}
+
+/**
+ * Returns true if this character can continue a preprocessing number:
+ *  [a-zA-Z0-9_.]
+ */
+inline bool IsPreprocessingNumber(unsigned char C) {
+  return (InfoTable[C] &
+          (CHAR_UPPER | CHAR_LOWER | CHAR_DIGIT | CHAR_UNDER | CHAR_PERIOD));
+}
 
 #endif
\ No newline at end of file
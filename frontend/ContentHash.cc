@@ -0,0 +1,159 @@
+#include "ContentHash.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The buffer is consumed in 64-byte stripes by eight 64-bit accumulators.
+ * Each stripe word is mixed with a key by a 32x32->64 bit multiply, which
+ * SSE2 does two lanes at a time; the word itself is added to the
+ * neighbouring lane so that no input bits are lost. Stripe N of a block uses
+ * the keys shifted by N, so reordering stripes changes the hash. After every
+ * block of 16 stripes the accumulators are scrambled. The SSE2 and scalar
+ * versions compute the same hash, which ends up in files on disk.
+ */
+
+static constexpr unsigned NumLanes = 8;
+static constexpr unsigned StripeSize = NumLanes * sizeof(uint64_t);
+static constexpr unsigned StripesPerBlock = 16;
+
+static constexpr uint32_t ScramblePrime = 0x9e3779b1U;
+
+alignas(16) static const uint64_t Keys[StripesPerBlock + NumLanes] = {
+    0x2cb0f69f4abea221ULL, 0x9417034723148989ULL, 0xdd555950609dfe03ULL,
+    0xdbafb150deb12800ULL, 0x7e789b2e6c442cb6ULL, 0xf41e5636c7e4f8c4ULL,
+    0x0959d150f8fba7e4ULL, 0xa97316f13cdb9eeaULL, 0x74cd8258f9520068ULL,
+    0x55c74a62e116868bULL, 0xd2f4c799a2023cbdULL, 0xdf98cb79a37b51b9ULL,
+    0x396f5885524f3905ULL, 0xaf1d56386ca3b276ULL, 0xa9ffbe6b5104e85aULL,
+    0x6bd0c51b9fd533b3ULL, 0x980ce91c50ab4b56ULL, 0x28ac395780fe62c5ULL,
+    0x768912e3a6bcedc7ULL, 0x50b3e8c9332c7c88ULL, 0xce3bbfe520bd47daULL,
+    0xcba6c8e8e0bb7c4fULL, 0xbf194db8434a346dULL, 0x7d8f2a7b60416d7fULL,
+};
+
+#ifdef __SSE2__
+
+static inline void
+AccumulateStripe(__m128i *Acc, const char *Data, const uint64_t *Key) {
+  for (unsigned I = 0; I < NumLanes / 2; ++I) {
+    __m128i Words =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(Data) + I);
+    __m128i KeyWords =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(Key) + I);
+    __m128i DataKey = _mm_xor_si128(Words, KeyWords);
+
+    // Low half times high half of each 64-bit lane.
+    __m128i Product = _mm_mul_epu32(
+        DataKey, _mm_shuffle_epi32(DataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+    // Swap the two lanes, each word goes to its neighbour.
+    __m128i Swapped = _mm_shuffle_epi32(Words, _MM_SHUFFLE(1, 0, 3, 2));
+    Acc[I] = _mm_add_epi64(Acc[I], _mm_add_epi64(Product, Swapped));
+  }
+}
+
+static inline void
+ScrambleAccumulators(__m128i *Acc) {
+  const __m128i Prime = _mm_set1_epi32(ScramblePrime);
+  const __m128i *Key =
+      reinterpret_cast<const __m128i *>(Keys + StripesPerBlock);
+  for (unsigned I = 0; I < NumLanes / 2; ++I) {
+    __m128i Value = _mm_xor_si128(Acc[I], _mm_srli_epi64(Acc[I], 47));
+    Value = _mm_xor_si128(Value, _mm_load_si128(Key + I));
+
+    // 64x32 bit multiply from two 32x32 bit ones.
+    __m128i Low = _mm_mul_epu32(Value, Prime);
+    __m128i High = _mm_mul_epu32(_mm_srli_epi64(Value, 32), Prime);
+    Acc[I] = _mm_add_epi64(Low, _mm_slli_epi64(High, 32));
+  }
+}
+
+#else
+
+static inline void
+AccumulateStripe(uint64_t *Acc, const char *Data, const uint64_t *Key) {
+  for (unsigned I = 0; I < NumLanes; ++I) {
+    uint64_t Word;
+    std::memcpy(&Word, Data + I * sizeof(uint64_t), sizeof(Word));
+    uint64_t DataKey = Word ^ Key[I];
+    Acc[I ^ 1] += Word;
+    Acc[I] += (DataKey & 0xffffffffU) * (DataKey >> 32);
+  }
+}
+
+static inline void
+ScrambleAccumulators(uint64_t *Acc) {
+  for (unsigned I = 0; I < NumLanes; ++I) {
+    uint64_t Value = Acc[I] ^ (Acc[I] >> 47);
+    Value ^= Keys[StripesPerBlock + I];
+    Acc[I] = Value * ScramblePrime;
+  }
+}
+
+#endif
+
+/** Fold the 128-bit product of A and B into 64 bits. */
+static inline uint64_t
+MultiplyFold(uint64_t A, uint64_t B) {
+  unsigned __int128 Product = static_cast<unsigned __int128>(A) * B;
+  return static_cast<uint64_t>(Product) ^
+         static_cast<uint64_t>(Product >> 64);
+}
+
+static inline uint64_t
+Avalanche(uint64_t Hash) {
+  Hash ^= Hash >> 37;
+  Hash *= 0x165667919e3779f9ULL;
+  Hash ^= Hash >> 32;
+  return Hash;
+}
+
+ContentHash
+ContentHash::Compute(const char *Data, size_t Size) {
+#ifdef __SSE2__
+  __m128i Acc[NumLanes / 2];
+#else
+  uint64_t Acc[NumLanes];
+#endif
+  alignas(16) uint64_t InitialAcc[NumLanes] = {
+      0x9e3779b1ULL,         0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL,
+      0x165667b19e3779f9ULL, 0x85ebca77c2b2ae63ULL, 0x85ebca77ULL,
+      0x27d4eb2f165667c5ULL, 0x61c8864fULL,
+  };
+  std::memcpy(Acc, InitialAcc, sizeof(Acc));
+
+  const size_t BlockSize = StripeSize * StripesPerBlock;
+  size_t Offset = 0;
+  for (; Offset + BlockSize <= Size; Offset += BlockSize) {
+    for (unsigned Stripe = 0; Stripe < StripesPerBlock; ++Stripe)
+      AccumulateStripe(Acc, Data + Offset + Stripe * StripeSize, Keys + Stripe);
+    ScrambleAccumulators(Acc);
+  }
+
+  unsigned Stripe = 0;
+  for (; Offset + StripeSize <= Size; Offset += StripeSize, ++Stripe)
+    AccumulateStripe(Acc, Data + Offset, Keys + Stripe);
+
+  // The rest, padded with zeros. The size is mixed in at the end, so padding
+  // does not make different buffers collide.
+  alignas(16) char Tail[StripeSize] = {};
+  std::memcpy(Tail, Data + Offset, Size - Offset);
+  AccumulateStripe(Acc, Tail, Keys + Stripe);
+
+  uint64_t Lanes[NumLanes];
+  std::memcpy(Lanes, Acc, sizeof(Lanes));
+
+  ContentHash Result;
+  Result.Low = Size * 0x9e3779b185ebca87ULL;
+  Result.High = ~Size * 0xc2b2ae3d27d4eb4fULL;
+  for (unsigned I = 0; I < NumLanes / 2; ++I) {
+    Result.Low += MultiplyFold(Lanes[2 * I] ^ Keys[I],
+                               Lanes[2 * I + 1] ^ Keys[I + NumLanes]);
+    Result.High += MultiplyFold(Lanes[2 * I] ^ Keys[I + 4],
+                                Lanes[2 * I + 1] ^ Keys[I + 12]);
+  }
+  Result.Low = Avalanche(Result.Low);
+  Result.High = Avalanche(Result.High);
+  return Result;
+}
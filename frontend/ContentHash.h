@@ -0,0 +1,36 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* ========================================================
+ *  ContentHash
+ * ========================================================
+ */
+
+/**
+ * 128-bit hash of the contents of a buffer. Not cryptographic: it tells
+ * apart files that differ, so identical files can share their buffer and
+ * persistent caches can be keyed by the contents of what they were built
+ * from.
+ */
+struct ContentHash {
+  uint64_t Low = 0;
+  uint64_t High = 0;
+
+  bool operator==(const ContentHash &Other) const {
+    return Low == Other.Low && High == Other.High;
+  }
+  bool operator!=(const ContentHash &Other) const { return !(*this == Other); }
+
+  /** Hash the Size bytes at Data. */
+  static ContentHash Compute(const char *Data, size_t Size);
+};
+
+/** For unordered containers keyed by a ContentHash. */
+struct ContentHashHasher {
+  size_t operator()(const ContentHash &Hash) const { return Hash.Low; }
+};
+
+#endif
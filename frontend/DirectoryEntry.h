@@ -1,10 +1,55 @@
 #ifndef DIRECTORY_ENTRY_H
 #define DIRECTORY_ENTRY_H
 
+#include "Mixins.h"
+
 #include <string>
+#include <unordered_map>
+
+/**
+ * A directory on disk, or made up to hold in-memory files, uniqued by the
+ * FileManager.
+ */
+class DirectoryEntry : private NonCopyable<DirectoryEntry> {
+  friend class FileManager;
+
+  std::string Name;
+
+public:
+  /** What a name in the directory listing refers to. */
+  enum EntryKind : unsigned char {
+    /** Not in the listing. */
+    EK_None,
+    EK_File,
+    EK_Directory,
+    /** Symlinks, special files, or the listing could not be read. */
+    EK_Unknown,
+  };
+
+private:
+  /**
+   * Names in this directory, read at once on the first lookup. Resolving a
+   * name is then a hash probe instead of a stat.
+   */
+  mutable std::unordered_map<std::string, EntryKind> Listing;
+
+  mutable bool bListingLoaded = false;
+  mutable bool bListingFailed = false;
+
+  /** True if the directory is not on disk, its listing stays empty. */
+  bool bIsVirtual = false;
+
+  /**
+   * In-memory files and the directories leading to them, found before the
+   * listing. Kept when the listing is cleared.
+   */
+  std::unordered_map<std::string, EntryKind> VirtualListing;
+
+public:
+  DirectoryEntry() {}
+  ~DirectoryEntry() = default;
 
-class DirectoryEntry {
- 
+  const std::string &GetName() const { return Name; }
 };
 
 #endif
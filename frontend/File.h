@@ -3,7 +3,11 @@
 
 #include "Mixins.h"
 
+#include <cstdint>
 #include <string>
+#include <sys/types.h>
+
+class DirectoryEntry;
 
 class FileEntry : private NonCopyable<FileEntry> {
   friend class FileManager;
@@ -11,6 +15,19 @@ class FileEntry : private NonCopyable<FileEntry> {
   std::string RealPathName;
   off_t Size;
 
+  /** Last modification, in nanoseconds since the epoch. */
+  int64_t ModificationTime = 0;
+
+  /** Identify the file on disk, whatever path it was found by. */
+  dev_t Device;
+  ino_t Inode;
+
+  /** The directory the file resides in. */
+  const DirectoryEntry *Dir = nullptr;
+
+  /** Contents of an in-memory file, null for files on disk. */
+  const char *VirtualData = nullptr;
+
   bool bIsValid = false;
 
 public:
@@ -18,8 +35,18 @@ public:
   ~FileEntry() = default;
 
   std::string GetRealPathName() const { return RealPathName; }
+  const DirectoryEntry *GetDir() const { return Dir; }
   bool IsValid() const { return bIsValid; }
   off_t GetSize() const { return Size; }
+  int64_t GetModificationTime() const { return ModificationTime; }
+  dev_t GetDevice() const { return Device; }
+  ino_t GetInode() const { return Inode; }
+
+  /** True for in-memory files, see FileManager::AddVirtualFile. */
+  bool IsVirtual() const { return VirtualData != nullptr; }
+
+  /** Contents of an in-memory file, null terminated at GetSize(). */
+  const char *GetVirtualData() const { return VirtualData; }
 };
 
 #endif
\ No newline at end of file
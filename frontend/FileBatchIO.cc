@@ -0,0 +1,368 @@
+#include "FileBatchIO.h"
+
+#include "FileManager.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+/* ========================================================
+ *  Ring
+ * ========================================================
+ */
+
+#ifdef HAVE_IO_URING
+/**
+ * Minimal io_uring set up with the raw system calls, so liburing is not
+ * needed. Entries are submitted in chunks of at most the ring size and every
+ * chunk is waited for before the next one.
+ */
+struct FileBatchIO::Ring : private NonCopyable<Ring> {
+  int FD = -1;
+
+  unsigned Entries = 0;
+
+  /* Submission queue. */
+  unsigned *SQHead, *SQTail, *SQMask, *SQArray;
+  io_uring_sqe *SQEs = nullptr;
+
+  /* Completion queue. */
+  unsigned *CQHead, *CQTail, *CQMask;
+  io_uring_cqe *CQEs;
+
+  void *SQRing = MAP_FAILED, *CQRing = MAP_FAILED;
+  size_t SQRingSize = 0, CQRingSize = 0, SQEsSize = 0;
+
+  Ring() {}
+  ~Ring();
+
+  /** Returns false if the kernel does not give us a ring. */
+  bool Init(unsigned NumEntries);
+
+  /**
+   * Run Count operations. Prepare fills in the operation for an index, and
+   * Results receives the result of each, a negated errno on failure.
+   */
+  void Run(unsigned Count,
+           const std::function<void(io_uring_sqe &, unsigned)> &Prepare,
+           std::vector<int> &Results);
+};
+
+FileBatchIO::Ring::~Ring() {
+  if (SQEs)
+    ::munmap(SQEs, SQEsSize);
+  if (CQRing != MAP_FAILED && CQRing != SQRing)
+    ::munmap(CQRing, CQRingSize);
+  if (SQRing != MAP_FAILED)
+    ::munmap(SQRing, SQRingSize);
+  if (FD >= 0)
+    ::close(FD);
+}
+
+bool
+FileBatchIO::Ring::Init(unsigned NumEntries) {
+  io_uring_params Params;
+  std::memset(&Params, 0, sizeof(Params));
+  FD = ::syscall(__NR_io_uring_setup, NumEntries, &Params);
+  if (FD < 0)
+    return false;
+
+  Entries = Params.sq_entries;
+
+  SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+  CQRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+  if (Params.features & IORING_FEAT_SINGLE_MMAP)
+    SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+
+  SQRing = ::mmap(nullptr, SQRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_SQ_RING);
+  if (SQRing == MAP_FAILED)
+    return false;
+
+  if (Params.features & IORING_FEAT_SINGLE_MMAP) {
+    CQRing = SQRing;
+  } else {
+    CQRing = ::mmap(nullptr, CQRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_CQ_RING);
+    if (CQRing == MAP_FAILED)
+      return false;
+  }
+
+  SQEsSize = Params.sq_entries * sizeof(io_uring_sqe);
+  void *SQEsPtr = ::mmap(nullptr, SQEsSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_SQES);
+  if (SQEsPtr == MAP_FAILED)
+    return false;
+  SQEs = static_cast<io_uring_sqe *>(SQEsPtr);
+
+  char *SQBase = static_cast<char *>(SQRing);
+  SQHead = reinterpret_cast<unsigned *>(SQBase + Params.sq_off.head);
+  SQTail = reinterpret_cast<unsigned *>(SQBase + Params.sq_off.tail);
+  SQMask = reinterpret_cast<unsigned *>(SQBase + Params.sq_off.ring_mask);
+  SQArray = reinterpret_cast<unsigned *>(SQBase + Params.sq_off.array);
+
+  char *CQBase = static_cast<char *>(CQRing);
+  CQHead = reinterpret_cast<unsigned *>(CQBase + Params.cq_off.head);
+  CQTail = reinterpret_cast<unsigned *>(CQBase + Params.cq_off.tail);
+  CQMask = reinterpret_cast<unsigned *>(CQBase + Params.cq_off.ring_mask);
+  CQEs = reinterpret_cast<io_uring_cqe *>(CQBase + Params.cq_off.cqes);
+  return true;
+}
+
+void
+FileBatchIO::Ring::Run(
+    unsigned Count,
+    const std::function<void(io_uring_sqe &, unsigned)> &Prepare,
+    std::vector<int> &Results) {
+  Results.assign(Count, -ECANCELED);
+
+  for (unsigned Start = 0; Start < Count; Start += Entries) {
+    unsigned ChunkSize = std::min(Entries, Count - Start);
+
+    // The ring is empty between chunks, so there is room for all of them.
+    unsigned Tail = *SQTail;
+    for (unsigned I = 0; I < ChunkSize; ++I) {
+      unsigned SlotIndex = (Tail + I) & *SQMask;
+      io_uring_sqe &SQE = SQEs[SlotIndex];
+      std::memset(&SQE, 0, sizeof(SQE));
+      Prepare(SQE, Start + I);
+      SQE.user_data = Start + I;
+      SQArray[SlotIndex] = SlotIndex;
+    }
+    __atomic_store_n(SQTail, Tail + ChunkSize, __ATOMIC_RELEASE);
+
+    unsigned Completed = 0;
+    unsigned ToSubmit = ChunkSize;
+    while (Completed < ChunkSize) {
+      int Ret = ::syscall(__NR_io_uring_enter, FD, ToSubmit,
+                          ChunkSize - Completed, IORING_ENTER_GETEVENTS,
+                          nullptr, 0);
+      if (Ret < 0) {
+        if (errno == EINTR)
+          continue;
+        // Leave the remaining results at -ECANCELED, the caller falls back
+        // to the plain system calls for them.
+        return;
+      }
+      ToSubmit -= std::min<unsigned>(Ret, ToSubmit);
+
+      unsigned Head = *CQHead;
+      unsigned CQTailNow = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+      for (; Head != CQTailNow; ++Head) {
+        const io_uring_cqe &CQE = CQEs[Head & *CQMask];
+        Results[CQE.user_data] = CQE.res;
+        ++Completed;
+      }
+      __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+    }
+  }
+}
+#else
+struct FileBatchIO::Ring {};
+#endif
+
+/* ========================================================
+ *  FileBatchIO
+ * ========================================================
+ */
+
+FileBatchIO::FileBatchIO() {
+#ifdef HAVE_IO_URING
+  std::unique_ptr<Ring> NewRing(new Ring());
+  if (NewRing->Init(64))
+    TheRing = std::move(NewRing);
+#endif
+}
+
+FileBatchIO::~FileBatchIO() = default;
+
+/* stat Path with the plain system call. */
+static void
+StatFile(const std::string &Path, FileBatchIO::StatResult &Result) {
+  struct stat StatBuf;
+  Result = FileBatchIO::StatResult();
+  if (::stat(Path.c_str(), &StatBuf) != 0 || !S_ISREG(StatBuf.st_mode))
+    return;
+
+  Result.bIsRegularFile = true;
+  Result.Size = StatBuf.st_size;
+  Result.ModificationTime =
+      StatBuf.st_mtim.tv_sec * INT64_C(1000000000) + StatBuf.st_mtim.tv_nsec;
+  Result.Device = StatBuf.st_dev;
+  Result.Inode = StatBuf.st_ino;
+}
+
+/* Was an io_uring operation not run, or not supported by the kernel? */
+static bool
+NeedsFallback(int Result) {
+  return Result == -ECANCELED || Result == -EINVAL || Result == -EOPNOTSUPP;
+}
+
+void
+FileBatchIO::StatFiles(const std::vector<std::string> &Paths,
+                       std::vector<StatResult> &Results) {
+  Results.assign(Paths.size(), StatResult());
+
+#ifdef HAVE_IO_URING
+  if (TheRing) {
+    std::vector<struct statx> StatxBufs(Paths.size());
+    std::vector<int> Ret;
+    TheRing->Run(
+        Paths.size(),
+        [&](io_uring_sqe &SQE, unsigned I) {
+          SQE.opcode = IORING_OP_STATX;
+          SQE.fd = AT_FDCWD;
+          SQE.addr = reinterpret_cast<uintptr_t>(Paths[I].c_str());
+          SQE.len = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME;
+          SQE.off = reinterpret_cast<uintptr_t>(&StatxBufs[I]);
+        },
+        Ret);
+
+    for (unsigned I = 0; I < Paths.size(); ++I) {
+      if (NeedsFallback(Ret[I])) {
+        StatFile(Paths[I], Results[I]);
+        continue;
+      }
+
+      const struct statx &Buf = StatxBufs[I];
+      if (Ret[I] < 0 || !S_ISREG(Buf.stx_mode))
+        continue;
+
+      Results[I].bIsRegularFile = true;
+      Results[I].Size = Buf.stx_size;
+      Results[I].ModificationTime =
+          Buf.stx_mtime.tv_sec * INT64_C(1000000000) + Buf.stx_mtime.tv_nsec;
+      Results[I].Device = makedev(Buf.stx_dev_major, Buf.stx_dev_minor);
+      Results[I].Inode = Buf.stx_ino;
+    }
+    return;
+  }
+#endif
+
+  for (unsigned I = 0; I < Paths.size(); ++I)
+    StatFile(Paths[I], Results[I]);
+}
+
+void
+FileBatchIO::ReadFiles(const std::vector<const FileEntry *> &Files,
+                       std::vector<std::string> &Buffers,
+                       std::vector<char> &Succeeded) {
+  Buffers.assign(Files.size(), std::string());
+  Succeeded.assign(Files.size(), false);
+
+#ifdef HAVE_IO_URING
+  if (TheRing) {
+    // Open all, read all, then close all: three chunks of work for the
+    // kernel, instead of three system calls per file.
+    std::vector<std::string> Paths(Files.size());
+    for (unsigned I = 0; I < Files.size(); ++I)
+      Paths[I] = Files[I]->GetRealPathName();
+
+    std::vector<int> FDs;
+    TheRing->Run(
+        Files.size(),
+        [&](io_uring_sqe &SQE, unsigned I) {
+          SQE.opcode = IORING_OP_OPENAT;
+          SQE.fd = AT_FDCWD;
+          SQE.addr = reinterpret_cast<uintptr_t>(Paths[I].c_str());
+          SQE.open_flags = O_RDONLY | O_CLOEXEC;
+        },
+        FDs);
+
+    std::vector<unsigned> Opened;
+    for (unsigned I = 0; I < Files.size(); ++I) {
+      if (FDs[I] >= 0) {
+        // One byte more than the stat said, to see if the file grew.
+        Buffers[I].resize(Files[I]->GetSize() + 1);
+        Opened.push_back(I);
+      } else if (NeedsFallback(FDs[I])) {
+        Succeeded[I] = FileManager::ReadFile(Files[I], Buffers[I]);
+      }
+    }
+
+    // The size from the stat is only a hint, as in FileManager::ReadFile, the
+    // file may have changed since. Read in rounds until every file hit its
+    // end: a read of a regular file only returns less than asked for at the
+    // end, so unless a file grew, one round is enough.
+    std::vector<size_t> Lengths(Files.size(), 0);
+    std::vector<unsigned> Pending = Opened;
+    std::vector<int> Read;
+    while (!Pending.empty()) {
+      for (unsigned Index : Pending) {
+        if (Lengths[Index] == Buffers[Index].size())
+          Buffers[Index].resize(Buffers[Index].size() * 2 + 4096);
+      }
+
+      TheRing->Run(
+          Pending.size(),
+          [&](io_uring_sqe &SQE, unsigned I) {
+            unsigned Index = Pending[I];
+            SQE.opcode = IORING_OP_READ;
+            SQE.fd = FDs[Index];
+            SQE.addr =
+                reinterpret_cast<uintptr_t>(&Buffers[Index][Lengths[Index]]);
+            SQE.len = Buffers[Index].size() - Lengths[Index];
+            SQE.off = Lengths[Index];
+          },
+          Read);
+
+      std::vector<unsigned> StillPending;
+      for (unsigned I = 0; I < Pending.size(); ++I) {
+        unsigned Index = Pending[I];
+        if (Read[I] >= 0) {
+          size_t Requested = Buffers[Index].size() - Lengths[Index];
+          Lengths[Index] += Read[I];
+          if (static_cast<size_t>(Read[I]) == Requested) {
+            StillPending.push_back(Index);
+            continue;
+          }
+          Buffers[Index].resize(Lengths[Index]);
+          Succeeded[Index] = true;
+        } else if (Read[I] == -EINTR || Read[I] == -EAGAIN) {
+          StillPending.push_back(Index);
+        } else if (NeedsFallback(Read[I])) {
+          Succeeded[Index] =
+              FileManager::ReadFile(Files[Index], Buffers[Index]);
+        }
+      }
+      Pending.swap(StillPending);
+    }
+
+    std::vector<int> Closed;
+    TheRing->Run(
+        Opened.size(),
+        [&](io_uring_sqe &SQE, unsigned I) {
+          SQE.opcode = IORING_OP_CLOSE;
+          SQE.fd = FDs[Opened[I]];
+        },
+        Closed);
+
+    for (unsigned I = 0; I < Opened.size(); ++I) {
+      if (NeedsFallback(Closed[I]))
+        ::close(FDs[Opened[I]]);
+    }
+    return;
+  }
+#endif
+
+  for (unsigned I = 0; I < Files.size(); ++I)
+    Succeeded[I] = FileManager::ReadFile(Files[I], Buffers[I]);
+}
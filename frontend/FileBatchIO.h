@@ -0,0 +1,63 @@
+#ifndef FILE_BATCH_IO_H
+#define FILE_BATCH_IO_H
+
+#include "Mixins.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+class FileEntry;
+
+/* ========================================================
+ *  FileBatchIO
+ * ========================================================
+ */
+
+/**
+ * Stats and reads batches of files. On Linux, the operations of a batch are
+ * submitted to an io_uring together, so a batch of N files costs a handful of
+ * system calls instead of several per file, and the kernel works on all of
+ * them at once. Without io_uring, because the kernel is too old or a seccomp
+ * filter refuses it, each file is handled with the usual system calls.
+ *
+ * Not thread safe, every thread needs its own.
+ */
+class FileBatchIO : private NonCopyable<FileBatchIO> {
+  struct Ring;
+  std::unique_ptr<Ring> TheRing;
+
+public:
+  FileBatchIO();
+  ~FileBatchIO();
+
+  /** True if batches go through an io_uring. */
+  bool HasRing() const { return TheRing != nullptr; }
+
+  struct StatResult {
+    /** True if the path names a regular file, the rest is valid then. */
+    bool bIsRegularFile = false;
+    off_t Size = 0;
+    /** In nanoseconds since the epoch. */
+    int64_t ModificationTime = 0;
+    dev_t Device = 0;
+    ino_t Inode = 0;
+  };
+
+  /** stat every path of Paths into the matching entry of Results. */
+  void StatFiles(const std::vector<std::string> &Paths,
+                 std::vector<StatResult> &Results);
+
+  /**
+   * Read every file of Files into the matching entry of Buffers. Succeeded[I]
+   * is false if Files[I] cannot be read. The size from the FileEntry is used,
+   * as for the stat the file was found by.
+   */
+  void ReadFiles(const std::vector<const FileEntry *> &Files,
+                 std::vector<std::string> &Buffers,
+                 std::vector<char> &Succeeded);
+};
+
+#endif
@@ -0,0 +1,392 @@
+#include "FileManager.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* Returns the directory part of Path, "." if there is none. */
+static std::string
+GetParentPath(const std::string &Path) {
+  std::string::size_type Slash = Path.rfind('/');
+  if (Slash == std::string::npos)
+    return ".";
+  if (Slash == 0)
+    return "/";
+  return Path.substr(0, Slash);
+}
+
+/* Returns the last component of Path. */
+static std::string
+GetBaseName(const std::string &Path) {
+  return Path.substr(Path.rfind('/') + 1);
+}
+
+const FileEntry *
+FileManager::GetFile(const std::string &Path) {
+  auto Seen = SeenFileEntries.find(Path);
+  if (Seen != SeenFileEntries.end()) {
+    ++NumStatCacheHits;
+    return Seen->second;
+  }
+
+  FileBatchIO::StatResult Stat;
+  struct stat StatBuf;
+  ++NumStatCalls;
+  if (::stat(Path.c_str(), &StatBuf) == 0 && S_ISREG(StatBuf.st_mode)) {
+    Stat.bIsRegularFile = true;
+    Stat.Size = StatBuf.st_size;
+    Stat.ModificationTime =
+        StatBuf.st_mtim.tv_sec * INT64_C(1000000000) + StatBuf.st_mtim.tv_nsec;
+    Stat.Device = StatBuf.st_dev;
+    Stat.Inode = StatBuf.st_ino;
+  }
+
+  return AddFile(Path, Stat);
+}
+
+void
+FileManager::StatFiles(const std::vector<std::string> &Paths) {
+  std::vector<std::string> Unseen;
+  for (const std::string &Path : Paths) {
+    if (!SeenFileEntries.count(Path))
+      Unseen.push_back(Path);
+  }
+  if (Unseen.empty())
+    return;
+
+  if (!BatchIO)
+    BatchIO.reset(new FileBatchIO());
+
+  std::vector<FileBatchIO::StatResult> Stats;
+  BatchIO->StatFiles(Unseen, Stats);
+  if (BatchIO->HasRing())
+    NumBatchedStats += Unseen.size();
+  else
+    NumStatCalls += Unseen.size();
+
+  for (unsigned I = 0; I < Unseen.size(); ++I) {
+    // The same path may be in the batch twice.
+    if (!SeenFileEntries.count(Unseen[I]))
+      AddFile(Unseen[I], Stats[I]);
+  }
+}
+
+const FileEntry *
+FileManager::AddFile(const std::string &Path,
+                     const FileBatchIO::StatResult &Stat) {
+  const FileEntry *&Cached = SeenFileEntries[Path];
+  if (!Stat.bIsRegularFile)
+    return Cached = nullptr;
+
+  // Another path to a file we already know.
+  const FileEntry *&Unique = UniqueFiles[{Stat.Device, Stat.Inode}];
+  if (Unique)
+    return Cached = Unique;
+
+  std::unique_ptr<FileEntry> Entry(new FileEntry());
+  Entry->RealPathName = Path;
+  Entry->Size = Stat.Size;
+  Entry->ModificationTime = Stat.ModificationTime;
+  Entry->Device = Stat.Device;
+  Entry->Inode = Stat.Inode;
+  Entry->Dir = GetDirectory(GetParentPath(Path));
+  Entry->bIsValid = true;
+
+  Files.push_back(std::move(Entry));
+  return Cached = Unique = Files.back().get();
+}
+
+void
+FileManager::ClearNegativeStatCache() {
+  for (auto It = SeenFileEntries.begin(); It != SeenFileEntries.end();) {
+    if (!It->second)
+      It = SeenFileEntries.erase(It);
+    else
+      ++It;
+  }
+}
+
+const FileEntry *
+FileManager::AddVirtualFile(const std::string &Path, const char *Data,
+                            size_t Size) {
+  assert(Data[Size] == '\0' && "Buffer is not null terminated!");
+
+  DirectoryEntry *Dir = GetVirtualDirectory(GetParentPath(Path));
+  Dir->VirtualListing[GetBaseName(Path)] = DirectoryEntry::EK_File;
+
+  // No file on disk has this device, so no path to one shares the entry.
+  std::unique_ptr<FileEntry> Entry(new FileEntry());
+  Entry->RealPathName = Path;
+  Entry->Size = Size;
+  Entry->Device = static_cast<dev_t>(-1);
+  Entry->Inode = ++NumVirtualFiles;
+  Entry->Dir = Dir;
+  Entry->VirtualData = Data;
+  Entry->bIsValid = true;
+
+  Files.push_back(std::move(Entry));
+  return SeenFileEntries[Path] = Files.back().get();
+}
+
+bool
+FileManager::ReadFile(const FileEntry *File, std::string &Buffer) {
+  if (File->IsVirtual()) {
+    Buffer.assign(File->GetVirtualData(), File->GetSize());
+    return true;
+  }
+
+  int FD = ::open(File->GetRealPathName().c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD < 0)
+    return false;
+
+  // The size from the stat is only a hint, the file may have changed since.
+  Buffer.resize(File->GetSize());
+  size_t Length = 0;
+  while (true) {
+    if (Length == Buffer.size())
+      Buffer.resize(Buffer.size() * 2 + 4096);
+
+    ssize_t Read = ::read(FD, &Buffer[Length], Buffer.size() - Length);
+    if (Read < 0) {
+      if (errno == EINTR)
+        continue;
+      ::close(FD);
+      return false;
+    }
+    if (Read == 0)
+      break;
+    Length += Read;
+  }
+
+  ::close(FD);
+  Buffer.resize(Length);
+  return true;
+}
+
+bool
+FileManager::GetBufferForFile(const FileEntry *File, std::string &Buffer,
+                              ContentHash &Hash) {
+  if (File->IsVirtual()) {
+    Buffer.assign(File->GetVirtualData(), File->GetSize());
+    Hash = ContentHash::Compute(File->GetVirtualData(), File->GetSize());
+    return true;
+  }
+  if (Prefetcher && Prefetcher->Take(File, Buffer, Hash))
+    return true;
+  if (!ReadFile(File, Buffer))
+    return false;
+
+  // Hash while the contents are still in the cache.
+  Hash = ContentHash::Compute(Buffer.data(), Buffer.size());
+  return true;
+}
+
+void
+FileManager::EnablePrefetching(unsigned NumThreads) {
+  assert(!Prefetcher && "Prefetching is already enabled!");
+  if (NumThreads)
+    Prefetcher.reset(new FilePrefetcher(NumThreads));
+}
+
+const DirectoryEntry *
+FileManager::GetDirectory(const std::string &Path) {
+  std::unique_ptr<DirectoryEntry> &Entry = Dirs[Path];
+  if (Entry)
+    return Entry.get();
+
+  struct stat StatBuf;
+  ++NumStatCalls;
+  if (::stat(Path.c_str(), &StatBuf) != 0 || !S_ISDIR(StatBuf.st_mode)) {
+    Dirs.erase(Path);
+    return nullptr;
+  }
+
+  Entry.reset(new DirectoryEntry());
+  Entry->Name = Path;
+  return Entry.get();
+}
+
+DirectoryEntry *
+FileManager::GetVirtualDirectory(const std::string &Path) {
+  if (GetDirectory(Path))
+    return Dirs[Path].get();
+
+  std::string ParentPath = GetParentPath(Path);
+  DirectoryEntry *Parent =
+      ParentPath != Path ? GetVirtualDirectory(ParentPath) : nullptr;
+  if (Parent)
+    Parent->VirtualListing[GetBaseName(Path)] = DirectoryEntry::EK_Directory;
+
+  // Nothing on disk to list.
+  std::unique_ptr<DirectoryEntry> &Entry = Dirs[Path];
+  Entry.reset(new DirectoryEntry());
+  Entry->Name = Path;
+  Entry->bIsVirtual = true;
+  Entry->bListingLoaded = true;
+  return Entry.get();
+}
+
+const DirectoryEntry *
+FileManager::GetSubDirectory(const DirectoryEntry *Dir,
+                             const std::string &Name) {
+  std::string Path = Dir->GetName() + "/" + Name;
+  std::unique_ptr<DirectoryEntry> &Entry = Dirs[Path];
+  if (!Entry) {
+    // No stat needed, the listing of Dir says it is a directory.
+    Entry.reset(new DirectoryEntry());
+    Entry->Name = Path;
+  }
+  return Entry.get();
+}
+
+/* Map a d_type of a directory listing to an EntryKind. */
+static DirectoryEntry::EntryKind
+GetEntryKind(unsigned char DType) {
+  switch (DType) {
+  case DT_REG:
+    return DirectoryEntry::EK_File;
+  case DT_DIR:
+    return DirectoryEntry::EK_Directory;
+  default:
+    return DirectoryEntry::EK_Unknown;
+  }
+}
+
+void
+FileManager::LoadDirectoryListing(const DirectoryEntry *Dir) {
+  if (Dir->bListingLoaded)
+    return;
+
+  Dir->bListingLoaded = true;
+  ++NumDirectoryListings;
+
+#ifdef __linux__
+  ++NumListingSysCalls;
+  int FD = ::open(Dir->GetName().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (FD < 0) {
+    Dir->bListingFailed = true;
+    return;
+  }
+
+  // Layout of the records returned by getdents64.
+  struct LinuxDirent64 {
+    uint64_t DIno;
+    int64_t DOff;
+    unsigned short DRecLen;
+    unsigned char DType;
+    char DName[1];
+  };
+
+  alignas(LinuxDirent64) char Buffer[32 * 1024];
+  while (true) {
+    ++NumListingSysCalls;
+    long Read = ::syscall(SYS_getdents64, FD, Buffer, sizeof(Buffer));
+    if (Read <= 0) {
+      if (Read < 0)
+        Dir->bListingFailed = true;
+      break;
+    }
+
+    for (long Pos = 0; Pos < Read;) {
+      auto *Ent = reinterpret_cast<LinuxDirent64 *>(Buffer + Pos);
+      Pos += Ent->DRecLen;
+      Dir->Listing.emplace(Ent->DName, GetEntryKind(Ent->DType));
+    }
+  }
+
+  ++NumListingSysCalls;
+  ::close(FD);
+#else
+  DIR *D = ::opendir(Dir->GetName().c_str());
+  if (!D) {
+    Dir->bListingFailed = true;
+    return;
+  }
+
+  while (struct dirent *Ent = ::readdir(D))
+    Dir->Listing.emplace(Ent->d_name, GetEntryKind(Ent->d_type));
+  ::closedir(D);
+#endif
+}
+
+DirectoryEntry::EntryKind
+FileManager::ProbeDirectoryEntry(const DirectoryEntry *Dir,
+                                 const std::string &RelativePath) {
+  std::string::size_type Start = 0;
+  while (true) {
+    std::string::size_type Slash = RelativePath.find('/', Start);
+    std::string Component = RelativePath.substr(Start, Slash - Start);
+
+    // Leave "." and ".." to the real file system.
+    if (Component.empty() || Component == "." || Component == "..")
+      return DirectoryEntry::EK_Unknown;
+
+    // In-memory files hide those on disk.
+    DirectoryEntry::EntryKind Kind;
+    auto Virtual = Dir->VirtualListing.find(Component);
+    if (Virtual != Dir->VirtualListing.end()) {
+      Kind = Virtual->second;
+    } else {
+      LoadDirectoryListing(Dir);
+      if (Dir->bListingFailed)
+        return DirectoryEntry::EK_Unknown;
+
+      auto It = Dir->Listing.find(Component);
+      if (It == Dir->Listing.end())
+        return DirectoryEntry::EK_None;
+      Kind = It->second;
+    }
+
+    if (Slash == std::string::npos)
+      return Kind;
+
+    // Descend into the subdirectory, listing it on first use.
+    if (Kind == DirectoryEntry::EK_File)
+      return DirectoryEntry::EK_None;
+    if (Kind != DirectoryEntry::EK_Directory)
+      return DirectoryEntry::EK_Unknown;
+
+    Dir = GetSubDirectory(Dir, Component);
+    Start = Slash + 1;
+  }
+}
+
+void
+FileManager::ClearDirectoryListings() {
+  for (auto &Entry : Dirs) {
+    if (Entry.second->bIsVirtual)
+      continue;
+    Entry.second->Listing.clear();
+    Entry.second->bListingLoaded = false;
+    Entry.second->bListingFailed = false;
+  }
+}
+
+void
+FileManager::PrintStats() const {
+  std::fprintf(stderr, "\n*** File Manager Stats:\n");
+  std::fprintf(stderr, "%zu real files found, %zu real dirs found.\n",
+               Files.size() - NumVirtualFiles, Dirs.size());
+  std::fprintf(stderr, "%u stat calls, %u answered by the stat cache.\n",
+               NumStatCalls, NumStatCacheHits);
+  std::fprintf(stderr, "%u files stat'ed in batches through io_uring.\n",
+               NumBatchedStats);
+  std::fprintf(stderr, "%u directories listed with %u system calls.\n",
+               NumDirectoryListings, NumListingSysCalls);
+  std::fprintf(stderr, "%u in-memory files.\n", NumVirtualFiles);
+  if (Prefetcher) {
+    std::fprintf(stderr,
+                 "%u files prefetched, %u were ready on use, %u waited for.\n",
+                 Prefetcher->GetNumRequested(), Prefetcher->GetNumReady(),
+                 Prefetcher->GetNumWaited());
+  }
+}
@@ -0,0 +1,173 @@
+#ifndef FILE_MANAGER_H
+#define FILE_MANAGER_H
+
+#include "ContentHash.h"
+#include "DirectoryEntry.h"
+#include "File.h"
+#include "FileBatchIO.h"
+#include "FilePrefetcher.h"
+#include "Mixins.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* ========================================================
+ *  FileManager
+ * ========================================================
+ */
+
+/** Looks up files and directories on disk. */
+class FileManager : private NonCopyable<FileManager> {
+  /** Directories uniqued by their path. */
+  std::unordered_map<std::string, std::unique_ptr<DirectoryEntry>> Dirs;
+
+  /** Owns every FileEntry handed out. */
+  std::vector<std::unique_ptr<FileEntry>> Files;
+
+  /**
+   * Result of the stat of every path asked for, null if it does not exist or
+   * is not a regular file.
+   */
+  std::unordered_map<std::string, const FileEntry *> SeenFileEntries;
+
+  /**
+   * Files by device and inode. Different paths to the same file, through
+   * symlinks or "..", share one FileEntry.
+   */
+  std::map<std::pair<dev_t, ino_t>, const FileEntry *> UniqueFiles;
+
+  /** Reads files ahead of use. Declared after Files, which it reads. */
+  std::unique_ptr<FilePrefetcher> Prefetcher;
+
+  /** Stats batches of files for StatFiles, created on first use. */
+  std::unique_ptr<FileBatchIO> BatchIO;
+
+  /** Number of stat system calls made. */
+  unsigned NumStatCalls = 0;
+  unsigned NumStatCacheHits = 0;
+
+  /** Number of files stat'ed through an io_uring, not by a system call. */
+  unsigned NumBatchedStats = 0;
+
+  /** Number of directories listed, and the system calls it took. */
+  unsigned NumDirectoryListings = 0;
+  unsigned NumListingSysCalls = 0;
+
+  /** Number of in-memory files, which also gives them unique inodes. */
+  unsigned NumVirtualFiles = 0;
+
+public:
+  FileManager() {}
+  ~FileManager() = default;
+
+  /**
+   * Returns the regular file at Path, or null if it does not exist or is not
+   * a regular file. Each path is only stat'ed once.
+   */
+  const FileEntry *GetFile(const std::string &Path);
+
+  /**
+   * stat the Paths not seen before in one batch, so that GetFile answers
+   * them from the cache. Useful where many paths are known in advance.
+   */
+  void StatFiles(const std::vector<std::string> &Paths);
+
+  /** Forget paths that did not exist, needed if files were created since. */
+  void ClearNegativeStatCache();
+
+  /**
+   * Add an in-memory file at Path. GetFile and directory probes find it like
+   * a file on disk, hiding any file on disk at that path, and the
+   * directories leading to it are made up if they do not exist. Data[Size]
+   * must be a null character. The memory is used in place, without a copy,
+   * and must outlive the FileManager and the SourceManagers reading it.
+   *
+   * Lookups done before are not affected, see
+   * HeaderSearch::ClearFileLookupCache.
+   */
+  const FileEntry *AddVirtualFile(const std::string &Path, const char *Data,
+                                  size_t Size);
+
+  /**
+   * Read the contents of File into Buffer and hash them into Hash, taking
+   * both from the prefetcher if they were read ahead. Returns false if the
+   * file cannot be read.
+   */
+  bool GetBufferForFile(const FileEntry *File, std::string &Buffer,
+                        ContentHash &Hash);
+
+  /**
+   * Read the contents of File into Buffer, with no caching whatsoever. The
+   * contents of in-memory files are copied.
+   */
+  static bool ReadFile(const FileEntry *File, std::string &Buffer);
+
+  /**
+   * Read files ahead of use on NumThreads background threads. Without this,
+   * PrefetchFile does nothing. The prefetcher stats and reads in batches
+   * through FileBatchIO, which only beats the plain system calls when the
+   * page cache is cold, so it is off by default.
+   */
+  void EnablePrefetching(unsigned NumThreads);
+
+  bool IsPrefetchingEnabled() const { return Prefetcher != nullptr; }
+
+  /** Start reading File in the background, it is going to be needed soon. */
+  void PrefetchFile(const FileEntry *File) {
+    if (Prefetcher && !File->IsVirtual())
+      Prefetcher->Request(File);
+  }
+
+  /** Returns the directory at Path, or null if it does not exist. */
+  const DirectoryEntry *GetDirectory(const std::string &Path);
+
+  /**
+   * Returns what RelativePath names below Dir. RelativePath may contain
+   * slashes, e.g. "sys/types.h"; each directory on the way is listed once,
+   * on first use, and later probes are hash lookups without system calls.
+   *
+   * EK_Unknown means the listing cannot answer, the caller has to stat.
+   */
+  DirectoryEntry::EntryKind
+  ProbeDirectoryEntry(const DirectoryEntry *Dir,
+                      const std::string &RelativePath);
+
+  /**
+   * Forget all directory listings, needed if files were created or removed
+   * since they were read.
+   */
+  void ClearDirectoryListings();
+
+  unsigned GetNumStatCalls() const { return NumStatCalls; }
+  unsigned GetNumStatCacheHits() const { return NumStatCacheHits; }
+  unsigned GetNumDirectoryListings() const { return NumDirectoryListings; }
+  unsigned GetNumListingSysCalls() const { return NumListingSysCalls; }
+  unsigned GetNumVirtualFiles() const { return NumVirtualFiles; }
+
+  /** Print statistics about file system accesses to stderr. */
+  void PrintStats() const;
+
+private:
+  /** Enter the result of the stat of Path into the caches. */
+  const FileEntry *AddFile(const std::string &Path,
+                           const FileBatchIO::StatResult &Stat);
+
+  /** Read the listing of Dir if that did not happen yet. */
+  void LoadDirectoryListing(const DirectoryEntry *Dir);
+
+  /**
+   * Returns the directory at Path to hold in-memory files, made up with its
+   * parents if it does not exist on disk.
+   */
+  DirectoryEntry *GetVirtualDirectory(const std::string &Path);
+
+  /** Returns the subdirectory Name of Dir, known to exist from its listing. */
+  const DirectoryEntry *GetSubDirectory(const DirectoryEntry *Dir,
+                                        const std::string &Name);
+};
+
+#endif
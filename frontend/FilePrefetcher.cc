@@ -0,0 +1,120 @@
+#include "FilePrefetcher.h"
+
+#include "FileBatchIO.h"
+#include "FileManager.h"
+
+FilePrefetcher::~FilePrefetcher() {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    bShutdown = true;
+  }
+  WorkAvailable.notify_all();
+
+  for (std::thread &Worker : Workers)
+    Worker.join();
+}
+
+void
+FilePrefetcher::Request(const FileEntry *File) {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (!Results.emplace(File, ReadResult()).second)
+      return;
+
+    Queue.push_back(File);
+    ++NumRequested;
+
+    if (Workers.empty()) {
+      for (unsigned I = 0; I < NumThreads; ++I)
+        Workers.emplace_back(&FilePrefetcher::WorkerMain, this);
+    }
+  }
+  WorkAvailable.notify_one();
+}
+
+bool
+FilePrefetcher::Take(const FileEntry *File, std::string &Buffer,
+                     ContentHash &Hash) {
+  std::unique_lock<std::mutex> Lock(Mutex);
+  auto It = Results.find(File);
+  if (It == Results.end())
+    return false;
+
+  // Not picked up by a worker yet, reading it here beats waiting in line.
+  if (It->second.State == RS_Queued) {
+    Results.erase(It);
+    return false;
+  }
+
+  // Other requests may rehash Results while waiting, references stay valid.
+  ReadResult &Result = It->second;
+  if (Result.State == RS_Reading) {
+    ++NumWaited;
+    ReadFinished.wait(Lock, [&] { return Result.State != RS_Reading; });
+  } else {
+    ++NumReady;
+  }
+
+  const bool bSucceeded = Result.State == RS_Done;
+  if (bSucceeded) {
+    Buffer = std::move(Result.Buffer);
+    Hash = Result.Hash;
+  }
+  Results.erase(File);
+  return bSucceeded;
+}
+
+void
+FilePrefetcher::WorkerMain() {
+  // With a ring, one batch keeps the kernel busy with many files at once.
+  // Without, every worker reads one file at a time.
+  FileBatchIO BatchIO;
+  const unsigned MaxBatchSize = BatchIO.HasRing() ? 32 : 1;
+
+  std::vector<const FileEntry *> Batch;
+  std::vector<std::string> Buffers;
+  std::vector<char> Succeeded;
+  std::vector<ContentHash> Hashes;
+
+  std::unique_lock<std::mutex> Lock(Mutex);
+  while (true) {
+    WorkAvailable.wait(Lock, [&] { return bShutdown || !Queue.empty(); });
+    if (bShutdown)
+      return;
+
+    Batch.clear();
+    while (!Queue.empty() && Batch.size() < MaxBatchSize) {
+      const FileEntry *File = Queue.front();
+      Queue.pop_front();
+
+      // Taken while it was still queued.
+      auto It = Results.find(File);
+      if (It == Results.end() || It->second.State != RS_Queued)
+        continue;
+      It->second.State = RS_Reading;
+      Batch.push_back(File);
+    }
+
+    if (Batch.empty())
+      continue;
+
+    Lock.unlock();
+    BatchIO.ReadFiles(Batch, Buffers, Succeeded);
+    Hashes.resize(Batch.size());
+    for (unsigned I = 0; I < Batch.size(); ++I) {
+      if (Succeeded[I])
+        Hashes[I] = ContentHash::Compute(Buffers[I].data(), Buffers[I].size());
+    }
+    Lock.lock();
+
+    // Results is only erased by Take, which waits while the state is
+    // RS_Reading, so the entries are still there.
+    for (unsigned I = 0; I < Batch.size(); ++I) {
+      ReadResult &Result = Results[Batch[I]];
+      Result.State = Succeeded[I] ? RS_Done : RS_Failed;
+      Result.Buffer = std::move(Buffers[I]);
+      Result.Hash = Hashes[I];
+    }
+    ReadFinished.notify_all();
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef FILE_PREFETCHER_H
+#define FILE_PREFETCHER_H
+
+#include "ContentHash.h"
+#include "Mixins.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class FileEntry;
+
+/* ========================================================
+ *  FilePrefetcher
+ * ========================================================
+ */
+
+/**
+ * Pool of threads reading files ahead of their use. The preprocessor requests
+ * the headers a file is going to include as soon as it knows them, and takes
+ * the contents when it actually enters them. If the read is still in flight
+ * by then, Take waits for it, which is no slower than reading it in place.
+ *
+ * The workers start on the first request. Each reads the queued files in
+ * batches through FileBatchIO, and hashes them before handing them over.
+ */
+class FilePrefetcher : private NonCopyable<FilePrefetcher> {
+  enum ReadState {
+    RS_Queued,
+    RS_Reading,
+    RS_Done,
+    RS_Failed,
+  };
+
+  struct ReadResult {
+    ReadState State = RS_Queued;
+    std::string Buffer;
+    ContentHash Hash;
+  };
+
+  unsigned NumThreads;
+  std::vector<std::thread> Workers;
+
+  std::mutex Mutex;
+  std::condition_variable WorkAvailable;
+  std::condition_variable ReadFinished;
+
+  /** Files waiting for a worker. Entries taken before that are skipped. */
+  std::deque<const FileEntry *> Queue;
+
+  /** Files requested and not taken yet. */
+  std::unordered_map<const FileEntry *, ReadResult> Results;
+
+  bool bShutdown = false;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumRequested = 0;
+  unsigned NumReady = 0;
+  unsigned NumWaited = 0;
+
+public:
+  FilePrefetcher(unsigned InNumThreads) : NumThreads(InNumThreads) {}
+  ~FilePrefetcher();
+
+  /** Start reading File in the background, if it is not already. */
+  void Request(const FileEntry *File);
+
+  /**
+   * Move the contents of File into Buffer, and their hash into Hash, if it
+   * was requested. Returns false if it was not, or the read failed; the
+   * caller then reads it itself.
+   */
+  bool Take(const FileEntry *File, std::string &Buffer, ContentHash &Hash);
+
+  unsigned GetNumRequested() const { return NumRequested; }
+
+  /** Number of taken files that were ready, and that had to be waited for. */
+  unsigned GetNumReady() const { return NumReady; }
+  unsigned GetNumWaited() const { return NumWaited; }
+
+private:
+  void WorkerMain();
+};
+
+#endif
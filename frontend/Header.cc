@@ -0,0 +1,246 @@
+#include "Header.h"
+
+#include "DirectoryEntry.h"
+#include "FileManager.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+void
+HeaderSearch::SetSearchPaths(std::vector<DirectoryLookup> &Dirs,
+                             unsigned InAngledDirIndex) {
+  assert(InAngledDirIndex <= Dirs.size() && "Invalid angled dir index!");
+  SearchDirs = Dirs;
+  AngledDirIndex = InAngledDirIndex;
+
+  // Cached hits index into SearchDirs.
+  LookupCache.clear();
+}
+
+void
+HeaderSearch::AddSearchPath(const DirectoryLookup &Dir, bool IsAngled) {
+  if (IsAngled) {
+    SearchDirs.push_back(Dir);
+  } else {
+    SearchDirs.insert(SearchDirs.begin() + AngledDirIndex, Dir);
+    ++AngledDirIndex;
+  }
+
+  LookupCache.clear();
+}
+
+const FileEntry *
+HeaderSearch::ProbeFile(const std::string &Path) {
+  return FileMgr.GetFile(Path);
+}
+
+const FileEntry *
+HeaderSearch::ProbeFileInDirectory(const DirectoryEntry *Dir,
+                                   const std::string &Filename) {
+  switch (FileMgr.ProbeDirectoryEntry(Dir, Filename)) {
+  case DirectoryEntry::EK_None:
+  case DirectoryEntry::EK_Directory:
+    ++NumListingMisses;
+    return nullptr;
+  case DirectoryEntry::EK_File:
+  case DirectoryEntry::EK_Unknown:
+    break;
+  }
+
+  return ProbeFile(Dir->GetName() + "/" + Filename);
+}
+
+void
+HeaderSearch::ClearFileLookupCache() {
+  LookupCache.clear();
+  FileMgr.ClearNegativeStatCache();
+  FileMgr.ClearDirectoryListings();
+}
+
+const FileEntry *
+HeaderSearch::LookupFile(const std::string &Filename, bool bIsAngled,
+                         const DirectoryEntry *IncluderDir,
+                         const DirectoryLookup *FromDir,
+                         const DirectoryLookup *&CurDir) {
+  ++NumLookups;
+  CurDir = nullptr;
+
+  // Absolute paths are not searched for.
+  if (!Filename.empty() && Filename[0] == '/')
+    return ProbeFile(Filename);
+
+  LookupCacheKey Key = MakeLookupKey(Filename, bIsAngled, IncluderDir, FromDir);
+  auto It = LookupCache.find(Key);
+  if (It != LookupCache.end()) {
+    ++NumLookupCacheHits;
+  } else {
+    LookupCacheEntry Result =
+        DoLookupFile(Filename, Key.StartIndex, Key.IncluderDir);
+    It = LookupCache.emplace(std::move(Key), Result).first;
+  }
+
+  const LookupCacheEntry &Result = It->second;
+  if (Result.File && Result.HitIndex != NoHitIndex)
+    CurDir = &SearchDirs[Result.HitIndex];
+  return Result.File;
+}
+
+HeaderSearch::LookupCacheKey
+HeaderSearch::MakeLookupKey(const std::string &Filename, bool bIsAngled,
+                            const DirectoryEntry *IncluderDir,
+                            const DirectoryLookup *FromDir) const {
+  // The directory of the includer is only searched for "x", and not by
+  // #include_next.
+  if (bIsAngled || FromDir)
+    IncluderDir = nullptr;
+
+  unsigned StartIndex = bIsAngled ? AngledDirIndex : 0;
+  if (FromDir)
+    StartIndex = (FromDir - SearchDirs.data()) + 1;
+
+  return {Filename, StartIndex, IncluderDir};
+}
+
+bool
+HeaderSearch::GetCandidatePath(const LookupCacheKey &Key, std::string &Path) {
+  auto IsCandidate = [&](const DirectoryEntry *Dir) {
+    if (FileMgr.ProbeDirectoryEntry(Dir, Key.Filename) ==
+        DirectoryEntry::EK_None)
+      return false;
+    Path = Dir->GetName() + "/" + Key.Filename;
+    return true;
+  };
+
+  if (Key.IncluderDir && IsCandidate(Key.IncluderDir))
+    return true;
+
+  for (unsigned Index = Key.StartIndex; Index < SearchDirs.size(); ++Index) {
+    if (IsCandidate(SearchDirs[Index].GetDir()))
+      return true;
+  }
+  return false;
+}
+
+HeaderSearch::LookupCacheEntry
+HeaderSearch::DoLookupFile(const std::string &Filename, unsigned StartIndex,
+                           const DirectoryEntry *IncluderDir) {
+  if (IncluderDir) {
+    if (const FileEntry *File = ProbeFileInDirectory(IncluderDir, Filename))
+      return {NoHitIndex, File};
+  }
+
+  for (unsigned Index = StartIndex; Index < SearchDirs.size(); ++Index) {
+    const DirectoryEntry *Dir = SearchDirs[Index].GetDir();
+    if (const FileEntry *File = ProbeFileInDirectory(Dir, Filename))
+      return {Index, File};
+  }
+
+  return {NoHitIndex, nullptr};
+}
+
+/* Skip spaces and tabs. */
+static const char *
+SkipBlanks(const char *Ptr, const char *End) {
+  while (Ptr != End && (*Ptr == ' ' || *Ptr == '\t'))
+    ++Ptr;
+  return Ptr;
+}
+
+/*
+ * If the line [Ptr, End) is an #include or #import directive, set Filename
+ * and bIsAngled and return true.
+ */
+static bool
+ScanIncludeLine(const char *Ptr, const char *End, std::string &Filename,
+                bool &bIsAngled) {
+  Ptr = SkipBlanks(Ptr, End);
+  if (Ptr == End || *Ptr != '#')
+    return false;
+  Ptr = SkipBlanks(Ptr + 1, End);
+
+  size_t Length = End - Ptr;
+  if (Length > 7 && !std::memcmp(Ptr, "include", 7))
+    Ptr += 7;
+  else if (Length > 6 && !std::memcmp(Ptr, "import", 6))
+    Ptr += 6;
+  else
+    return false;
+
+  Ptr = SkipBlanks(Ptr, End);
+  if (Ptr == End || (*Ptr != '"' && *Ptr != '<'))
+    return false;
+
+  bIsAngled = *Ptr == '<';
+  const char *NameStart = ++Ptr;
+  const char *NameEnd = static_cast<const char *>(
+      std::memchr(NameStart, bIsAngled ? '>' : '"', End - NameStart));
+  if (!NameEnd || NameEnd == NameStart)
+    return false;
+
+  Filename.assign(NameStart, NameEnd);
+  return true;
+}
+
+void
+HeaderSearch::PrefetchIncludes(const char *BufStart, const char *BufEnd,
+                               const DirectoryEntry *IncluderDir) {
+  if (!FileMgr.IsPrefetchingEnabled())
+    return;
+
+  std::vector<std::pair<std::string, bool>> Includes;
+  std::string Filename;
+  for (const char *Ptr = BufStart; Ptr < BufEnd;) {
+    const char *LineEnd =
+        static_cast<const char *>(std::memchr(Ptr, '\n', BufEnd - Ptr));
+    if (!LineEnd)
+      LineEnd = BufEnd;
+
+    bool bIsAngled;
+    if (ScanIncludeLine(Ptr, LineEnd, Filename, bIsAngled))
+      Includes.emplace_back(Filename, bIsAngled);
+
+    Ptr = LineEnd + 1;
+  }
+
+  // stat the first candidate of every lookup not done before in one batch.
+  // The lookups below then find their results in the stat cache.
+  std::vector<std::string> Candidates;
+  for (const auto &Include : Includes) {
+    if (!Include.first.empty() && Include.first[0] == '/')
+      continue;
+
+    LookupCacheKey Key =
+        MakeLookupKey(Include.first, Include.second, IncluderDir, nullptr);
+    std::string Path;
+    if (!LookupCache.count(Key) && GetCandidatePath(Key, Path))
+      Candidates.push_back(std::move(Path));
+  }
+  FileMgr.StatFiles(Candidates);
+
+  for (const auto &Include : Includes) {
+    // The result stays in the lookup cache for the real #include.
+    const DirectoryLookup *CurDir;
+    if (const FileEntry *File = LookupFile(Include.first, Include.second,
+                                           IncluderDir, nullptr, CurDir)) {
+      FileMgr.PrefetchFile(File);
+      ++NumPrefetched;
+    }
+  }
+}
+
+void
+HeaderSearch::PrintStats() const {
+  std::fprintf(stderr, "\n*** HeaderSearch Stats:\n");
+  std::fprintf(stderr, "%u #include lookups.\n", NumLookups);
+  std::fprintf(stderr, "  %u answered by the lookup cache.\n",
+               NumLookupCacheHits);
+  std::fprintf(stderr, "  %u probes answered by directory listings.\n",
+               NumListingMisses);
+  std::fprintf(stderr, "  %u stat calls, %u answered by the stat cache.\n",
+               FileMgr.GetNumStatCalls(), FileMgr.GetNumStatCacheHits());
+  std::fprintf(stderr, "  %u directories listed with %u system calls.\n",
+               FileMgr.GetNumDirectoryListings(),
+               FileMgr.GetNumListingSysCalls());
+  std::fprintf(stderr, "  %u headers prefetched.\n", NumPrefetched);
+}
@@ -1,21 +1,29 @@
 #ifndef HEADER_H
 #define HEADER_H
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 class DirectoryEntry;
+class FileEntry;
+class FileManager;
 
 class DirectoryLookup {
-  DirectoryEntry &Dir;
+  const DirectoryEntry *Dir;
 
 public:
-  DirectoryLookup(DirectoryEntry &InDir) : Dir(InDir) {}
+  DirectoryLookup(const DirectoryEntry &InDir) : Dir(&InDir) {}
+
+  const DirectoryEntry *GetDir() const { return Dir; }
 };
 
 /**
  * Information required to find the file referenced by include directive.
  */
 class HeaderSearch {
+  FileManager &FileMgr;
+
   /**
    * Header search for #include "x" begins with the directory of the including
    * file, then each directory in the search directory. Search for <x> search
@@ -25,12 +33,122 @@ class HeaderSearch {
   std::vector<DirectoryLookup> SearchDirs;
   unsigned AngledDirIndex = 0;
 
+  /**
+   * A lookup of Filename that started at SearchDirs[StartIndex]. IncluderDir
+   * is the directory of the including file for "x" includes, which is
+   * searched first, and null for <x>.
+   */
+  struct LookupCacheKey {
+    std::string Filename;
+    unsigned StartIndex;
+    const DirectoryEntry *IncluderDir;
+
+    bool operator==(const LookupCacheKey &Other) const {
+      return StartIndex == Other.StartIndex &&
+             IncluderDir == Other.IncluderDir && Filename == Other.Filename;
+    }
+  };
+
+  struct LookupCacheKeyHash {
+    size_t operator()(const LookupCacheKey &Key) const {
+      size_t Hash = std::hash<std::string>()(Key.Filename);
+      Hash ^= std::hash<const void *>()(Key.IncluderDir) + (Hash << 6);
+      return Hash ^ (Key.StartIndex + (Hash >> 2));
+    }
+  };
+
+  /** Result of a lookup, File is null if nothing was found. */
+  struct LookupCacheEntry {
+    /** Index of the DirectoryLookup that had the file, or NoHitIndex. */
+    unsigned HitIndex;
+    const FileEntry *File;
+  };
+
+  /** HitIndex of files that were found in the directory of the includer. */
+  static constexpr unsigned NoHitIndex = ~0u;
+
+  /** Results of previous lookups, a hit or a miss costs no stat. */
+  std::unordered_map<LookupCacheKey, LookupCacheEntry, LookupCacheKeyHash>
+      LookupCache;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumLookups = 0;
+  unsigned NumLookupCacheHits = 0;
+  unsigned NumPrefetched = 0;
+  unsigned NumListingMisses = 0;
+
 public:
+  HeaderSearch(FileManager &FM) : FileMgr(FM) {}
+
+  FileManager &GetFileMgr() const { return FileMgr; }
+
   void SetSearchPaths(std::vector<DirectoryLookup> &Dirs,
                       unsigned AngledDirIndex);
 
   /** Add an additional search path. */
   void AddSearchPath(const DirectoryLookup &Dir, bool IsAngled);
+
+  /**
+   * Find the file of #include "Filename" or #include <Filename>.
+   *
+   * IncluderDir is the directory of the including file. FromDir is the entry
+   * of SearchDirs the includer was found in, to implement #include_next; the
+   * search starts after it. On success, CurDir is set to the entry of
+   * SearchDirs the file was found in, or null if it was found relative to
+   * the includer.
+   */
+  const FileEntry *LookupFile(const std::string &Filename, bool bIsAngled,
+                              const DirectoryEntry *IncluderDir,
+                              const DirectoryLookup *FromDir,
+                              const DirectoryLookup *&CurDir);
+
+  /**
+   * Look for the #include directives in the buffer of a file that is about to
+   * be preprocessed, and have the FileManager read the headers they name in
+   * the background. IncluderDir is the directory of the file.
+   *
+   * This is a quick line scan, directives in comments or skipped blocks are
+   * prefetched as well, which only costs a read. #include_next is ignored.
+   * The headers are looked up with their stats batched, see
+   * FileManager::StatFiles.
+   */
+  void PrefetchIncludes(const char *BufStart, const char *BufEnd,
+                        const DirectoryEntry *IncluderDir);
+
+  /**
+   * Forget all lookup results. Needed if files were created on disk or added
+   * in memory since, like generated headers.
+   */
+  void ClearFileLookupCache();
+
+  /** Print statistics about header lookups to stderr. */
+  void PrintStats() const;
+
+private:
+  /** stat Path, through the cache of the FileManager. */
+  const FileEntry *ProbeFile(const std::string &Path);
+
+  /**
+   * Look for Filename in Dir. The listing of Dir answers most misses without
+   * a system call.
+   */
+  const FileEntry *ProbeFileInDirectory(const DirectoryEntry *Dir,
+                                        const std::string &Filename);
+
+  /** The key LookupFile caches the result of a lookup under. */
+  LookupCacheKey MakeLookupKey(const std::string &Filename, bool bIsAngled,
+                               const DirectoryEntry *IncluderDir,
+                               const DirectoryLookup *FromDir) const;
+
+  /**
+   * Set Path to the first place the lookup of Key would stat, judging by the
+   * directory listings. Returns false if no directory has the file.
+   */
+  bool GetCandidatePath(const LookupCacheKey &Key, std::string &Path);
+
+  LookupCacheEntry DoLookupFile(const std::string &Filename,
+                                unsigned StartIndex,
+                                const DirectoryEntry *IncluderDir);
 };
 
 #endif
@@ -18,6 +18,8 @@ enum KeywordAvaibility {
 };
 } // namespace
 
+IIdentifierInfoLookup::~IIdentifierInfoLookup() {}
+
 /** Check if the laguage options allows all the keyword flags. */
 static KeywordAvaibility
 GetKeywordFlagAvailibility(const LanguageOptions &LangOptions, unsigned Flags) {
@@ -51,7 +53,7 @@ GetKwTokenAvaibility(const LanguageOptions &LangOptions, TokenKind Kind) {
   switch (Kind) {
 #define KEYWORD(NAME, FLAGS)                                                   \
   case KW_##NAME:                                                              \
-    return GetKeywordAvailibility(LangOptions, FLAGS);
+    return GetKeywordFlagAvailibility(LangOptions, FLAGS);
 #include "Tokens.list"
   default:
     return KA_NotAvailable;
@@ -16,7 +16,10 @@ class alignas(8) IdentifierInfo
 
   TokenKind Kind;
 
-  /** True if there is a #define for this. */
+  /**
+   * True if there is a #define for this. The definition itself lives in the
+   * macro table of the Preprocessor, which is only consulted when set.
+   */
   unsigned bHasMacro : 1;
 
   /** True if there was a #define for this. */
@@ -29,18 +32,21 @@ class alignas(8) IdentifierInfo
   IdentifierInfo() : bHasMacro(false), bHadMacro(false) {}
 
 public:
-  std::string GetName() const { return Entry->first; }
+  const std::string &GetName() const { return Entry->first; }
 
-  bool GetHasMacroDefinition() const { return bHadMacro; }
+  bool GetHasMacroDefinition() const { return bHasMacro; }
   void SetHasMacroDefinition(bool Value) {
     if (Value == bHasMacro)
       return;
 
     bHasMacro = Value;
-    if (Value) {
-    }
+    if (Value)
+      bHadMacro = true;
   }
 
+  /** True if there was a #define for this at some point. */
+  bool GetHadMacroDefinition() const { return bHadMacro; }
+
   /**
    * Returns the preprocessor keyword for this identifier.
    * Returns directive type else returns PP_Invalid if not a preprocessor
@@ -54,7 +60,13 @@ public:
   bool IsKeyword(const LanguageOptions &LangOptions) const;
 };
 
-/** Provides an interface for Identifier lookup. */
+/**
+ * Provides an interface for Identifier lookup.
+ *
+ * Get is asked for every identifier not in the table yet. It returns null if
+ * it does not know Name, or else the identifier created with
+ * IdentifierInfoTable::GetOwn, set up with the state it knows.
+ */
 class IIdentifierInfoLookup {
 public:
   virtual ~IIdentifierInfoLookup();
@@ -68,9 +80,32 @@ class IdentifierInfoTable {
   using HashTable_T = std::map<std::string, IdentifierInfo *>;
   HashTable_T HashTable;
 
-  IIdentifierInfoLookup *ExternalLookup;
+  IIdentifierInfoLookup *ExternalLookup = nullptr;
 
 public:
+  /**
+   * Consult Lookup for identifiers not in the table yet, before creating
+   * them. Null to stop.
+   */
+  void SetExternalLookup(IIdentifierInfoLookup *Lookup) {
+    ExternalLookup = Lookup;
+  }
+
+  /**
+   * Returns the identifier Name, creating it without asking the external
+   * lookup. For the external lookup itself.
+   */
+  IdentifierInfo &GetOwn(const std::string &Name) {
+    auto &Entry = *HashTable.insert({Name, nullptr}).first;
+
+    IdentifierInfo *&II = Entry.second;
+    if (!II) {
+      II = new IdentifierInfo();
+      II->Entry = &Entry;
+    }
+    return *II;
+  }
+
   IdentifierInfo &GetOrCreate(std::string &Name) {
     auto &Entry = *HashTable.insert({Name, nullptr}).first;
 
@@ -88,9 +123,9 @@ public:
     // Lookups failed, make a new IdentifierInfo.
     II = new IdentifierInfo();
     II->Entry = &Entry;
+    return *II;
   }
 
-  using Iterator = HashTable_T::const_iterator;
   using Iterator = HashTable_T::const_iterator;
 
   Iterator begin() const { return HashTable.begin(); }
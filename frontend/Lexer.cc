@@ -3,12 +3,25 @@
 #include "CharInfo.h"
 #include "Preprocessor.h"
 #include "PreprocessorLexer.h"
+#include "TokenCache.h"
+
+Lexer::Lexer(FileID FID, Preprocessor &InPP)
+    : PreprocessorLexer(&InPP, FID)
+    , LangOptions(InPP.GetLangOptions())
+    , FileLocation(InPP.GetSourceManager().GetComposedLoc(FID, 0)) {
+  // The buffer is pinned by PreprocessorLexer while we lex it.
+  InitLexer(PinnedContent->GetBufferStart(), PinnedContent->GetBufferStart(),
+            PinnedContent->GetBufferEnd());
+}
 
-Lexer::Lexer(FileID FID, Preprocessor &InPP, std::string &InputFile)
-    : PreprocessorLexer(&InPP, FID) {
-  // TODO: Fix this
-  InitLexer(InputFile.begin().base(), InputFile.begin().base(),
-            InputFile.end().base());
+Lexer::Lexer(SourceLocation FileLoc, const LanguageOptions &InLangOptions,
+             const char *InBufferStart, const char *InBufferPtr,
+             const char *InBufferEnd)
+    : PreprocessorLexer(nullptr, FileID())
+    , LangOptions(InLangOptions)
+    , FileLocation(FileLoc) {
+  InitLexer(InBufferStart, InBufferPtr, InBufferEnd);
+  LexingRawMode = true;
 }
 
 void
@@ -21,6 +34,9 @@ Lexer::InitLexer(const char *InBufferStart, const char *InBufferPtr,
   if (BufferStart == BufferPtr) {
     // skip the bom length
   }
+
+  IsAtPhysicalStartOfLine = BufferPtr == BufferStart || BufferPtr[-1] == '\n' ||
+                            BufferPtr[-1] == '\r';
 }
 
 SourceLocation
@@ -29,66 +45,364 @@ Lexer::GetSourceLocation(const char *Loc, unsigned TokenLen) const {
          "Location out of range of this buffer!");
 
   unsigned CharNo = Loc - BufferStart;
+  return FileLocation.GetLocWithOffset(CharNo);
 }
 
 /* =============== Trigraphs and escape sequence handling =================== */
 
-static char ProcessTrigraph(const char *CP, Lexer *L, bool Trigraph) {
-  char Res = 0;
-  switch (*CP) {
-    default: return 0;
-    case '=': Res = '#';
-    case '/': Res = '\\';
-    case '\'': Res = '^';
-    case '(': Res = '[';
-    case ')': Res = ']';
-    case '!': Res = '|';
-    case '<': Res = '{';
-    case '>': Res = '}';
-    case '-': Res = '~';
+/* Returns the character of the trigraph ??Letter, 0 if it is not one. */
+static char
+GetTrigraphChar(char Letter) {
+  switch (Letter) {
+  case '=': return '#';
+  case '/': return '\\';
+  case '\'': return '^';
+  case '(': return '[';
+  case ')': return ']';
+  case '!': return '|';
+  case '<': return '{';
+  case '>': return '}';
+  case '-': return '~';
+  default: return 0;
   }
+}
 
-  if (!Res || !L) return Res;
+/*
+ * Returns the size of the escaped newline at Ptr, right after a backslash:
+ * horizontal whitespace and a newline. 0 if there is none.
+ */
+static unsigned
+GetEscapedNewLineSize(const char *Ptr) {
+  unsigned Size = 0;
+  while (IsHorizontalWhitespace(Ptr[Size]))
+    ++Size;
 
-  if (!Trigraphs) {
+  if (Ptr[Size] != '\n' && Ptr[Size] != '\r')
     return 0;
+
+  // Handle \n\r \r\n
+  if ((Ptr[Size + 1] == '\n' || Ptr[Size + 1] == '\r') &&
+      Ptr[Size + 1] != Ptr[Size])
+    return Size + 2;
+  return Size + 1;
+}
+
+const char *
+Lexer::SkipLineComment(const char *CurPtr) const {
+  while (true) {
+    char C = *CurPtr;
+    if (C == '\n' || C == '\r' || (C == 0 && CurPtr == BufferEnd))
+      return CurPtr;
+
+    if (!IsSpecialCharacter(C)) {
+      ++CurPtr;
+      continue;
+    }
+
+    // Escaped newlines and ??/ trigraphs continue the comment.
+    unsigned Size = 0;
+    C = PeekCharNoFlags(CurPtr, Size, LangOptions);
+    if (C == '\n' || C == '\r' || (C == 0 && CurPtr + Size - 1 == BufferEnd))
+      return CurPtr + Size - 1;
+    CurPtr += Size;
   }
+}
 
-  return Res;
+const char *
+Lexer::SkipBlockComment(const char *CurPtr) const {
+  while (true) {
+    char C = *CurPtr++;
+    if (C == '*') {
+      // The / may be behind an escaped newline.
+      unsigned Size = 0;
+      if (PeekCharNoFlags(CurPtr, Size, LangOptions) == '/')
+        return CurPtr + Size;
+    } else if (C == 0 && CurPtr - 1 == BufferEnd) {
+      // error: unterminated /* comment
+      return BufferEnd;
+    }
+  }
 }
 
-char Lexer::PeekCharSlow(const char *Ptr, unsigned &Size, Token *Tok) {
-  // if we have a slash look for an escaped new line
-  if (Ptr[0] '\\') {
-    ++Size;
-    ++Ptr;
+void
+Lexer::SkipMacroBody(SourceLocation &BodyLoc, unsigned &BodyLength) {
+  const bool bDigitSeparators = LangOptions.CPlusPlus14 || LangOptions.C2x;
+  const char *CurPtr = BufferPtr;
+
+  // First character of the body that is not whitespace or a comment, and one
+  // past the last one.
+  const char *BodyStart = nullptr;
+  const char *BodyEnd = nullptr;
+
+  // Quotes in pp-numbers are digit separators, not character constants.
+  bool bInNumber = false;
+  char PrevChar = ' ';
+
+  while (true) {
+    unsigned Size = 1;
+    char C = *CurPtr;
+    if (IsSpecialCharacter(C)) {
+      Size = 0;
+      C = PeekCharNoFlags(CurPtr, Size, LangOptions);
+    }
+
+    // The end of the line, possibly right after an escaped newline.
+    if (C == '\n' || C == '\r' || (C == 0 && CurPtr + Size - 1 == BufferEnd)) {
+      CurPtr += Size - 1;
+      break;
+    }
+
+    const char *Next = CurPtr + Size;
+    if (C == '/') {
+      unsigned Size2 = 0;
+      char C2 = PeekCharNoFlags(Next, Size2, LangOptions);
+      if (C2 == '*' || (C2 == '/' && HasLineComments())) {
+        // Comments are whitespace; a block comment can span lines.
+        CurPtr = C2 == '*' ? SkipBlockComment(Next + Size2)
+                           : SkipLineComment(Next + Size2);
+        bInNumber = false;
+        PrevChar = ' ';
+        continue;
+      }
+    }
+
+    if (bInNumber) {
+      bInNumber = IsPreprocessingNumber(C) || (C == '\'' && bDigitSeparators) ||
+                  ((C == '+' || C == '-') &&
+                   ((PrevChar | 0x20) == 'e' || (PrevChar | 0x20) == 'p'));
+    } else {
+      bInNumber = C >= '0' && C <= '9' && !IsAsciiIdentifierContinue(PrevChar);
+    }
 
-    // blackslash-char
-    if (!IsWhiteSpace(Ptr[0])) return '\\';
-  
-    return '\\';
+    if ((C == '"' || C == '\'') && !bInNumber) {
+      // Comment markers inside literals are text, skip to the closing quote.
+      // An unterminated literal ends at the end of the line.
+      while (true) {
+        char Q = *Next;
+        if (Q == C || Q == '\n' || Q == '\r' || (Q == 0 && Next == BufferEnd))
+          break;
+
+        if (Q == '\\' && !(Next[1] == 0 && Next + 1 == BufferEnd)) {
+          unsigned NewLineSize = GetEscapedNewLineSize(Next + 1);
+          Next += NewLineSize ? 1 + NewLineSize : 2;
+          continue;
+        }
+        ++Next;
+      }
+
+      if (*Next == C)
+        ++Next;
+    }
+
+    if (!IsHorizontalWhitespace(C)) {
+      if (!BodyStart)
+        BodyStart = CurPtr;
+      BodyEnd = Next;
+    }
+
+    PrevChar = C;
+    CurPtr = Next;
+  }
+
+  if (!BodyStart)
+    BodyStart = BodyEnd = CurPtr;
+
+  BodyLoc = GetSourceLocation(BodyStart);
+  BodyLength = BodyEnd - BodyStart;
+  BufferPtr = CurPtr;
+}
+
+char
+Lexer::PeekCharSlow(const char *Ptr, unsigned &Size, Token *Tok) {
+  unsigned OldSize = Size;
+  char C = PeekCharNoFlags(Ptr, Size, LangOptions);
+
+  // More than one byte for one character, the token has to be cleaned.
+  if (Tok && Size - OldSize > 1)
+    Tok->SetFlag(Token::NeedsCleaning);
+  return C;
+}
+
+char
+Lexer::PeekCharNoFlags(const char *Ptr, unsigned &Size,
+                       const LanguageOptions &LangOptions) {
+  while (true) {
+    char C = Ptr[0];
+    unsigned CharSize = 1;
+
+    // If this is a trigraph, process it. ??/ is a backslash.
+    if (C == '?' && Ptr[1] == '?' && LangOptions.Trigraphs) {
+      if (char Trigraph = GetTrigraphChar(Ptr[2])) {
+        C = Trigraph;
+        CharSize = 3;
+      }
+    }
+
+    // A backslash followed by a newline joins the lines, read on.
+    if (C == '\\') {
+      if (unsigned NewLineSize = GetEscapedNewLineSize(Ptr + CharSize)) {
+        Size += CharSize + NewLineSize;
+        Ptr += CharSize + NewLineSize;
+        continue;
+      }
+    }
+
+    Size += CharSize;
+    return C;
   }
+}
 
-  // if this is a trigraph, process it
-  if (Ptr[0] == "?" && Ptr[1] == '?') {
-    
+const char *
+Lexer::GetSpelling(const Token &Tok, const char *TokStart,
+                   const LanguageOptions &LangOptions, std::string &Buffer,
+                   unsigned &Length) {
+  Length = Tok.GetLength();
+  if (!Tok.HasFlag(Token::NeedsCleaning))
+    return TokStart;
+
+  // The cleaned spelling is never longer than the source text.
+  if (Buffer.size() < Length)
+    Buffer.resize(Length);
+
+  const char *Ptr = TokStart;
+  const char *End = TokStart + Tok.GetLength();
+  unsigned CleanLength = 0;
+  while (Ptr < End) {
+    unsigned Size = 0;
+    Buffer[CleanLength++] = PeekCharNoFlags(Ptr, Size, LangOptions);
+    Ptr += Size;
   }
+
+  Length = CleanLength;
+  return Buffer.data();
 }
 
 bool
 Lexer::AdvanceToken(Token &Result) {
   Result.ResetToken();
-  return AdvanceTokenInternal(Result);
+  // Header names lex differently from the raw tokens, lex them for real.
+  bool bReturnedToken = CachedTokens && !ParsingFilename
+                            ? AdvanceCachedToken(Result)
+                            : AdvanceTokenInternal(Result);
+
+  // Directives, the end of an included file and expanded macros return
+  // false; the lexer may have been popped off the include stack by then.
+  // Macro expansions are recorded by Preprocessor::HandleIdentifier.
+  if (bReturnedToken)
+    MIOpt.ReadToken();
+  return bReturnedToken;
+}
+
+void
+Lexer::SetCachedTokens(const CachedTokenStream *Tokens) {
+  CachedTokens = Tokens;
+  NextCachedToken = 0;
+  CachedIdentifiers.assign(Tokens ? Tokens->GetNumIdentifiers() : 0, nullptr);
+}
+
+bool
+Lexer::AdvanceCachedToken(Token &Result) {
+  const CachedTokenStream &Tokens = *CachedTokens;
+
+  // Step over the tokens of text that was consumed without us.
+  uint32_t Offset = BufferPtr - BufferStart;
+  while (NextCachedToken < Tokens.size() &&
+         Tokens.GetOffset(NextCachedToken) < Offset)
+    ++NextCachedToken;
+
+  if (NextCachedToken == Tokens.size()) {
+    BufferPtr = BufferEnd;
+    return LexEndOfFile(Result, BufferEnd);
+  }
+
+  uint32_t Index = NextCachedToken;
+  uint16_t Flags = Tokens.GetFlags(Index);
+  const char *TokStart = BufferStart + Tokens.GetOffset(Index);
+
+  if (ParsingPreprocessorDirective && (Flags & Token::StartOfLine)) {
+    // The directive ends at the newline before the token.
+    const char *CurPtr = BufferPtr;
+    while (CurPtr != TokStart && *CurPtr != '\n' && *CurPtr != '\r')
+      ++CurPtr;
+
+    ParsingPreprocessorDirective = false;
+    IsAtPhysicalStartOfLine = true;
+    BufferPtr = CurPtr;
+    CreateTokenWithChars(Result, CurPtr == TokStart ? CurPtr : CurPtr + 1,
+                         Eod);
+    return true;
+  }
+
+  IsAtPhysicalStartOfLine = false;
+  ++NextCachedToken;
+  TokenKind Kind = Tokens.GetKind(Index);
+  BufferPtr = TokStart;
+  CreateTokenWithChars(Result, TokStart + Tokens.GetLength(Index), Kind);
+  Result.SetFlags(Flags);
+
+  if (Result.IsLiteral()) {
+    Result.SetLiteralData(TokStart);
+    return true;
+  }
+
+  if (LexingRawMode)
+    return true;
+
+  if (Kind == Identifier) {
+    // Each distinct identifier is looked up once per file.
+    IdentifierInfo *&II = CachedIdentifiers[Tokens.GetIdentifier(Index)];
+    if (II)
+      Result.SetIdentifierInfo(II);
+    else
+      II = OwnerPP->LookUpIdentifierInfo(Result, TokStart);
+
+    if (II->GetHasMacroDefinition())
+      return OwnerPP->HandleIdentifier(Result);
+    return true;
+  }
+
+  // We parsed a # at the start of line, it's a preprocessor directive.
+  if (Kind == Hash && (Flags & Token::StartOfLine) &&
+      !ParsingPreprocessorDirective) {
+    OwnerPP->HandleDirective(Result);
+    return false;
+  }
+
+  return true;
 }
 
 bool
 Lexer::LexIdentifierContinue(Token &Result, const char *CurPtr) {
   // Match [_A-Za-z0-9]*, we have already matched an identifier start.
   while (true) {
-    unsigned char C = *CurPtr;
+    if (IsAsciiIdentifierContinue(*CurPtr)) {
+      ++CurPtr;
+      continue;
+    }
+
+    if (!IsSpecialCharacter(*CurPtr))
+      break;
+
+    // Slow path: the identifier may go on behind an escaped newline. The
+    // token then needs cleaning.
+    unsigned Size;
+    if (!IsAsciiIdentifierContinue(PeekChar(CurPtr, Size)))
+      break;
+    CurPtr = ConsumeChar(CurPtr, Size, Result);
   }
 
   const char *IdentifierStart = BufferPtr;
+  CreateTokenWithChars(Result, CurPtr, Identifier);
+
+  // Raw lexers leave the identifier lookup to their user.
+  if (LexingRawMode)
+    return true;
+
+  IdentifierInfo *II = OwnerPP->LookUpIdentifierInfo(Result, IdentifierStart);
+
+  // Only identifiers with the macro bit set need the preprocessor's attention.
+  if (II->GetHasMacroDefinition())
+    return OwnerPP->HandleIdentifier(Result);
   return true;
 }
 
@@ -109,27 +423,37 @@ Lexer::LexNumericalConstant(Token &Result, const char *CurPtr) {
   unsigned Size;
   char C = PeekChar(CurPtr, Size);
   char PrevChar = 0;
+  while (IsPreprocessingNumber(C)) {
+    CurPtr = ConsumeChar(CurPtr, Size, Result);
+    PrevChar = C;
+    C = PeekChar(CurPtr, Size);
+  }
 
+  // exponent sign, 1e+10
   if ((C == '+' || C == '-') && (PrevChar == 'E' || PrevChar == 'e')) {
     return LexNumericalConstant(Result, ConsumeChar(CurPtr, Size, Result));
   }
 
-  // hexadecimal FP constant
-  // if ((C == '+' || C == '-') && (PrevChar == 'P' || PrevChar == 'p')) {
-  //   bool IsHexFloat = true;
-  //   if (!LangOptions.C99) {
-  //     if (!IsHexLiteral(BufferPtr, LangOptions)) {
-  //       IsHexFloat = false;
-  //     }
-  //   }
-  // }
+  // hexadecimal FP constant, 0x1p-3
+  if ((C == '+' || C == '-') && (PrevChar == 'P' || PrevChar == 'p') &&
+      (LangOptions.C99 || LangOptions.CPlusPlus17) &&
+      IsHexLiteral(BufferPtr, LangOptions)) {
+    return LexNumericalConstant(Result, ConsumeChar(CurPtr, Size, Result));
+  }
 
-  // digit separator
-  // if (C == '\'') {
-  // }
+  // digit separator, 1'000
+  if (C == '\'' && (LangOptions.CPlusPlus14 || LangOptions.C2x)) {
+    unsigned NextSize;
+    char Next = PeekChar(CurPtr + Size, NextSize);
+    if (IsAsciiIdentifierContinue(Next)) {
+      CurPtr = ConsumeChar(CurPtr, Size, Result);
+      return LexNumericalConstant(Result,
+                                  ConsumeChar(CurPtr, NextSize, Result));
+    }
+  }
 
   const char *TokenStart = BufferPtr;
-  CreateTokenWithChars(Result, CurPtr, Identifier);
+  CreateTokenWithChars(Result, CurPtr, NumericConstant);
   Result.SetLiteralData(TokenStart);
   return true;
 }
@@ -149,7 +473,7 @@ Lexer::LexStringLiteral(Token &Result, const char *CurPtr,
     if (C == '\\')
       C = PeekAndConsumeChar(CurPtr, Result);
 
-    if (C == '\n' && C == '\r' || /* Newline */
+    if (C == '\n' || C == '\r' || /* Newline */
         (C == 0 && (CurPtr - 1) == BufferEnd /* End of file */)) {
       CreateTokenWithChars(Result, CurPtr - 1, Unknown);
       return true;
@@ -178,11 +502,7 @@ Lexer::LexAngledStringLiteral(Token &Result, const char *CurPtr) {
 
   // Keep consuming characters until we find the closing (>)
   while (C != '>') {
-    // Skip escaped characters
-    if (C == '\n')
-      C = PeekAndConsumeChar(CurPtr, Result);
-
-    if (C == '\n' && C == '\r' || /* Newline */
+    if (C == '\n' || C == '\r' || /* Newline */
         (C == 0 && (CurPtr - 1) == BufferEnd /* End of file */)) {
       // Must be a lone < character. Return this as such.
       CreateTokenWithChars(Result, CurPtr - 1, Less);
@@ -205,10 +525,10 @@ Lexer::LexCharacterConstant(Token &Result, const char *CurPtr,
 
   while (C != '\'') {
     // Skip escaped characters
-    if (C == '\n')
+    if (C == '\\')
       C = PeekAndConsumeChar(CurPtr, Result);
 
-    if (C == '\n' && C == '\r' || /* Newline */
+    if (C == '\n' || C == '\r' || /* Newline */
         (C == 0 && (CurPtr - 1) == BufferEnd /* End of file */)) {
       CreateTokenWithChars(Result, CurPtr - 1, Unknown);
       return true;
@@ -233,6 +553,11 @@ Lexer::LexEndOfFile(Token &Result, const char *CurPtr) {
     return true;
   }
 
+  if (LexingRawMode) {
+    CreateTokenWithChars(Result, CurPtr, Eof);
+    return true;
+  }
+
   BufferPtr = CurPtr;
 
   return OwnerPP->HandleEndOfFile(Result);
@@ -241,6 +566,13 @@ Lexer::LexEndOfFile(Token &Result, const char *CurPtr) {
 // Main lexer body
 bool
 Lexer::AdvanceTokenInternal(Token &Result) {
+  // A token at the start of the buffer or after a directive starts a line,
+  // newlines on the way are handled below.
+  bool bAtPhysicalStartOfLine = IsAtPhysicalStartOfLine;
+  IsAtPhysicalStartOfLine = false;
+  if (bAtPhysicalStartOfLine)
+    Result.SetFlag(Token::StartOfLine);
+
 Next:
   const char *CurPtr = BufferPtr;
   if (IsHorizontalWhitespace(*CurPtr)) {
@@ -249,6 +581,7 @@ Next:
     } while (IsHorizontalWhitespace(*CurPtr));
 
     BufferPtr = CurPtr;
+    Result.SetFlag(Token::LeadingSpace);
   }
 
   // TODO: Handle trigraphs and digraphs
@@ -272,9 +605,17 @@ Next:
     if (ParsingPreprocessorDirective) {
       // done with parsing the preprocessor
       ParsingPreprocessorDirective = false;
+      IsAtPhysicalStartOfLine = true;
       Kind = Eod;
+      break;
     }
 
+    // The next token starts a new line, whitespace before the newline does
+    // not count.
+    bAtPhysicalStartOfLine = true;
+    Result.SetFlag(Token::StartOfLine);
+    Result.ClearFlag(Token::LeadingSpace);
+    BufferPtr = CurPtr;
     goto Next;
 
   case ' ':
@@ -538,6 +879,24 @@ Next:
       Kind = Exclaim;
     }
     break;
+  case '/': // //, /*, /=, /
+    Char = PeekChar(CurPtr, Size);
+    if (Char == '*' || (Char == '/' && HasLineComments())) {
+      // A comment is whitespace. After a line comment, the newline ending it
+      // is lexed next.
+      BufferPtr = Char == '*' ? SkipBlockComment(CurPtr + Size)
+                              : SkipLineComment(CurPtr + Size);
+      Result.SetFlag(Token::LeadingSpace);
+      goto Next;
+    }
+
+    if (Char == '=') {
+      CurPtr = ConsumeChar(CurPtr, Size, Result);
+      Kind = SlashEqual;
+    } else {
+      Kind = Slash;
+    }
+    break;
   case '%': // %>, %=, %
     Char = PeekChar(CurPtr, Size);
     if (Char == '=') {
@@ -643,11 +1002,10 @@ Next:
       Kind = HashHash;
       CurPtr = ConsumeChar(CurPtr, Size, Result);
     } else {
-      // TODO: Handle Preprocessor directive.
-
       // We parsed a # at the start of line, it's actually a preprocessor
       // directive. Callback to the preprocessor to handle it.
-      if (/* Token at physical start of line */ 1) {
+      if (!LexingRawMode && !ParsingPreprocessorDirective &&
+          bAtPhysicalStartOfLine) {
         goto HandlePPDirective;
       }
 
@@ -655,6 +1013,16 @@ Next:
     }
     break;
 
+  case '\\':
+    // An escaped newline between tokens joins the lines and is dropped.
+    if (unsigned NewLineSize = GetEscapedNewLineSize(CurPtr)) {
+      BufferPtr = CurPtr + NewLineSize;
+      goto Next;
+    }
+
+    Kind = Unknown;
+    break;
+
   default:
     if (IsAscii(Char)) {
       Kind = Unknown;
@@ -5,6 +5,11 @@
 #include "PreprocessorLexer.h"
 #include "Token.h"
 
+#include <vector>
+
+class CachedTokenStream;
+class IdentifierInfo;
+
 /* ========================================================
  *  Lexer
  * ========================================================
@@ -14,6 +19,8 @@ class Lexer
     : public PreprocessorLexer
     , private NonCopyable<Lexer> {
   friend class Preprocessor;
+  friend class PreprocessorLexer;
+  friend class TokenCache;
 
   const char *BufferStart;
   const char *BufferEnd;
@@ -26,10 +33,32 @@ class Lexer
   /** Current pointer into buffer. Points to the next character to be read. */
   const char *BufferPtr;
 
+  /**
+   * True if the next token starts a line: it is at the start of the buffer or
+   * follows a newline, possibly after whitespace.
+   */
   bool IsAtPhysicalStartOfLine;
 
+  /** Raw tokens of the buffer from a TokenCache, replayed instead of lexing. */
+  const CachedTokenStream *CachedTokens = nullptr;
+
+  /** Index of the next token of CachedTokens. */
+  uint32_t NextCachedToken = 0;
+
+  /** Identifiers of CachedTokens by their index, looked up on first use. */
+  std::vector<IdentifierInfo *> CachedIdentifiers;
+
 public:
-  Lexer(FileID FID, Preprocessor &InPP, std::string &InputFile);
+  /** Create a lexer for the file FID, which InPP is about to enter. */
+  Lexer(FileID FID, Preprocessor &InPP);
+
+  /**
+   * Create a raw lexer for [InBufferPtr, InBufferEnd). InBufferStart is at
+   * FileLoc. Raw lexers do not call back into the preprocessor.
+   */
+  Lexer(SourceLocation FileLoc, const LanguageOptions &InLangOptions,
+        const char *InBufferStart, const char *InBufferPtr,
+        const char *InBufferEnd);
 
 private:
   void InitLexer(const char *InBufferStart, const char *InBufferPtr,
@@ -39,6 +68,9 @@ private:
   bool AdvanceToken(Token &Result);
   bool AdvanceTokenInternal(Token &Result);
 
+  /** Return the next token of CachedTokens. */
+  bool AdvanceCachedToken(Token &Result);
+
 public:
   /** Source code buffer. */
   std::string GetBuffer() const {
@@ -51,6 +83,32 @@ public:
   /** Return a source location for the specified offset in the current file. */
   SourceLocation GetSourceLocation(const char *Loc, unsigned TokLen = 1) const;
 
+  /**
+   * Skip the replacement list of a #define without lexing it. On return the
+   * lexer is positioned at the newline that ends the directive. Comments
+   * follow the lexer's rules, a block comment can span lines. BodyLoc and
+   * BodyLength describe the body with surrounding whitespace and comments
+   * trimmed.
+   */
+  void SkipMacroBody(SourceLocation &BodyLoc, unsigned &BodyLength);
+
+  /**
+   * Returns the spelling of Tok, whose text starts at TokStart, and sets
+   * Length to its length. Clean tokens are returned in place and nothing is
+   * copied. Tokens with escaped newlines or trigraphs are cleaned into
+   * Buffer, which is grown as needed and can be reused between calls.
+   */
+  static const char *GetSpelling(const Token &Tok, const char *TokStart,
+                                 const LanguageOptions &LangOptions,
+                                 std::string &Buffer, unsigned &Length);
+
+  /**
+   * Replay Tokens, the raw tokens of this buffer, instead of lexing it. The
+   * tokens from the buffer position on are used; text consumed directly, like
+   * a skipped macro body or a header name, is stepped over. Null to lex.
+   */
+  void SetCachedTokens(const CachedTokenStream *Tokens);
+
 private:
   /** Creates a token */
   void CreateTokenWithChars(Token &Result, const char *TokenEndPtr,
@@ -91,7 +149,7 @@ private:
   /**
    * Reads a character and advances (increments) the character pointer.
    */
-  inline char PeekAndConsumeChar(const char *Ptr, Token &Tok) {
+  inline char PeekAndConsumeChar(const char *&Ptr, Token &Tok) {
     if (!IsSpecialCharacter(Ptr[0])) {
       return *Ptr++;
     }
@@ -103,18 +161,43 @@ private:
   }
 
   /** Is some kind of special character */
-  inline bool IsSpecialCharacter(unsigned char C) {
-    return ((C != '?') && (C != '\\'));
+  static bool IsSpecialCharacter(unsigned char C) {
+    return C == '?' || C == '\\';
   }
 
   /**
    * Slower alternative for inlined PeekChar. Works on trigraphs and escape
-   * sequences.
+   * sequences, and marks Tok as needing cleaning if it finds any.
    */
   char PeekCharSlow(const char *Ptr, unsigned &Size, Token *Tok = nullptr);
 
+  /**
+   * Reads the character at Ptr once escaped newlines and trigraphs are
+   * replaced, and adds the number of bytes it spans to Size.
+   */
+  static char PeekCharNoFlags(const char *Ptr, unsigned &Size,
+                              const LanguageOptions &LangOptions);
+
   bool IsHexLiteral(const char *Start, const LanguageOptions &LangOptions);
 
+  /**
+   * Skip the line comment whose text starts at CurPtr, after the "//".
+   * Returns the newline that ends it; escaped newlines continue it.
+   */
+  const char *SkipLineComment(const char *CurPtr) const;
+
+  /**
+   * Skip the block comment whose text starts at CurPtr, after its opening.
+   * Returns the position after its end, or the end of the buffer if it is
+   * not terminated.
+   */
+  const char *SkipBlockComment(const char *CurPtr) const;
+
+  /** True if "//" starts a comment in this language. */
+  bool HasLineComments() const {
+    return LangOptions.C99 || LangOptions.CPlusPlus;
+  }
+
   /*==================== Lexer Methods ================================*/
 
   // The lexer identifies every letter sequence as identifiers. In the next
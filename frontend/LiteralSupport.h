@@ -0,0 +1,108 @@
+#ifndef LITERAL_SUPPORT_H
+#define LITERAL_SUPPORT_H
+
+#include "Options.h"
+
+#include <cstdint>
+
+/* ========================================================
+ *  NumericLiteralParser
+ * ========================================================
+ */
+
+/**
+ * Parses the spelling of a NumericConstant token, a pp-number, into a
+ * decimal, hexadecimal, octal or binary integer with its suffixes, or a
+ * decimal or hexadecimal floating literal. Digit separators are accepted in
+ * C++14 and C2x. The spelling must be clean (see Preprocessor::GetSpelling).
+ *
+ * The constructor only classifies the literal, its value is computed on
+ * demand. Long runs of digits are converted eight at a time; floating values
+ * are correctly rounded, with a fallback to strtod for the rare literals
+ * with more digits than fit in 64 bits that fall close to a tie.
+ */
+class NumericLiteralParser {
+  const char *TokBegin;
+  const char *TokEnd;
+
+  /** First digit after the radix prefix. */
+  const char *DigitsBegin;
+
+  /** End of the digits, and of the exponent if any. */
+  const char *SuffixBegin;
+
+  /** The '.' if any. */
+  const char *PeriodPos = nullptr;
+
+  /** The 'e' or 'p' if any. */
+  const char *ExponentPos = nullptr;
+
+  unsigned Radix = 10;
+
+  bool bHadError = false;
+  bool bSawDigitSeparator = false;
+
+  /** Integer suffixes. */
+  bool bIsUnsigned = false;
+  bool bIsLong = false;
+  bool bIsLongLong = false;
+
+  /** Floating suffixes. */
+  bool bIsFloat = false;
+  bool bIsLongDouble = false;
+
+public:
+  NumericLiteralParser(const char *Spelling, unsigned Length,
+                       const LanguageOptions &LangOptions);
+
+  bool HadError() const { return bHadError; }
+
+  unsigned GetRadix() const { return Radix; }
+
+  bool IsIntegerLiteral() const { return !PeriodPos && !ExponentPos; }
+  bool IsFloatingLiteral() const { return !IsIntegerLiteral(); }
+
+  bool IsUnsigned() const { return bIsUnsigned; }
+  bool IsLong() const { return bIsLong; }
+  bool IsLongLong() const { return bIsLongLong; }
+
+  bool IsFloat() const { return bIsFloat; }
+  bool IsLongDouble() const { return bIsLongDouble; }
+
+  /**
+   * Compute the value of an integer literal into Value. Returns true if it
+   * does not fit in 64 bits, Value then holds the low 64 bits.
+   */
+  bool GetIntegerValue(uint64_t &Value) const;
+
+  /**
+   * The value of a floating literal as a double, rounded to nearest even.
+   * Out of range values become zero or infinity.
+   */
+  double GetFloatValue() const;
+
+private:
+  /**
+   * Read digits of DigitRadix from Ptr, with digit separators between them.
+   * Returns the end of the digits.
+   */
+  const char *SkipDigits(const char *Ptr, unsigned DigitRadix,
+                         const LanguageOptions &LangOptions);
+
+  /** Read an exponent after 'e' or 'p', returns its end. */
+  const char *SkipExponent(const char *Ptr, const LanguageOptions &LangOptions);
+
+  /** Read the suffix starting at SuffixBegin. */
+  void ParseSuffix();
+
+  double GetDecimalFloatValue() const;
+  double GetHexFloatValue() const;
+
+  /** Exponent digits after ExponentPos, saturated far beyond any range. */
+  int32_t GetExponent() const;
+
+  /** Convert with strtod, for the cases the fast paths do not handle. */
+  double GetFloatValueSlow() const;
+};
+
+#endif
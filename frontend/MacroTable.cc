@@ -0,0 +1,192 @@
+#include "MacroTable.h"
+
+#include <cassert>
+
+uint64_t
+MacroTable::Hash(const IdentifierInfo *II) {
+  // Bijective mix of the pointer bits (MurmurHash3 finalizer). Distinct keys
+  // always have distinct hashes, so the trie never needs collision lists.
+  uint64_t H = reinterpret_cast<uintptr_t>(II);
+  H ^= H >> 33;
+  H *= 0xff51afd7ed558ccdULL;
+  H ^= H >> 33;
+  H *= 0xc4ceb9fe1a85ec53ULL;
+  H ^= H >> 33;
+  return H;
+}
+
+void
+MacroTable::Release(Node *N) {
+  if (!N || --N->RefCount)
+    return;
+
+  for (Slot &S : N->Slots) {
+    if (!S.Key)
+      Release(S.Child);
+  }
+  delete N;
+}
+
+MacroTable::Node *
+MacroTable::MakeUnique(Node *N) {
+  if (!N)
+    return new Node();
+  if (N->RefCount == 1)
+    return N;
+
+  // Shared with another table, copy it. The children are now referenced by
+  // both the original and the copy.
+  Node *Clone = new Node();
+  Clone->Bitmap = N->Bitmap;
+  Clone->Slots = N->Slots;
+  for (Slot &S : Clone->Slots) {
+    if (!S.Key)
+      Retain(S.Child);
+  }
+
+  --N->RefCount;
+  return Clone;
+}
+
+MacroDirective *
+MacroTable::Lookup(const IdentifierInfo *II) const {
+  uint64_t KeyHash = Hash(II);
+
+  const Node *N = Root;
+  for (unsigned Shift = 0; N; Shift += BitsPerLevel) {
+    uint32_t Bit = 1u << ((KeyHash >> Shift) & 31);
+    if (!(N->Bitmap & Bit))
+      return nullptr;
+
+    const Slot &S = N->Slots[__builtin_popcount(N->Bitmap & (Bit - 1))];
+    if (S.Key)
+      return S.Key == II ? S.Value : nullptr;
+    N = S.Child;
+  }
+  return nullptr;
+}
+
+void
+MacroTable::Set(IdentifierInfo *II, MacroDirective *MD) {
+  if (SetInNode(Root, II, Hash(II), 0, MD))
+    ++NumEntries;
+}
+
+bool
+MacroTable::SetInNode(Node *&N, IdentifierInfo *II, uint64_t KeyHash,
+                      unsigned Shift, MacroDirective *MD) {
+  assert(Shift < 64 && "Distinct keys with the same hash!");
+  N = MakeUnique(N);
+
+  uint32_t Bit = 1u << ((KeyHash >> Shift) & 31);
+  unsigned Pos = __builtin_popcount(N->Bitmap & (Bit - 1));
+
+  if (!(N->Bitmap & Bit)) {
+    Slot S;
+    S.Key = II;
+    S.Value = MD;
+    N->Slots.insert(N->Slots.begin() + Pos, S);
+    N->Bitmap |= Bit;
+    return true;
+  }
+
+  Slot &S = N->Slots[Pos];
+  if (!S.Key)
+    return SetInNode(S.Child, II, KeyHash, Shift + BitsPerLevel, MD);
+
+  if (S.Key == II) {
+    S.Value = MD;
+    return false;
+  }
+
+  // Two keys share the hash chunk at this level, move both a level down.
+  Node *Child = nullptr;
+  SetInNode(Child, S.Key, Hash(S.Key), Shift + BitsPerLevel, S.Value);
+  SetInNode(Child, II, KeyHash, Shift + BitsPerLevel, MD);
+  S.Key = nullptr;
+  S.Child = Child;
+  return true;
+}
+
+void
+MacroTable::ForEach(
+    const std::function<void(IdentifierInfo *, MacroDirective *)> &Fn) const {
+  ForEachInNode(Root, Fn);
+}
+
+void
+MacroTable::ForEachInNode(
+    const Node *N,
+    const std::function<void(IdentifierInfo *, MacroDirective *)> &Fn) {
+  if (!N)
+    return;
+
+  for (const Slot &S : N->Slots) {
+    if (S.Key)
+      Fn(S.Key, S.Value);
+    else
+      ForEachInNode(S.Child, Fn);
+  }
+}
+
+void
+MacroTable::ForEachDifference(
+    const MacroTable &Other,
+    const std::function<void(IdentifierInfo *)> &Fn) const {
+  DiffNodes(Root, Other.Root, Fn);
+}
+
+void
+MacroTable::DiffNodes(const Node *A, const Node *B,
+                      const std::function<void(IdentifierInfo *)> &Fn) {
+  // Shared subtree, nothing changed below.
+  if (A == B)
+    return;
+
+  auto ReportAll = [&Fn](const Node *N) {
+    ForEachInNode(N, [&Fn](IdentifierInfo *II, MacroDirective *) { Fn(II); });
+  };
+
+  auto ReportSlot = [&](const Slot &S) {
+    if (S.Key)
+      Fn(S.Key);
+    else
+      ReportAll(S.Child);
+  };
+
+  if (!A || !B)
+    return ReportAll(A ? A : B);
+
+  uint32_t Chunks = A->Bitmap | B->Bitmap;
+  while (Chunks) {
+    uint32_t Bit = Chunks & -Chunks;
+    Chunks &= Chunks - 1;
+
+    const Slot *SA = (A->Bitmap & Bit)
+                         ? &A->Slots[__builtin_popcount(A->Bitmap & (Bit - 1))]
+                         : nullptr;
+    const Slot *SB = (B->Bitmap & Bit)
+                         ? &B->Slots[__builtin_popcount(B->Bitmap & (Bit - 1))]
+                         : nullptr;
+
+    if (!SA || !SB) {
+      ReportSlot(SA ? *SA : *SB);
+      continue;
+    }
+
+    if (!SA->Key && !SB->Key) {
+      DiffNodes(SA->Child, SB->Child, Fn);
+      continue;
+    }
+
+    if (SA->Key && SA->Key == SB->Key) {
+      if (SA->Value != SB->Value)
+        Fn(SA->Key);
+      continue;
+    }
+
+    // Different keys, or a pair on one side and a subtree on the other.
+    ReportSlot(*SA);
+    ReportSlot(*SB);
+  }
+}
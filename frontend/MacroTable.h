@@ -0,0 +1,117 @@
+#ifndef MACRO_TABLE_H
+#define MACRO_TABLE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class IdentifierInfo;
+class MacroDirective;
+
+/* ========================================================
+ *  MacroTable
+ * ========================================================
+ */
+
+/**
+ * Persistent map from an identifier to the most recent #define or #undef of
+ * it.
+ *
+ * The table is a hash array mapped trie with 32-way nodes. Copying a table
+ * is O(1): both copies share all the nodes, which are reference counted.
+ * Updates copy the nodes on the path from the root to the entry if they are
+ * shared, and modify them in place otherwise. This makes snapshots of the
+ * macro state of the preprocessor cheap, and restoring one is a pointer swap.
+ */
+class MacroTable {
+  struct Node;
+
+  /** Either a key/value pair, or a child node if Key is null. */
+  struct Slot {
+    IdentifierInfo *Key;
+    union {
+      MacroDirective *Value;
+      Node *Child;
+    };
+  };
+
+  struct Node {
+    unsigned RefCount = 1;
+
+    /** Bit N is set if the hash chunk N is present in Slots. */
+    uint32_t Bitmap = 0;
+
+    /** Occupied slots in hash chunk order. */
+    std::vector<Slot> Slots;
+  };
+
+  Node *Root = nullptr;
+
+  /** Number of entries. */
+  unsigned NumEntries = 0;
+
+  static constexpr unsigned BitsPerLevel = 5;
+
+public:
+  MacroTable() = default;
+  MacroTable(const MacroTable &Other)
+      : Root(Retain(Other.Root))
+      , NumEntries(Other.NumEntries) {}
+  MacroTable &operator=(const MacroTable &Other) {
+    Node *OldRoot = Root;
+    Root = Retain(Other.Root);
+    NumEntries = Other.NumEntries;
+    Release(OldRoot);
+    return *this;
+  }
+  ~MacroTable() { Release(Root); }
+
+  /** Returns the directive stored for II, or null. */
+  MacroDirective *Lookup(const IdentifierInfo *II) const;
+
+  /** Store MD as the directive of II, replacing any previous one. */
+  void Set(IdentifierInfo *II, MacroDirective *MD);
+
+  unsigned size() const { return NumEntries; }
+  bool empty() const { return NumEntries == 0; }
+
+  /** Call Fn for every entry of the table. */
+  void ForEach(
+      const std::function<void(IdentifierInfo *, MacroDirective *)> &Fn) const;
+
+  /**
+   * Call Fn for every identifier whose directive differs between this table
+   * and Other. Subtrees shared by both tables are skipped, so the cost is
+   * proportional to the number of changes since they diverged. Fn may also be
+   * called for some identifiers whose directive did not change.
+   */
+  void ForEachDifference(const MacroTable &Other,
+                         const std::function<void(IdentifierInfo *)> &Fn) const;
+
+private:
+  static uint64_t Hash(const IdentifierInfo *II);
+
+  static Node *Retain(Node *N) {
+    if (N)
+      ++N->RefCount;
+    return N;
+  }
+  static void Release(Node *N);
+
+  /** Return a node for N that may be modified by the caller. */
+  static Node *MakeUnique(Node *N);
+
+  /** Returns true if a new key was inserted. */
+  static bool SetInNode(Node *&N, IdentifierInfo *II, uint64_t KeyHash,
+                        unsigned Shift, MacroDirective *MD);
+
+  static void
+  ForEachInNode(const Node *N,
+                const std::function<void(IdentifierInfo *, MacroDirective *)>
+                    &Fn);
+
+  static void DiffNodes(const Node *A, const Node *B,
+                        const std::function<void(IdentifierInfo *)> &Fn);
+};
+
+#endif
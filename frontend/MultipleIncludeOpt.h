@@ -0,0 +1,65 @@
+#ifndef MULTIPLE_INCLUDE_OPT_H
+#define MULTIPLE_INCLUDE_OPT_H
+
+class IdentifierInfo;
+
+/**
+ * Detects the include guard of a file as it is lexed:
+ *
+ *   #ifndef X
+ *   ...
+ *   #endif
+ *
+ * with no tokens outside of the conditional, only whitespace and comments.
+ * Including such a file again while X is defined produces nothing, so it does
+ * not need to be entered; see Preprocessor::ShouldEnterIncludeFile.
+ */
+class MultipleIncludeOpt {
+  /**
+   * True if a token was read outside of the guard: before the #ifndef, or
+   * after its #endif.
+   */
+  bool bReadAnyTokens = false;
+
+  /** Macro of the #ifndef that may be the guard, null if there is none. */
+  const IdentifierInfo *TheMacro = nullptr;
+
+public:
+  /** The file cannot have a guard anymore. */
+  void Invalidate() {
+    bReadAnyTokens = true;
+    TheMacro = nullptr;
+  }
+
+  /** A token that is not whitespace or a comment was read. */
+  void ReadToken() { bReadAnyTokens = true; }
+
+  bool HasReadAnyTokens() const { return bReadAnyTokens; }
+
+  /** An #ifndef Macro opens a conditional at the top level of the file. */
+  void EnterTopLevelIfndef(const IdentifierInfo *Macro) {
+    // A second top-level conditional, the first one was not a guard.
+    if (TheMacro)
+      return Invalidate();
+    TheMacro = Macro;
+  }
+
+  /** Any other conditional directive at the top level of the file. */
+  void EnterTopLevelConditional() { Invalidate(); }
+
+  /** The #endif of a top-level conditional. */
+  void ExitTopLevelConditional() {
+    if (!TheMacro)
+      return Invalidate();
+
+    // Anything read from here on is after the guard.
+    bReadAnyTokens = false;
+  }
+
+  /** The guard of the file, once all of it has been lexed, or null. */
+  const IdentifierInfo *GetControllingMacroAtEndOfFile() const {
+    return bReadAnyTokens ? nullptr : TheMacro;
+  }
+};
+
+#endif
@@ -1,26 +1,40 @@
 #ifndef LANG_OPTIONS_H
 #define LANG_OPTIONS_H
 
+#include <cstdint>
+
 /** C/C++ language options. */
 struct LanguageOptions {
-
 #define LANG_OPT(Name, Bits, Default, Description) unsigned Name : Bits;
-  // clang-format off
-  LANG_OPT(C99,         1, 0, "C99")
-  LANG_OPT(C11,         1, 0, "C11")
-  LANG_OPT(C17,         1, 0, "C17")
-  LANG_OPT(C2x,         1, 0, "C2x")
+#include "LangOptions.list"
+
+  /** Every option starts out at its Default in LangOptions.list. */
+  LanguageOptions() {
+#define LANG_OPT(Name, Bits, Default, Description) Name = Default;
+#include "LangOptions.list"
+  }
+
+  /**
+   * Pack all the options into an integer, for files that are only valid for
+   * the options they were produced with.
+   */
+  uint64_t Serialize() const {
+    uint64_t Result = 0;
+    unsigned Shift = 0;
+#define LANG_OPT(Name, Bits, Default, Description)                             \
+  Result |= uint64_t(Name) << Shift;                                           \
+  Shift += Bits;
+#include "LangOptions.list"
+    return Result;
+  }
+};
 
-  LANG_OPT(CPlusPlus,   1, 0, "C++")
-  LANG_OPT(CPlusPlus11, 1, 0, "C++11")
-  LANG_OPT(CPlusPlus14, 1, 0, "C++14")
-  LANG_OPT(CPlusPlus17, 1, 0, "C++17")
-  LANG_OPT(CPlusPlus20, 1, 0, "C++20")
-  LANG_OPT(CPlusPlus2b, 1, 0, "C++2b")
+/** Options controlling the preprocessed output of -E. */
+struct PreprocessorOutputOptions {
+  /** Emit GNU line markers, "# 12 "foo.h" 1". Cleared by -P. */
+  unsigned ShowLineMarkers : 1;
 
-  LANG_OPT(Trigraphs,   1, 0, "Trigraphs")
-  LANG_OPT(Digraphs,    1, 0, "Digraphs")
-  // clang-format on
+  PreprocessorOutputOptions() : ShowLineMarkers(1) {}
 };
 
 #endif
@@ -0,0 +1,166 @@
+#ifndef PCH_FORMAT_H
+#define PCH_FORMAT_H
+
+#include <cstdint>
+
+/* ========================================================
+ *  PCH file layout
+ * ========================================================
+ */
+
+/**
+ * A precompiled preamble is a single file meant to be mapped into memory and
+ * used in place. It starts with a PCHHeader; all the other parts are found
+ * through byte offsets from the start of the file and are aligned for direct
+ * access. Strings are stored as an offset and a length and are followed by a
+ * null character.
+ *
+ * Source locations are stored in the 32-bit raw encoding from the
+ * SourceManager that wrote the file, see SourceLocation::GetRawEncoding32,
+ * whatever the width of locations in the build. Readers reserve a range of
+ * loaded offsets for all of them and translate them by a constant.
+ * SourceManager entries are read on first use; the separate offset table is
+ * all that is needed to map a location to its entry.
+ */
+constexpr uint32_t PCHMagic = 0x48435043; // "CPCH"
+constexpr uint32_t PCHVersion = 4;
+
+struct PCHHeader {
+  uint32_t Magic;
+  uint32_t Version;
+
+  /** LanguageOptions::Serialize() of the writer. */
+  uint64_t LangOptions;
+
+  /** Size of the whole file, to reject truncated files. */
+  uint32_t FileSize;
+
+  /** Value of __COUNTER__ at the end of the preamble. */
+  uint32_t CounterValue;
+
+  /**
+   * The offsets of source locations in the file span [1, SLocSize), the
+   * local offsets of the writer.
+   */
+  uint32_t SLocSize;
+
+  uint32_t NumSLocEntries;
+  uint32_t SLocEntriesOffset;
+
+  /** The Offset of every SLoc entry, in the same order, as a dense array. */
+  uint32_t SLocOffsetsOffset;
+
+  uint32_t NumFiles;
+  uint32_t FilesOffset;
+
+  /** Identifier hash table, NumBuckets is a power of two. */
+  uint32_t NumBuckets;
+  uint32_t BucketsOffset;
+  uint32_t NumIdentifiers;
+};
+
+/** A string in the file. */
+struct PCHString {
+  uint32_t Offset;
+  uint32_t Length;
+};
+
+enum PCHSLocEntryKind : uint32_t {
+  PCH_SK_File,
+  PCH_SK_Expansion,
+};
+
+/** An entry of the SourceManager, in FileID order. */
+struct PCHSLocEntry {
+  uint32_t Offset;
+  uint32_t Kind;
+
+  union {
+    struct {
+      uint32_t IncludeLoc;
+
+      /** Index into the file table, PCHNoFile for memory buffers. */
+      uint32_t FileIndex;
+
+      /** The contents, stored in the PCH file. */
+      PCHString Buffer;
+      PCHString Name;
+    } File;
+
+    struct {
+      uint32_t SpellingLoc;
+      uint32_t ExpansionLocStart;
+      uint32_t ExpansionLocEnd;
+    } Expansion;
+  };
+};
+
+constexpr uint32_t PCHNoFile = ~0U;
+
+enum PCHFileFlags : uint32_t {
+  PCH_FF_Included = 0x1,
+  PCH_FF_OnceOnly = 0x2,
+  PCH_FF_HasControllingMacro = 0x4,
+};
+
+/**
+ * A file the preamble read. Its size and modification time are checked when
+ * the PCH is loaded, the file is out of date if either changed.
+ */
+struct PCHFile {
+  PCHString Path;
+  uint64_t Size;
+  int64_t ModificationTime;
+  uint32_t Flags;
+  PCHString ControllingMacro;
+
+  /**
+   * Index of the first SLoc entry of the file, PCHNoSLocEntry if it has
+   * none. Lets readers find the FileID of a file without reading entries.
+   */
+  uint32_t FirstSLocEntry;
+};
+
+constexpr uint32_t PCHNoSLocEntry = ~0U;
+
+enum PCHIdentifierFlags : uint32_t {
+  PCH_IF_FunctionLike = 0x1,
+  PCH_IF_Variadic = 0x2,
+};
+
+/**
+ * An identifier defined as a macro at the end of the preamble, a record in
+ * the chain of its hash bucket. Only the latest #define is kept, identifiers
+ * that are #undef'ed at the end are not macros and are left out.
+ */
+struct PCHIdentifier {
+  /** Offset of the next record in the bucket, 0 at the end. */
+  uint32_t Next;
+  uint32_t Hash;
+  PCHString Name;
+
+  uint32_t Flags;
+  uint32_t DirectiveLoc;
+
+  uint32_t DefinitionLoc;
+  uint32_t DefinitionEndLoc;
+  uint32_t BodyLoc;
+  uint32_t BodyLength;
+
+  /** Parameter names, an array of NumParameters PCHStrings. */
+  uint32_t NumParameters;
+  uint32_t ParametersOffset;
+};
+
+/** Hash of identifier names in the table, FNV-1a. */
+inline uint32_t
+HashPCHIdentifier(const char *Name, uint32_t Length) {
+  uint32_t Hash = 2166136261U;
+  for (uint32_t I = 0; I < Length; ++I) {
+    Hash ^= static_cast<unsigned char>(Name[I]);
+    Hash *= 16777619U;
+  }
+  return Hash;
+}
+
+#endif
@@ -0,0 +1,360 @@
+#include "PCHReader.h"
+
+#include "FileManager.h"
+#include "Options.h"
+#include "Preprocessor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+
+PCHReader::~PCHReader() {
+  if (Header) {
+    Identifiers.SetExternalLookup(nullptr);
+    PP.GetSourceManager().SetExternalSLocEntrySource(nullptr);
+  }
+  Unmap();
+}
+
+void
+PCHReader::Unmap() {
+  if (Data)
+    ::munmap(const_cast<char *>(Data), DataSize);
+  Data = nullptr;
+  DataSize = 0;
+  Header = nullptr;
+}
+
+PCHReader::LoadResult
+PCHReader::ReadPCH(const std::string &Path) {
+  assert(!Data && "A PCH is already loaded!");
+
+  int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD < 0)
+    return LR_Failure;
+
+  struct stat StatBuf;
+  if (::fstat(FD, &StatBuf) != 0 ||
+      static_cast<size_t>(StatBuf.st_size) < sizeof(PCHHeader)) {
+    ::close(FD);
+    return LR_Failure;
+  }
+
+  void *Mapping =
+      ::mmap(nullptr, StatBuf.st_size, PROT_READ, MAP_PRIVATE, FD, 0);
+  ::close(FD);
+  if (Mapping == MAP_FAILED)
+    return LR_Failure;
+
+  Data = static_cast<const char *>(Mapping);
+  DataSize = StatBuf.st_size;
+  Header = reinterpret_cast<const PCHHeader *>(Data);
+
+  LoadResult Result = ValidateHeader();
+  if (Result == LR_Success)
+    Result = ReadFiles();
+  if (Result != LR_Success) {
+    Unmap();
+    return Result;
+  }
+
+  Result = ReadSLocEntries();
+  if (Result != LR_Success) {
+    Unmap();
+    return Result;
+  }
+
+  // From here on, identifiers are looked up in the PCH as they are created.
+  // The ones created before, like keywords, are checked right away.
+  Identifiers.SetExternalLookup(this);
+
+  std::vector<std::pair<std::string, IdentifierInfo *>> Existing(
+      Identifiers.begin(), Identifiers.end());
+  for (const auto &Entry : Existing) {
+    const PCHIdentifier *Record =
+        FindIdentifier(Entry.first.data(), Entry.first.size());
+    if (Record && Entry.second && !Entry.second->GetHasMacroDefinition())
+      ReadMacro(*Entry.second, *Record);
+  }
+
+  ReadIncludeState();
+  PP.CounterValue = Header->CounterValue;
+  return LR_Success;
+}
+
+PCHReader::LoadResult
+PCHReader::ValidateHeader() const {
+  if (Header->Magic != PCHMagic || Header->Version != PCHVersion ||
+      Header->FileSize != DataSize)
+    return LR_Failure;
+
+  if (Header->LangOptions != PP.GetLangOptions().Serialize())
+    return LR_ConfigurationMismatch;
+
+  if (!IsArrayInFile(Header->SLocEntriesOffset, Header->NumSLocEntries,
+                     sizeof(PCHSLocEntry), alignof(PCHSLocEntry)) ||
+      !IsArrayInFile(Header->SLocOffsetsOffset, Header->NumSLocEntries,
+                     sizeof(uint32_t), alignof(uint32_t)) ||
+      !IsArrayInFile(Header->FilesOffset, Header->NumFiles, sizeof(PCHFile),
+                     alignof(PCHFile)) ||
+      !IsArrayInFile(Header->BucketsOffset, Header->NumBuckets,
+                     sizeof(uint32_t), alignof(uint32_t)))
+    return LR_Failure;
+
+  if (!Header->NumBuckets || (Header->NumBuckets & (Header->NumBuckets - 1)))
+    return LR_Failure;
+
+  // Offsets of entries are distinct and within [1, SLocSize).
+  if (!Header->SLocSize || Header->NumSLocEntries >= Header->SLocSize)
+    return LR_Failure;
+
+  return LR_Success;
+}
+
+bool
+PCHReader::IsStringInFile(const PCHString &Str) const {
+  // Length < DataSize - Offset leaves room for the null terminator.
+  return Str.Offset <= DataSize && Str.Length < DataSize - Str.Offset &&
+         Data[Str.Offset + Str.Length] == '\0';
+}
+
+bool
+PCHReader::IsArrayInFile(uint32_t Offset, uint64_t Count, size_t Size,
+                         size_t Alignment) const {
+  return Offset % Alignment == 0 && Offset <= DataSize &&
+         Count * Size <= DataSize - Offset;
+}
+
+PCHReader::LoadResult
+PCHReader::ReadFiles() {
+  const PCHFile *Records = GetArray<PCHFile>(Header->FilesOffset);
+  Files.resize(Header->NumFiles);
+
+  for (uint32_t I = 0; I < Header->NumFiles; ++I) {
+    if (!IsStringInFile(Records[I].Path) ||
+        ((Records[I].Flags & PCH_FF_HasControllingMacro) &&
+         !IsStringInFile(Records[I].ControllingMacro)))
+      return LR_Failure;
+
+    const FileEntry *File = FileMgr.GetFile(GetString(Records[I].Path));
+    if (!File || static_cast<uint64_t>(File->GetSize()) != Records[I].Size ||
+        File->GetModificationTime() != Records[I].ModificationTime)
+      return LR_OutOfDate;
+    Files[I] = File;
+  }
+  return LR_Success;
+}
+
+SourceLocation
+PCHReader::TranslateLocation(uint32_t RawLocation) const {
+  if (!RawLocation)
+    return SourceLocation();
+
+  // Keep the macro bit of the encoding, move the offset into our range.
+  return SourceLocation::GetFromRawEncoding32(RawLocation)
+      .GetLocWithOffset(BaseOffset - 1);
+}
+
+PCHReader::LoadResult
+PCHReader::ReadSLocEntries() {
+  SourceManager &SourceMgr = PP.GetSourceManager();
+  const uint32_t *Offsets = GetArray<uint32_t>(Header->SLocOffsetsOffset);
+  const PCHSLocEntry *Entries =
+      GetArray<PCHSLocEntry>(Header->SLocEntriesOffset);
+  const PCHFile *Records = GetArray<PCHFile>(Header->FilesOffset);
+
+  // Entries are found by binary search on their offsets, which must be
+  // increasing and within [1, SLocSize). The entries themselves are checked
+  // when they are read.
+  uint32_t PrevOffset = 0;
+  for (uint32_t I = 0; I < Header->NumSLocEntries; ++I) {
+    if (Offsets[I] <= PrevOffset || Offsets[I] >= Header->SLocSize)
+      return LR_Failure;
+    PrevOffset = Offsets[I];
+  }
+
+  for (uint32_t I = 0; I < Header->NumFiles; ++I) {
+    uint32_t First = Records[I].FirstSLocEntry;
+    if (First != PCHNoSLocEntry &&
+        (First >= Header->NumSLocEntries ||
+         Entries[First].Kind != PCH_SK_File ||
+         Entries[First].File.FileIndex != I))
+      return LR_Failure;
+  }
+
+  // Offsets of the writer span [1, SLocSize).
+  std::tie(BaseID, BaseOffset) = SourceMgr.AllocateLoadedSLocEntries(
+      Header->NumSLocEntries, Header->SLocSize - 1);
+
+  // Only the offsets are needed up front, the entries are read on demand.
+  for (uint32_t I = 0; I < Header->NumSLocEntries; ++I)
+    SourceMgr.SetLoadedSLocEntryOffset(BaseID + I, BaseOffset + Offsets[I] - 1);
+
+  // The file table knows the first entry of every file, so TranslateFile
+  // does not need to read them.
+  for (uint32_t I = 0; I < Header->NumFiles; ++I) {
+    if (Records[I].FirstSLocEntry != PCHNoSLocEntry)
+      SourceMgr.SetLoadedFileID(Files[I], BaseID + Records[I].FirstSLocEntry);
+  }
+  SourceMgr.SetExternalSLocEntrySource(this);
+  return LR_Success;
+}
+
+bool
+PCHReader::ReadSLocEntry(int ID) {
+  SourceManager &SourceMgr = PP.GetSourceManager();
+  if (ID < BaseID || ID - BaseID >= static_cast<int>(Header->NumSLocEntries))
+    return false;
+
+  ++NumSLocEntriesRead;
+  uint32_t Index = ID - BaseID;
+  const PCHSLocEntry &Record =
+      GetArray<PCHSLocEntry>(Header->SLocEntriesOffset)[Index];
+  if (Record.Offset != GetArray<uint32_t>(Header->SLocOffsetsOffset)[Index])
+    return false;
+
+  SourceLocation::UIntTy Offset = BaseOffset + Record.Offset - 1;
+
+  if (Record.Kind == PCH_SK_Expansion) {
+    SourceMgr.CreateLoadedExpansion(
+        ExpansionInfo::Create(
+            TranslateLocation(Record.Expansion.SpellingLoc),
+            TranslateLocation(Record.Expansion.ExpansionLocStart),
+            TranslateLocation(Record.Expansion.ExpansionLocEnd)),
+        ID, Offset);
+    return true;
+  }
+
+  if (Record.Kind != PCH_SK_File || !IsStringInFile(Record.File.Buffer) ||
+      !IsStringInFile(Record.File.Name) ||
+      (Record.File.FileIndex != PCHNoFile &&
+       Record.File.FileIndex >= Header->NumFiles))
+    return false;
+
+  std::unique_ptr<FileContentCache> Content(new FileContentCache());
+  Content->SetUnownedBuffer(Data + Record.File.Buffer.Offset,
+                            Record.File.Buffer.Length);
+  Content->SetFileName(GetString(Record.File.Name));
+  if (Record.File.FileIndex != PCHNoFile)
+    Content->SetFileEntry(Files[Record.File.FileIndex]);
+
+  SourceMgr.CreateFileID(*Content, TranslateLocation(Record.File.IncludeLoc),
+                         ID, Offset);
+  ContentCaches.push_back(std::move(Content));
+  return true;
+}
+
+void
+PCHReader::ReadIncludeState() {
+  const PCHFile *Records = GetArray<PCHFile>(Header->FilesOffset);
+  for (uint32_t I = 0; I < Header->NumFiles; ++I) {
+    const PCHFile &Record = Records[I];
+    if (Record.Flags & PCH_FF_Included)
+      PP.IncludedFiles.push_back(Files[I]);
+    if (Record.Flags & PCH_FF_OnceOnly)
+      PP.MarkFileIncludeOnce(Files[I]);
+    if (Record.Flags & PCH_FF_HasControllingMacro) {
+      std::string Name = GetString(Record.ControllingMacro);
+      PP.SetFileControllingMacro(Files[I], &Identifiers.GetOrCreate(Name));
+    }
+  }
+}
+
+const PCHIdentifier *
+PCHReader::FindIdentifier(const char *Name, size_t Length) const {
+  uint32_t Hash = HashPCHIdentifier(Name, Length);
+  const uint32_t *Buckets = GetArray<uint32_t>(Header->BucketsOffset);
+
+  // Every record is in exactly one chain, a chain longer than NumIdentifiers
+  // has a cycle.
+  uint32_t NumRecords = 0;
+  for (uint32_t Offset = Buckets[Hash & (Header->NumBuckets - 1)]; Offset;) {
+    if (++NumRecords > Header->NumIdentifiers ||
+        !IsArrayInFile(Offset, 1, sizeof(PCHIdentifier),
+                       alignof(PCHIdentifier)))
+      return nullptr;
+
+    const PCHIdentifier *Record = GetArray<PCHIdentifier>(Offset);
+    if (Record->Hash == Hash && Record->Name.Length == Length) {
+      if (!IsStringInFile(Record->Name))
+        return nullptr;
+      if (!std::memcmp(Data + Record->Name.Offset, Name, Length))
+        return IsIdentifierValid(*Record) ? Record : nullptr;
+    }
+    Offset = Record->Next;
+  }
+  return nullptr;
+}
+
+bool
+PCHReader::IsIdentifierValid(const PCHIdentifier &Record) const {
+  if (!IsArrayInFile(Record.ParametersOffset, Record.NumParameters,
+                     sizeof(PCHString), alignof(PCHString)))
+    return false;
+
+  const PCHString *Names = GetArray<PCHString>(Record.ParametersOffset);
+  for (uint32_t I = 0; I < Record.NumParameters; ++I) {
+    if (!IsStringInFile(Names[I]))
+      return false;
+  }
+  return true;
+}
+
+IdentifierInfo *
+PCHReader::Get(std::string &Name) {
+  const PCHIdentifier *Record = FindIdentifier(Name.data(), Name.size());
+  if (!Record)
+    return nullptr;
+
+  IdentifierInfo &II = Identifiers.GetOwn(Name);
+  ReadMacro(II, *Record);
+  return &II;
+}
+
+void
+PCHReader::ReadMacro(IdentifierInfo &II, const PCHIdentifier &Record) {
+  ++NumMacrosRead;
+
+  MacroInfo *MI = PP.AllocateMacroInfo(TranslateLocation(Record.DefinitionLoc));
+  MI->SetDefinitionEndLoc(TranslateLocation(Record.DefinitionEndLoc));
+  MI->SetBodyRange(TranslateLocation(Record.BodyLoc), Record.BodyLength);
+
+  if (Record.Flags & PCH_IF_FunctionLike)
+    MI->SetIsFunctionLike();
+  if (Record.Flags & PCH_IF_Variadic)
+    MI->SetIsC99Varargs();
+
+  // Parameters may be macros from the PCH themselves, which is fine: II is in
+  // the identifier table already, so this does not come back for it.
+  std::vector<IdentifierInfo *> Parameters;
+  const PCHString *Names = GetArray<PCHString>(Record.ParametersOffset);
+  for (uint32_t I = 0; I < Record.NumParameters; ++I) {
+    std::string Name = GetString(Names[I]);
+    Parameters.push_back(&Identifiers.GetOrCreate(Name));
+  }
+  MI->SetParameterList(Parameters, PP.MacroAllocator);
+
+  PP.AppendMacroDirective(
+      &II, PP.AllocateMacroDirective(MacroDirective::MD_Define,
+                                     TranslateLocation(Record.DirectiveLoc),
+                                     MI));
+}
+
+void
+PCHReader::PrintStats() const {
+  if (!Header)
+    return;
+
+  std::fprintf(stderr, "\n*** PCH Stats:\n");
+  std::fprintf(stderr, "%u/%u source location entries read, %u files.\n",
+               NumSLocEntriesRead, Header->NumSLocEntries, Header->NumFiles);
+  std::fprintf(stderr, "%u/%u macros read (%.1f%%).\n", NumMacrosRead,
+               Header->NumIdentifiers,
+               Header->NumIdentifiers
+                   ? NumMacrosRead * 100.0 / Header->NumIdentifiers
+                   : 0.0);
+}
@@ -0,0 +1,152 @@
+#ifndef PCH_READER_H
+#define PCH_READER_H
+
+#include "IdentifierTable.h"
+#include "Mixins.h"
+#include "PCHFormat.h"
+#include "SourceManager.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class FileEntry;
+class FileManager;
+class Preprocessor;
+
+/* ========================================================
+ *  PCHReader
+ * ========================================================
+ */
+
+/**
+ * Loads a file written by PCHWriter into a preprocessor that has not entered
+ * any file yet.
+ *
+ * The file is mapped and used in place. Loading validates its header, checks
+ * that the files it was built from did not change, and sets up their
+ * SourceManager entries over the mapped contents; nothing is copied. Macros
+ * are read lazily: the reader answers the identifier table for each
+ * identifier it does not know yet, so only macros the translation unit
+ * actually mentions are ever materialized. SourceManager entries are likewise
+ * only reserved, and read when the SourceManager first asks for them.
+ *
+ * The reader must outlive the preprocessor, which points into the mapping.
+ */
+class PCHReader : public IIdentifierInfoLookup,
+                  public ExternalSLocEntrySource,
+                  private NonCopyable<PCHReader> {
+  Preprocessor &PP;
+  IdentifierInfoTable &Identifiers;
+  FileManager &FileMgr;
+
+  /** The mapped file. */
+  const char *Data = nullptr;
+  size_t DataSize = 0;
+
+  const PCHHeader *Header = nullptr;
+
+  /** FileID of the first SourceManager entry, and its offset. */
+  int BaseID = 0;
+  SourceLocation::UIntTy BaseOffset = 0;
+
+  /** The FileEntry of every file of the file table. */
+  std::vector<const FileEntry *> Files;
+
+  /** Contents of the loaded file entries, pointing into the mapping. */
+  std::vector<std::unique_ptr<FileContentCache>> ContentCaches;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumMacrosRead = 0;
+  unsigned NumSLocEntriesRead = 0;
+
+public:
+  enum LoadResult {
+    /** The PCH is in use. */
+    LR_Success,
+    /** The file cannot be read or is not a valid PCH. */
+    LR_Failure,
+    /** One of the files the PCH was built from changed. */
+    LR_OutOfDate,
+    /** The PCH was built with different language options. */
+    LR_ConfigurationMismatch,
+  };
+
+  PCHReader(Preprocessor &InPP, IdentifierInfoTable &InIdentifiers,
+            FileManager &InFileMgr)
+      : PP(InPP)
+      , Identifiers(InIdentifiers)
+      , FileMgr(InFileMgr) {}
+  ~PCHReader() override;
+
+  /**
+   * Map the PCH at Path and make its state the state of the preprocessor.
+   * On failure nothing is changed and the prefix has to be preprocessed.
+   */
+  LoadResult ReadPCH(const std::string &Path);
+
+  /** Called by the identifier table for identifiers it does not have. */
+  IdentifierInfo *Get(std::string &Name) override;
+
+  /** Called by the SourceManager for loaded entries it does not have. */
+  bool ReadSLocEntry(int ID) override;
+
+  /** Print statistics about the loaded PCH to stderr. */
+  void PrintStats() const;
+
+private:
+  /**
+   * Check the header, and that the tables it points to lie within the file.
+   * This takes constant time; the records of the tables are checked when
+   * they are first read, see ReadSLocEntry and FindIdentifier.
+   */
+  LoadResult ValidateHeader() const;
+
+  /** Does Str and its null terminator lie within the file? */
+  bool IsStringInFile(const PCHString &Str) const;
+
+  /** Does an array of Count elements of Size bytes lie within the file? */
+  bool IsArrayInFile(uint32_t Offset, uint64_t Count, size_t Size,
+                     size_t Alignment) const;
+
+  /** Find the files of the file table, LR_OutOfDate if one changed. */
+  LoadResult ReadFiles();
+
+  /**
+   * Reserve loaded SourceManager entries for the entries of the PCH. Fails
+   * before changing the SourceManager if the offset table is invalid.
+   */
+  LoadResult ReadSLocEntries();
+
+  /** Apply #pragma once and include guards, and the included files. */
+  void ReadIncludeState();
+
+  /**
+   * Returns the record of the identifier Name, or null. A record that does
+   * not lie within the file is treated as missing.
+   */
+  const PCHIdentifier *FindIdentifier(const char *Name, size_t Length) const;
+
+  /** Do the parameter names of Record lie within the file? */
+  bool IsIdentifierValid(const PCHIdentifier &Record) const;
+
+  /** Define II as a macro as described by Record. */
+  void ReadMacro(IdentifierInfo &II, const PCHIdentifier &Record);
+
+  /** Translate a location of the writer into our loaded range. */
+  SourceLocation TranslateLocation(uint32_t RawLocation) const;
+
+  /** Drop the mapping of a PCH that is not going to be used. */
+  void Unmap();
+
+  template <typename T>
+  const T *GetArray(uint32_t Offset) const {
+    return reinterpret_cast<const T *>(Data + Offset);
+  }
+
+  std::string GetString(const PCHString &Str) const {
+    return std::string(Data + Str.Offset, Str.Length);
+  }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "PCHWriter.h"
+
+#include <cstdio>
+#include <cstring>
+
+uint32_t
+PCHWriter::Align(unsigned Alignment) {
+  Buffer.resize((Buffer.size() + Alignment - 1) & ~size_t(Alignment - 1));
+  return Buffer.size();
+}
+
+uint32_t
+PCHWriter::AddBytes(const void *Data, size_t Size, unsigned Alignment) {
+  uint32_t Offset = Align(Alignment);
+  if (Size)
+    Buffer.append(static_cast<const char *>(Data), Size);
+  return Offset;
+}
+
+PCHString
+PCHWriter::AddString(const char *Data, size_t Length) {
+  PCHString Str;
+  Str.Offset = Buffer.size();
+  Str.Length = Length;
+  Buffer.append(Data, Length);
+  Buffer.push_back('\0');
+  return Str;
+}
+
+uint32_t
+PCHWriter::GetFileIndex(const FileEntry *File) {
+  auto It = FileIndices.find(File);
+  if (It != FileIndices.end())
+    return It->second;
+
+  PCHFile Record;
+  std::memset(&Record, 0, sizeof(Record));
+  Record.Path = AddString(File->GetRealPathName());
+  Record.Size = File->GetSize();
+  Record.ModificationTime = File->GetModificationTime();
+  Record.FirstSLocEntry = PCHNoSLocEntry;
+
+  Files.push_back(Record);
+  return FileIndices[File] = Files.size() - 1;
+}
+
+void
+PCHWriter::WriteSLocEntries(PCHHeader &Header,
+                            const SourceManager::Checkpoint &SourceMgrState) {
+  const SourceManager &SourceMgr = PP.GetSourceManager();
+
+  std::vector<PCHSLocEntry> Entries(SourceMgrState.NumLocalEntries);
+  std::vector<uint32_t> Offsets(SourceMgrState.NumLocalEntries);
+  for (unsigned Index = 0; Index < SourceMgrState.NumLocalEntries; ++Index) {
+    const SourceLocationEntry &Entry = SourceMgr.GetLocalSLocEntry(Index);
+    PCHSLocEntry &Record = Entries[Index];
+    std::memset(&Record, 0, sizeof(Record));
+    assert(Entry.GetOffset() < (1U << 31) && "Preamble too large for a PCH!");
+    Record.Offset = Offsets[Index] = Entry.GetOffset();
+
+    if (Entry.IsExpansion()) {
+      const ExpansionInfo &Expansion = Entry.GetExpansion();
+      Record.Kind = PCH_SK_Expansion;
+      Record.Expansion.SpellingLoc =
+          Expansion.SpellingLocation.GetRawEncoding32();
+      Record.Expansion.ExpansionLocStart =
+          Expansion.ExpansionLocStart.GetRawEncoding32();
+      Record.Expansion.ExpansionLocEnd =
+          Expansion.ExpansionLocEnd.GetRawEncoding32();
+      continue;
+    }
+
+    const FileInfo &File = Entry.GetFile();
+    const FileContentCache *Content = File.GetContentCache();
+    Record.Kind = PCH_SK_File;
+    Record.File.IncludeLoc = File.GetIncludeLocation().GetRawEncoding32();
+    Record.File.FileIndex = Content->GetFileEntry()
+                                ? GetFileIndex(Content->GetFileEntry())
+                                : PCHNoFile;
+    if (Record.File.FileIndex != PCHNoFile &&
+        Files[Record.File.FileIndex].FirstSLocEntry == PCHNoSLocEntry)
+      Files[Record.File.FileIndex].FirstSLocEntry = Index;
+    Record.File.Buffer =
+        AddString(Content->GetBufferStart(), Content->GetSize());
+    Record.File.Name = AddString(Content->GetFileName());
+  }
+
+  Header.NumSLocEntries = Entries.size();
+  Header.SLocEntriesOffset =
+      AddBytes(Entries.data(), Entries.size() * sizeof(PCHSLocEntry),
+               alignof(PCHSLocEntry));
+  Header.SLocOffsetsOffset = AddBytes(
+      Offsets.data(), Offsets.size() * sizeof(uint32_t), alignof(uint32_t));
+  assert(SourceMgrState.NextLocalOffset <= (1U << 31) &&
+         "Preamble too large for a PCH!");
+  Header.SLocSize = SourceMgrState.NextLocalOffset;
+}
+
+void
+PCHWriter::WriteFiles(PCHHeader &Header,
+                      const Preprocessor::Checkpoint &State) {
+  for (const FileEntry *File : State.IncludedFiles)
+    Files[GetFileIndex(File)].Flags |= PCH_FF_Included;
+
+  for (const FileEntry *File : State.OnceOnlyFiles)
+    Files[GetFileIndex(File)].Flags |= PCH_FF_OnceOnly;
+
+  for (const auto &Guard : State.ControllingMacros) {
+    // GetFileIndex first, it may grow Files.
+    uint32_t Index = GetFileIndex(Guard.first);
+    Files[Index].Flags |= PCH_FF_HasControllingMacro;
+    Files[Index].ControllingMacro = AddString(Guard.second->GetName());
+  }
+
+  Header.NumFiles = Files.size();
+  Header.FilesOffset = AddBytes(
+      Files.data(), Files.size() * sizeof(PCHFile), alignof(PCHFile));
+}
+
+void
+PCHWriter::WriteIdentifiers(PCHHeader &Header, const MacroTable &Macros) {
+  std::vector<PCHIdentifier> Records;
+  Macros.ForEach([&](IdentifierInfo *II, MacroDirective *MD) {
+    if (!MD->IsDefined())
+      return;
+
+    const MacroInfo *MI = MD->GetMacroInfo();
+    std::string Name = II->GetName();
+
+    PCHIdentifier Record;
+    std::memset(&Record, 0, sizeof(Record));
+    Record.Hash = HashPCHIdentifier(Name.data(), Name.size());
+    Record.Name = AddString(Name);
+    Record.DirectiveLoc = MD->GetLocation().GetRawEncoding32();
+    Record.DefinitionLoc = MI->GetDifinitionLocation().GetRawEncoding32();
+    Record.DefinitionEndLoc = MI->GetDefinitionEndLoc().GetRawEncoding32();
+    Record.BodyLoc = MI->GetBodyLocation().GetRawEncoding32();
+    Record.BodyLength = MI->GetBodyLength();
+
+    if (MI->IsFunctionLike())
+      Record.Flags |= PCH_IF_FunctionLike;
+    if (MI->IsVariadic())
+      Record.Flags |= PCH_IF_Variadic;
+
+    std::vector<PCHString> Parameters;
+    for (unsigned I = 0; I < MI->GetNumParameters(); ++I)
+      Parameters.push_back(AddString(MI->GetParameter(I)->GetName()));
+    Record.NumParameters = Parameters.size();
+    Record.ParametersOffset =
+        AddBytes(Parameters.data(), Parameters.size() * sizeof(PCHString),
+                 alignof(PCHString));
+
+    Records.push_back(Record);
+  });
+
+  // Power of two buckets, about one record per bucket.
+  uint32_t NumBuckets = 1;
+  while (NumBuckets < Records.size())
+    NumBuckets *= 2;
+
+  uint32_t RecordsOffset = Align(alignof(PCHIdentifier));
+  std::vector<uint32_t> Buckets(NumBuckets, 0);
+  for (unsigned I = 0; I < Records.size(); ++I) {
+    uint32_t &Bucket = Buckets[Records[I].Hash & (NumBuckets - 1)];
+    Records[I].Next = Bucket;
+    Bucket = RecordsOffset + I * sizeof(PCHIdentifier);
+  }
+  AddBytes(Records.data(), Records.size() * sizeof(PCHIdentifier),
+           alignof(PCHIdentifier));
+
+  Header.NumIdentifiers = Records.size();
+  Header.NumBuckets = NumBuckets;
+  Header.BucketsOffset = AddBytes(
+      Buckets.data(), Buckets.size() * sizeof(uint32_t), alignof(uint32_t));
+}
+
+bool
+PCHWriter::Write(const std::string &Path) {
+  Preprocessor::Checkpoint State = PP.TakeCheckpoint();
+
+  Buffer.clear();
+  Files.clear();
+  FileIndices.clear();
+
+  PCHHeader Header;
+  std::memset(&Header, 0, sizeof(Header));
+  Header.Magic = PCHMagic;
+  Header.Version = PCHVersion;
+  Header.LangOptions = PP.GetLangOptions().Serialize();
+  Header.CounterValue = State.CounterValue;
+  Buffer.resize(sizeof(PCHHeader));
+
+  WriteSLocEntries(Header, State.SourceMgrCheckpoint);
+  WriteIdentifiers(Header, State.Macros);
+  WriteFiles(Header, State);
+
+  Header.FileSize = Align(8);
+  std::memcpy(&Buffer[0], &Header, sizeof(Header));
+
+  // Readers must never see a partial file, write it aside and rename.
+  std::string TempPath = Path + ".tmp";
+  std::FILE *Out = std::fopen(TempPath.c_str(), "wb");
+  if (!Out)
+    return false;
+
+  bool bSucceeded =
+      std::fwrite(Buffer.data(), 1, Buffer.size(), Out) == Buffer.size();
+  bSucceeded &= std::fclose(Out) == 0;
+  if (bSucceeded)
+    bSucceeded = std::rename(TempPath.c_str(), Path.c_str()) == 0;
+  if (!bSucceeded)
+    std::remove(TempPath.c_str());
+  return bSucceeded;
+}
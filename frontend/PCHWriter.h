@@ -0,0 +1,71 @@
+#ifndef PCH_WRITER_H
+#define PCH_WRITER_H
+
+#include "Mixins.h"
+#include "PCHFormat.h"
+#include "Preprocessor.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FileEntry;
+
+/* ========================================================
+ *  PCHWriter
+ * ========================================================
+ */
+
+/**
+ * Writes the state of the preprocessor after a prefix header, the preamble,
+ * to a file that PCHReader maps into later translation units instead of
+ * preprocessing the prefix again. See PCHFormat.h for the layout.
+ *
+ * The file holds the macros defined at the end of the preamble, the
+ * #pragma once and include guard state of the files it entered, and all the
+ * SourceManager entries with the contents of their files, so that macro
+ * bodies and locations stay valid.
+ */
+class PCHWriter : private NonCopyable<PCHWriter> {
+  Preprocessor &PP;
+
+  /** The file being built. */
+  std::string Buffer;
+
+  /** File table, and the index of each file in it. */
+  std::vector<PCHFile> Files;
+  std::unordered_map<const FileEntry *, uint32_t> FileIndices;
+
+public:
+  PCHWriter(Preprocessor &InPP) : PP(InPP) {}
+
+  /**
+   * Write the current state of the preprocessor to Path. Must be called
+   * between files, like Preprocessor::TakeCheckpoint. Returns false if the
+   * file cannot be written.
+   */
+  bool Write(const std::string &Path);
+
+private:
+  /** Pad the buffer to a multiple of Alignment and return its size. */
+  uint32_t Align(unsigned Alignment);
+
+  /** Append Size bytes and return their offset. */
+  uint32_t AddBytes(const void *Data, size_t Size, unsigned Alignment);
+
+  /** Append a null terminated string. */
+  PCHString AddString(const char *Data, size_t Length);
+  PCHString AddString(const std::string &Str) {
+    return AddString(Str.data(), Str.size());
+  }
+
+  /** Returns the index of File in the file table, adding it if needed. */
+  uint32_t GetFileIndex(const FileEntry *File);
+
+  void WriteSLocEntries(PCHHeader &Header,
+                        const SourceManager::Checkpoint &SourceMgrState);
+  void WriteFiles(PCHHeader &Header, const Preprocessor::Checkpoint &State);
+  void WriteIdentifiers(PCHHeader &Header, const MacroTable &Macros);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PP_CALLBACKS_H
+#define PP_CALLBACKS_H
+
+#include "SourceManager.h"
+
+/**
+ * Told by the preprocessor about events that the token stream does not show,
+ * such as the lexer moving between files. The default implementations do
+ * nothing.
+ */
+class PPCallbacks {
+public:
+  enum FileChangeReason {
+    /** A file was entered, the main file or an #include. */
+    EnterFile,
+    /**
+     * The end of an #include'd file was reached, lexing resumes after the
+     * #include in the includer.
+     */
+    ExitFile,
+  };
+
+  virtual ~PPCallbacks() = default;
+
+  /**
+   * The lexer moved to Loc in another file: the start of a file entered, or
+   * the point in the includer where lexing resumes.
+   */
+  virtual void FileChanged(SourceLocation Loc, FileChangeReason Reason) {}
+};
+
+#endif
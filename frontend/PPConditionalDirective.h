@@ -10,6 +10,12 @@ struct PPConditionalInfo {
   /** Location where the conditional started. */
   SourceLocation IfLocation;
 
+  /** True if the block containing the conditional was being skipped. */
+  bool WasSkipping;
+
+  /** True if one of the branches of the conditional has been entered. */
+  bool FoundNonSkip;
+
   /** True if we've seen a #else in this block. */
   bool FoundElse;
 };
@@ -0,0 +1,95 @@
+#include "PPRecord.h"
+#include "Preprocessor.h"
+
+#include <algorithm>
+#include <string.h>
+
+MacroInfo::MacroInfo(SourceLocation DifinitionLocation)
+    : Location(DifinitionLocation)
+    , ParameterList(nullptr)
+    , NumParameters(0)
+    , bIsFunctionLike(false)
+    , IsC99Varargs(false)
+    , IsBuiltinMacro(false)
+    , bUsedForHeaderGaurd(false)
+    , BodyLength(0)
+    , ReplacementTokens(nullptr)
+    , NumReplacementTokens(0)
+    , bIsBodyLexed(false)
+    , bIsDisabled(false) {}
+
+void
+MacroInfo::SetParameterList(const std::vector<IdentifierInfo *> &Parameters,
+                            BumpAllocator &Allocator) {
+  assert(!ParameterList && !NumParameters && "Parameter list already set!");
+  NumParameters = Parameters.size();
+  if (NumParameters == 0)
+    return;
+
+  ParameterList = Allocator.Allocate<IdentifierInfo *>(NumParameters);
+  std::copy(Parameters.begin(), Parameters.end(), ParameterList);
+}
+
+void
+MacroInfo::SetReplacementTokens(const std::vector<Token> &Tokens,
+                                BumpAllocator &Allocator) {
+  assert(!ReplacementTokens && "Replacement list already set!");
+  NumReplacementTokens = Tokens.size();
+  if (NumReplacementTokens == 0)
+    return;
+
+  ReplacementTokens = Allocator.Allocate<Token>(NumReplacementTokens);
+  std::copy(Tokens.begin(), Tokens.end(), ReplacementTokens);
+}
+
+bool
+MacroInfo::IsIdenticalTo(MacroInfo &Other, Preprocessor &PP) {
+  if (bIsFunctionLike != Other.bIsFunctionLike ||
+      IsC99Varargs != Other.IsC99Varargs ||
+      NumParameters != Other.NumParameters)
+    return false;
+
+  for (unsigned I = 0; I != NumParameters; ++I) {
+    if (ParameterList[I] != Other.ParameterList[I])
+      return false;
+  }
+
+  // Fast path: the replacement lists are spelled the same, so they will lex
+  // into the same tokens. Neither body needs to be materialized.
+  if (BodyLength == Other.BodyLength) {
+    if (BodyLength == 0)
+      return true;
+
+    SourceManager &SM = PP.GetSourceManager();
+    if (!memcmp(SM.GetCharacterData(BodyLocation),
+                SM.GetCharacterData(Other.BodyLocation), BodyLength))
+      return true;
+  }
+
+  // Spellings differ (whitespace, line splices), compare the tokens.
+  PP.LexMacroBody(*this);
+  PP.LexMacroBody(Other);
+
+  if (NumReplacementTokens != Other.NumReplacementTokens)
+    return false;
+
+  std::string BufferA, BufferB;
+  for (unsigned I = 0, E = NumReplacementTokens; I != E; ++I) {
+    const Token &A = ReplacementTokens[I];
+    const Token &B = Other.ReplacementTokens[I];
+    if (A.GetKind() != B.GetKind())
+      return false;
+
+    // Whitespace between the tokens must match, not its amount.
+    if (I && A.HasFlag(Token::LeadingSpace) != B.HasFlag(Token::LeadingSpace))
+      return false;
+
+    unsigned LengthA, LengthB;
+    const char *SpellingA = PP.GetSpelling(A, BufferA, LengthA);
+    const char *SpellingB = PP.GetSpelling(B, BufferB, LengthB);
+    if (LengthA != LengthB || memcmp(SpellingA, SpellingB, LengthA))
+      return false;
+  }
+
+  return true;
+}
@@ -1,13 +1,16 @@
 #ifndef PP_RECORD_H
 #define PP_RECORD_H
 
+#include "Allocator.h"
 #include "SourceManager.h"
+#include "Token.h"
 
 #include <string>
 #include <vector>
 
 class PPEntity;
 class IdentifierInfo;
+class Preprocessor;
 
 class MacroInfo {
   friend class Preprocessor;
@@ -34,6 +37,29 @@ class MacroInfo {
   /** Whether this macro was used as header guard. */
   bool bUsedForHeaderGaurd;
 
+  /**
+   * Location and length of the replacement list as written in the source.
+   *
+   * #define only records the range of the body. The body is lexed into
+   * ReplacementTokens on first expansion, or when a redefinition has to be
+   * checked for compatibility.
+   */
+  SourceLocation BodyLocation;
+  unsigned BodyLength;
+
+  /**
+   * Tokens of the replacement list, allocated next to the MacroInfo. Valid
+   * only once bIsBodyLexed is set.
+   */
+  Token *ReplacementTokens;
+  unsigned NumReplacementTokens;
+
+  /** True once the replacement list has been lexed into ReplacementTokens. */
+  bool bIsBodyLexed;
+
+  /** True while the macro is being expanded; its name is not expanded. */
+  bool bIsDisabled;
+
   MacroInfo(SourceLocation DifinitionLocation);
   ~MacroInfo() = default;
 
@@ -42,6 +68,109 @@ public:
 
   void SetDefinitionEndLoc(SourceLocation EndLoc) { EndLocation = EndLoc; }
   SourceLocation GetDefinitionEndLoc() const { return EndLocation; }
+
+  bool IsFunctionLike() const { return bIsFunctionLike; }
+  bool IsObjectLike() const { return !bIsFunctionLike; }
+  bool IsVariadic() const { return IsC99Varargs; }
+
+  void SetIsFunctionLike() { bIsFunctionLike = true; }
+  void SetIsC99Varargs() { IsC99Varargs = true; }
+
+  /** Copy the parameter list of a function-like macro into this macro. */
+  void SetParameterList(const std::vector<IdentifierInfo *> &Parameters,
+                        BumpAllocator &Allocator);
+
+  unsigned GetNumParameters() const { return NumParameters; }
+  IdentifierInfo *GetParameter(unsigned Index) const {
+    assert(Index < NumParameters && "Invalid parameter index!");
+    return ParameterList[Index];
+  }
+
+  void SetBodyRange(SourceLocation InBodyLocation, unsigned InBodyLength) {
+    BodyLocation = InBodyLocation;
+    BodyLength = InBodyLength;
+  }
+  SourceLocation GetBodyLocation() const { return BodyLocation; }
+  unsigned GetBodyLength() const { return BodyLength; }
+
+  bool IsBodyLexed() const { return bIsBodyLexed; }
+
+  /** Tokens of the replacement list. See Preprocessor::LexMacroBody. */
+  unsigned GetNumTokens() const {
+    assert(bIsBodyLexed && "Macro body has not been lexed yet!");
+    return NumReplacementTokens;
+  }
+  const Token &GetReplacementToken(unsigned Index) const {
+    assert(Index < GetNumTokens() && "Invalid token index!");
+    return ReplacementTokens[Index];
+  }
+
+  bool IsEnabled() const { return !bIsDisabled; }
+  void EnableMacro() {
+    assert(bIsDisabled && "Macro is already enabled!");
+    bIsDisabled = false;
+  }
+  void DisableMacro() {
+    assert(!bIsDisabled && "Macro is already disabled!");
+    bIsDisabled = true;
+  }
+
+  /** Copy the lexed replacement list into this macro. */
+  void SetReplacementTokens(const std::vector<Token> &Tokens,
+                            BumpAllocator &Allocator);
+
+  /**
+   * Return true if the Other macro is a valid redefinition of this macro
+   * (C99 6.10.3p2). Bodies are lexed only if their spellings differ.
+   */
+  bool IsIdenticalTo(MacroInfo &Other, Preprocessor &PP);
+};
+
+/**
+ * A #define or #undef of a macro.
+ *
+ * The directives of an identifier are chained from the most recent one to
+ * the oldest, forming the history of the macro. The head of the chain is the
+ * state of the macro at the current point of preprocessing.
+ */
+class MacroDirective {
+public:
+  enum Kind {
+    MD_Define,
+    MD_Undefine,
+  };
+
+private:
+  /** The previous directive of the same identifier, null if first. */
+  MacroDirective *Previous = nullptr;
+
+  /** The location of the directive. */
+  SourceLocation Location;
+
+  Kind MDKind;
+
+  /** The definition introduced by a MD_Define, null for MD_Undefine. */
+  MacroInfo *Info;
+
+public:
+  MacroDirective(Kind InKind, SourceLocation InLocation, MacroInfo *MI)
+      : Location(InLocation)
+      , MDKind(InKind)
+      , Info(MI) {
+    assert((InKind == MD_Define) == (MI != nullptr) &&
+           "Only #define directives carry a definition!");
+  }
+
+  Kind GetKind() const { return MDKind; }
+  SourceLocation GetLocation() const { return Location; }
+
+  MacroDirective *GetPrevious() const { return Previous; }
+  void SetPrevious(MacroDirective *Prev) { Previous = Prev; }
+
+  /** True if the macro is defined right after this directive. */
+  bool IsDefined() const { return MDKind == MD_Define; }
+
+  MacroInfo *GetMacroInfo() const { return Info; }
 };
 
 class MacroArgs;
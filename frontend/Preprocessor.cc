@@ -1,17 +1,162 @@
 #include "Preprocessor.h"
 #include "IdentifierTable.h"
-
-Preprocessor::Preprocessor(LanguageOptions &Options)
-    : LangOptions(Options) {}
+#include "LiteralSupport.h"
+#include "StreamFingerprint.h"
+#include "TokenCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+Preprocessor::Preprocessor(LanguageOptions &Options, SourceManager &SM)
+    : LangOptions(Options)
+    , SourceMgr(SM) {}
+
+Preprocessor::~Preprocessor() {
+  // A TokenLexer left over from an unfinished expansion enables its macro,
+  // which lives in MacroAllocator; destroy it while the macro is still there.
+  IncludeMacroStack.clear();
+  CurTokenLexer.reset();
+}
 
 void
 Preprocessor::Init() {
+  assert(Identifiers && "SetIdentifierTable not called!");
+
   // Populate the identifier info table about keywords for current language.
   Identifiers->AddKeywords(LangOptions);
 }
 
 void
 Preprocessor::AdvanceToken(Token &Result) {
+  // Replay a token that was looked ahead or backtracked over.
+  if (CachedLexPos != CachedEnd) {
+    Result = CachedTokens[CachedLexPos++ & (CachedTokens.size() - 1)];
+    TrimTokenCache();
+    if (Fingerprint)
+      AddToFingerprint(Result);
+    return;
+  }
+
+  AdvanceTokenUncached(Result);
+
+  // Keep the token around in case the caller backtracks.
+  if (!BacktrackPositions.empty()) {
+    PushCachedToken(Result);
+    ++CachedLexPos;
+  }
+
+  if (Fingerprint)
+    AddToFingerprint(Result);
+}
+
+const Token &
+Preprocessor::LookAhead(unsigned N) {
+  while (CachedEnd - CachedLexPos <= N) {
+    Token Tok;
+    AdvanceTokenUncached(Tok);
+    PushCachedToken(Tok);
+  }
+
+  return CachedTokens[(CachedLexPos + N) & (CachedTokens.size() - 1)];
+}
+
+void
+Preprocessor::EnableStreamFingerprint() {
+  assert(BacktrackPositions.empty() &&
+         "Cannot start fingerprinting while backtracking!");
+  Fingerprint.reset(new StreamFingerprint());
+  StreamPos = NumFingerprintedTokens = 0;
+  bFingerprintHasFile = false;
+}
+
+ContentHash
+Preprocessor::GetStreamFingerprint() const {
+  assert(Fingerprint && "EnableStreamFingerprint not called!");
+  return Fingerprint->GetFingerprint();
+}
+
+void
+Preprocessor::AddToFingerprint(const Token &Tok) {
+  if (StreamPos++ != NumFingerprintedTokens)
+    return;
+  ++NumFingerprintedTokens;
+
+  // Where the output would place the token, see PreprocessedOutputWriter.
+  if (Tok.GetLocation().IsValid()) {
+    std::pair<FileID, unsigned> LocInfo =
+        SourceMgr.GetDecomposedExpansionLoc(Tok.GetLocation());
+    if (!bFingerprintHasFile || LocInfo.first != FingerprintFID) {
+      bFingerprintHasFile = true;
+      FingerprintFID = LocInfo.first;
+      Fingerprint->AddFileChange(
+          SourceMgr.GetContentCache(LocInfo.first).GetFileName(),
+          SourceMgr.GetLineNumber(LocInfo.first, LocInfo.second));
+    } else if (Tok.HasFlag(Token::StartOfLine)) {
+      Fingerprint->AddLine(
+          SourceMgr.GetLineNumber(LocInfo.first, LocInfo.second));
+    }
+  }
+
+  unsigned Length;
+  const char *Spelling = GetSpelling(Tok, FingerprintSpelling, Length);
+  Fingerprint->AddToken(Tok.GetKind(), Tok.GetFlags(), Spelling, Length);
+}
+
+std::vector<Preprocessor::Dependency>
+Preprocessor::GetDependencies() const {
+  std::vector<Dependency> Result;
+  std::unordered_set<const FileEntry *> Seen;
+  for (unsigned I = 0; I < SourceMgr.GetNumLocalSLocEntries(); ++I) {
+    const SourceLocationEntry &Entry = SourceMgr.GetLocalSLocEntry(I);
+    if (!Entry.IsFile())
+      continue;
+
+    const FileContentCache *Content = Entry.GetFile().GetContentCache();
+    const FileEntry *File = Content ? Content->GetFileEntry() : nullptr;
+    if (File && Seen.insert(File).second)
+      Result.push_back({File->GetRealPathName(), Content->GetContentHash()});
+  }
+  return Result;
+}
+
+void
+Preprocessor::CommitBacktrackedTokens() {
+  assert(!BacktrackPositions.empty() && "EnableBacktrackAtThisPos not called!");
+  BacktrackPositions.pop_back();
+  TrimTokenCache();
+}
+
+void
+Preprocessor::Backtrack() {
+  assert(!BacktrackPositions.empty() && "EnableBacktrackAtThisPos not called!");
+  if (Fingerprint)
+    StreamPos -= CachedLexPos - BacktrackPositions.back();
+  CachedLexPos = BacktrackPositions.back();
+  BacktrackPositions.pop_back();
+  TrimTokenCache();
+}
+
+void
+Preprocessor::PushCachedToken(const Token &Tok) {
+  if (CachedEnd - CachedBegin == CachedTokens.size()) {
+    // Full, move the live tokens to a buffer twice the size. Their positions
+    // do not change, only where they wrap around.
+    size_t OldMask = CachedTokens.size() - 1;
+    size_t NewSize = CachedTokens.empty() ? 64 : CachedTokens.size() * 2;
+    std::vector<Token> NewTokens(NewSize);
+    size_t NewMask = NewTokens.size() - 1;
+    for (uint64_t Pos = CachedBegin; Pos != CachedEnd; ++Pos)
+      NewTokens[Pos & NewMask] = CachedTokens[Pos & OldMask];
+    CachedTokens.swap(NewTokens);
+  }
+
+  CachedTokens[CachedEnd++ & (CachedTokens.size() - 1)] = Tok;
+}
+
+void
+Preprocessor::AdvanceTokenUncached(Token &Result) {
   bool ReturnedToken;
   do {
     switch (CurLexerKind) {
@@ -29,37 +174,352 @@ Preprocessor::AdvanceToken(Token &Result) {
   }
 }
 
-std::optional<FileEntry &>
-LookupFile(std::string &Filename, bool bIsAngled) {}
+const FileEntry *
+Preprocessor::LookupFile(const std::string &Filename, bool bIsAngled,
+                         const DirectoryLookup *FromDir,
+                         const DirectoryLookup *&CurDir) {
+  CurDir = nullptr;
+  if (!HS)
+    return nullptr;
+
+  // "foo" is searched relative to the directory of the includer first.
+  const DirectoryEntry *IncluderDir = nullptr;
+  if (CurLexer) {
+    const FileContentCache &Content =
+        SourceMgr.GetContentCache(CurLexer->GetFileID());
+    if (const FileEntry *Includer = Content.GetFileEntry())
+      IncluderDir = Includer->GetDir();
+  }
+
+  return HS->LookupFile(Filename, bIsAngled, IncluderDir, FromDir, CurDir);
+}
 
 void
-Preprocessor::CheckEndOfDirective() {}
+Preprocessor::PrefetchIncludes(FileID FID) {
+  const FileContentCache &Content = SourceMgr.GetContentCache(FID);
+  const FileEntry *File = Content.GetFileEntry();
+  HS->PrefetchIncludes(Content.GetBufferStart(), Content.GetBufferEnd(),
+                       File ? File->GetDir() : nullptr);
+}
 
-bool
-Preprocessor::LexHeaderName(Token &Result) {
-  if (CurLexer) {
-    CurLexer->LexIncludeFilename(Result);
+void
+Preprocessor::UseCachedTokens(Lexer &L) {
+  if (TokCache)
+    L.SetCachedTokens(
+        TokCache->GetTokens(SourceMgr.GetContentCache(L.GetFileID())));
+}
+
+void
+Preprocessor::CheckEndOfDirective() {
+  Token Tmp;
+  LexUnexpanedToken(Tmp);
+
+  if (Tmp.GetKind() != Eod) {
+    // warning: extra tokens at end of directive
+    DiscardUntilEndOfDirective();
+  }
+}
+
+void
+Preprocessor::DiscardUntilEndOfDirective() {
+  Token Tok;
+  do {
+    LexUnexpanedToken(Tok);
+  } while (Tok.GetKind() != Eod && Tok.GetKind() != Eof);
+}
+
+const char *
+Preprocessor::GetSpelling(const Token &Tok, std::string &Buffer,
+                          unsigned &Length) const {
+  if (IdentifierInfo *II = Tok.GetIdentifierInfo()) {
+    const std::string &Name = II->GetName();
+    Length = Name.size();
+    return Name.data();
+  }
+
+  // Eod, Eof and the like have no text.
+  if (!Tok.GetLength()) {
+    Length = 0;
+    return "";
+  }
+
+  // Literals lexed from a buffer point at their text.
+  const char *TokStart = Tok.IsLiteral() ? Tok.GetLiteralData() : nullptr;
+  if (!TokStart)
+    TokStart = SourceMgr.GetCharacterData(Tok.GetLocation());
+  return Lexer::GetSpelling(Tok, TokStart, LangOptions, Buffer, Length);
+}
+
+std::string
+Preprocessor::GetSpelling(const Token &Tok) const {
+  std::string Buffer;
+  unsigned Length;
+  const char *Spelling = GetSpelling(Tok, Buffer, Length);
+  return std::string(Spelling, Length);
+}
+
+IdentifierInfo *
+Preprocessor::LookUpIdentifierInfo(Token &Identifier, const char *Start) {
+  // An identifier spelled with escaped newlines is looked up without them.
+  std::string Name;
+  if (Identifier.HasFlag(Token::NeedsCleaning)) {
+    unsigned Length;
+    Lexer::GetSpelling(Identifier, Start, LangOptions, Name, Length);
+    Name.resize(Length);
   } else {
-    AdvanceToken(Result);
+    Name.assign(Start, Identifier.GetLength());
   }
 
-  std::vector<char> FilenameBuffer(128);
-  if ((Result.GetKind() == Less)) {
-    FilenameBuffer.emplace_back('<');
+  IdentifierInfo *II = &Identifiers->GetOrCreate(Name);
+  Identifier.SetIdentifierInfo(II);
+  return II;
+}
+
+void
+Preprocessor::PrintStats() const {
+  std::fprintf(stderr, "\n*** Preprocessor Stats:\n");
+  std::fprintf(stderr, "%u #define directives.\n", NumDefined);
+  std::fprintf(stderr, "  %u macro bodies lexed on demand (%u%%).\n",
+               NumMacroBodiesLexed,
+               NumDefined ? NumMacroBodiesLexed * 100 / NumDefined : 0);
+  std::fprintf(stderr, "  %u replacement tokens materialized (%zu bytes).\n",
+               NumMacroBodyTokens, NumMacroBodyTokens * sizeof(Token));
+  std::fprintf(stderr,
+               "  %llu of %llu replacement list bytes never lexed.\n",
+               (unsigned long long)(NumDeferredBodyBytes - NumLexedBodyBytes),
+               (unsigned long long)NumDeferredBodyBytes);
+}
+
+/*=============== Checkpoints =======================================*/
+
+Preprocessor::Checkpoint
+Preprocessor::TakeCheckpoint() const {
+  assert(IncludeMacroStack.empty() && !CurTokenLexer &&
+         CachedLexPos == CachedEnd &&
+         "Checkpoint taken in the middle of a file!");
+
+  Checkpoint C;
+  C.Macros = TakeMacroSnapshot();
+  C.PragmaPushMacroInfo = PragmaPushMacroInfo;
+  C.IncludedFiles = IncludedFiles;
+  C.OnceOnlyFiles = OnceOnlyFiles;
+  C.ControllingMacros = ControllingMacros;
+  C.SourceMgrCheckpoint = SourceMgr.TakeCheckpoint();
+  C.CounterValue = CounterValue;
+  return C;
+}
+
+void
+Preprocessor::RestoreCheckpoint(const Checkpoint &C) {
+  // Drop whatever is being lexed, it belongs to the previous main file.
+  CachedBegin = CachedEnd = CachedLexPos = 0;
+  BacktrackPositions.clear();
+  IncludeMacroStack.clear();
+  CurLexer.reset();
+  CurTokenLexer.reset();
+  CurLexerKind = CLK_Lexer;
+  CurDirLookup = nullptr;
+
+  RestoreMacroSnapshot(C.Macros);
+  PragmaPushMacroInfo = C.PragmaPushMacroInfo;
+  IncludedFiles = C.IncludedFiles;
+  OnceOnlyFiles = C.OnceOnlyFiles;
+  ControllingMacros = C.ControllingMacros;
+  SourceMgr.RestoreCheckpoint(C.SourceMgrCheckpoint);
+  CounterValue = C.CounterValue;
+
+  // The next file is a new stream.
+  if (Fingerprint)
+    EnableStreamFingerprint();
+}
+
+/*=============== Include Guards ====================================*/
+
+bool
+Preprocessor::ShouldEnterIncludeFile(const FileEntry *File) const {
+  if (OnceOnlyFiles.count(File))
+    return false;
+
+  auto It = ControllingMacros.find(File);
+  if (It != ControllingMacros.end() && IsMacroDefined(It->second))
+    return false;
+
+  return true;
+}
+
+void
+Preprocessor::EnterSourceFile(FileID FID, const DirectoryLookup *Dir) {
+  // Save the lexer of the includer, if any.
+  if (CurLexer || CurTokenLexer)
+    PushIncludeMacroStack();
+
+  CurLexer.reset(new Lexer(FID, *this));
+  CurLexerKind = CLK_Lexer;
+  CurDirLookup = Dir;
+  UseCachedTokens(*CurLexer);
+
+  if (Callbacks) {
+    Callbacks->FileChanged(SourceMgr.GetComposedLoc(FID, 0),
+                           PPCallbacks::EnterFile);
+  }
+
+  // Have the headers it includes read while we lex up to them.
+  if (HS)
+    PrefetchIncludes(FID);
+}
+
+/*=============== Macro Definitions ================================*/
 
-    // Consume tokens until we find a '>'
-    while (Result.GetKind() == Greater) {
-      AdvanceToken(Result);
+MacroInfo *
+Preprocessor::AllocateMacroInfo(SourceLocation Location) {
+  return new (MacroAllocator.Allocate<MacroInfo>()) MacroInfo(Location);
+}
+
+MacroDirective *
+Preprocessor::AllocateMacroDirective(MacroDirective::Kind Kind,
+                                     SourceLocation Location, MacroInfo *MI) {
+  return new (MacroAllocator.Allocate<MacroDirective>())
+      MacroDirective(Kind, Location, MI);
+}
+
+void
+Preprocessor::AppendMacroDirective(IdentifierInfo *II, MacroDirective *MD) {
+  MD->SetPrevious(Macros.Lookup(II));
+  Macros.Set(II, MD);
+
+  II->SetHasMacroDefinition(MD->IsDefined());
+}
+
+void
+Preprocessor::LexMacroBody(MacroInfo &MI) {
+  if (MI.IsBodyLexed())
+    return;
+
+  MI.bIsBodyLexed = true;
+  if (MI.GetBodyLength() == 0)
+    return;
+
+  ++NumMacroBodiesLexed;
+  NumLexedBodyBytes += MI.GetBodyLength();
+
+  SourceLocation BodyLoc = MI.GetBodyLocation();
+  const char *BodyStart = SourceMgr.GetCharacterData(BodyLoc);
+  const char *BufferEnd =
+      SourceMgr.GetContentCache(SourceMgr.GetFileID(BodyLoc)).GetBufferEnd();
+
+  // Lex the body with a raw lexer. It is in directive mode, so it stops with
+  // an Eod at the newline that ended the #define.
+  Lexer RawLexer(BodyLoc, LangOptions, BodyStart, BodyStart, BufferEnd);
+  RawLexer.ParsingPreprocessorDirective = true;
+
+  std::vector<Token> Tokens;
+  Token Tok;
+  while (true) {
+    RawLexer.AdvanceToken(Tok);
+    if (Tok.GetKind() == Eod || Tok.GetKind() == Eof)
+      break;
+
+    if (Tok.GetKind() == Identifier) {
+      LookUpIdentifierInfo(Tok,
+                           RawLexer.GetBufferLocation() - Tok.GetLength());
     }
 
-    Result.ResetToken();
-    Result.SetKind(HeaderName);
-  } else if (Result.GetKind() == StringLiteral) {
-    std::string Str = 0;
-    if (Str.size() >= 2 && Str.front() == '"' && Str.back() == '"') {
-      Result.SetKind(HeaderName);
+    // Literals point at their text in the buffer of the defining file, which
+    // may be dropped while the macro is still expanded. Keep a copy.
+    if (Tok.IsLiteral()) {
+      char *Spelling = MacroAllocator.Allocate<char>(Tok.GetLength() + 1);
+      std::memcpy(Spelling, Tok.GetLiteralData(), Tok.GetLength());
+      Spelling[Tok.GetLength()] = '\0';
+      Tok.SetLiteralData(Spelling);
+    }
+
+    Tokens.push_back(Tok);
+  }
+
+  MI.SetReplacementTokens(Tokens, MacroAllocator);
+  NumMacroBodyTokens += Tokens.size();
+}
+
+void
+Preprocessor::RestoreMacroSnapshot(const MacroTable &Snapshot) {
+  Macros.ForEachDifference(Snapshot, [&Snapshot](IdentifierInfo *II) {
+    MacroDirective *MD = Snapshot.Lookup(II);
+    II->SetHasMacroDefinition(MD && MD->IsDefined());
+  });
+
+  Macros = Snapshot;
+}
+
+bool
+Preprocessor::ReadMacroParameterList(std::vector<IdentifierInfo *> &Parameters,
+                                     bool &bIsVariadic) {
+  Token Tok;
+  LexUnexpanedToken(Tok);
+
+  // Empty parameter list, "#define X()"
+  if (Tok.GetKind() == RParen)
+    return true;
+
+  while (true) {
+    if (Tok.GetKind() == Ellipsis) {
+      // C99 variadic macro, "#define X(...)" or "#define X(a, ...)"
+      std::string VAArgs = "__VA_ARGS__";
+      Parameters.push_back(&Identifiers->GetOrCreate(VAArgs));
+      bIsVariadic = true;
+
+      LexUnexpanedToken(Tok);
+      if (Tok.GetKind() != RParen) {
+        // error: missing ')' after "..."
+        break;
+      }
+      return true;
+    }
+
+    IdentifierInfo *II = Tok.GetIdentifierInfo();
+    if (Tok.GetKind() != Identifier || !II) {
+      // error: invalid token in macro parameter list
+      break;
+    }
+
+    Parameters.push_back(II);
+
+    LexUnexpanedToken(Tok);
+    if (Tok.GetKind() == RParen)
+      return true;
+    if (Tok.GetKind() != Comma) {
+      // error: expected comma in macro parameter list
+      break;
     }
+
+    LexUnexpanedToken(Tok);
+  }
+
+  if (Tok.GetKind() != Eod)
+    DiscardUntilEndOfDirective();
+  return false;
+}
+
+bool
+Preprocessor::LexHeaderName(Token &Result) {
+  // Computed includes, #include MACRO, are not supported; the name is never
+  // expanded.
+  bool Backup = DisableMacroExpansion;
+  DisableMacroExpansion = true;
+  CurLexer->LexIncludeFilename(Result);
+  DisableMacroExpansion = Backup;
+
+  // <foo> is lexed as a header name, "foo" as a string literal.
+  if (Result.GetKind() == StringLiteral)
+    Result.SetKind(HeaderName);
+
+  if (Result.GetKind() != HeaderName) {
+    // error: expected "FILENAME" or <FILENAME>
+    if (Result.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return true;
   }
+
+  return false;
 }
 
 /* Determine the location to use as the end of the buffer for a lexer.
@@ -99,7 +559,8 @@ class PPExprResult {
   IdentifierInfo *II;
 
 public:
-  uint32_t Value;
+  /** #if arithmetic is done in the widest integer type. */
+  uint64_t Value;
 
   IdentifierInfo *GetIdentifierInfo() const { return II; }
   void SetIdentifierInfo(IdentifierInfo *II) { this->II = II; }
@@ -119,57 +580,120 @@ struct DefinedTracker {
   IdentifierInfo *TheMacro;
 };
 
-static bool
-EvaluateDefine(PPExprResult &Result, Token &PeekToken, DefinedTracker &DT,
-               Preprocessor &PP) {
-  // Lex Next
-  if (PeekToken.GetKind() == LParen) {
-    // Skip it
-    // Lex Next
-  }
+/**
+ * Parses the values of a preprocessor conditional. On entry PeekToken is the
+ * first token of the value, on success it is the token after it.
+ */
+class PPExprEvaluator {
+public:
+  static bool EvaluateDefine(PPExprResult &Result, Token &PeekToken,
+                             DefinedTracker &DT, Preprocessor &PP);
+  static bool EvaluateValue(PPExprResult &Result, Token &PeekToken,
+                            DefinedTracker &DT, Preprocessor &PP);
+};
+
+// PeekToken is the "defined" keyword, parse "defined X" or "defined(X)".
+bool
+PPExprEvaluator::EvaluateDefine(PPExprResult &Result, Token &PeekToken,
+                                DefinedTracker &DT, Preprocessor &PP) {
+  // The operand is never macro expanded.
+  PP.LexUnexpanedToken(PeekToken);
+
+  bool bHasParen = PeekToken.GetKind() == LParen;
+  if (bHasParen)
+    PP.LexUnexpanedToken(PeekToken);
 
   IdentifierInfo *II = PeekToken.GetIdentifierInfo();
+  if (!II) {
+    // error: macro name must be an identifier
+    return true;
+  }
+
+  Result.Value = PP.IsMacroDefined(II);
+  Result.SetIdentifierInfo(II);
+
+  if (bHasParen) {
+    PP.LexUnexpanedToken(PeekToken);
+    if (PeekToken.GetKind() != RParen) {
+      // error: expected ')' after the macro name
+      return true;
+    }
+  }
+
+  PP.AdvanceTokenUncached(PeekToken);
 
   DT.State = DefinedTracker::DefinedMacro;
   DT.TheMacro = II;
   return false;
 }
 
-static bool
-EvaluateValue(PPExprResult &Result, Token &PeekToken, DefinedTracker &DT,
-              Preprocessor &PP) {
+bool
+PPExprEvaluator::EvaluateValue(PPExprResult &Result, Token &PeekToken,
+                               DefinedTracker &DT, Preprocessor &PP) {
   DT.State = DefinedTracker::Unknown;
+  DT.TheMacro = nullptr;
+  Result.SetIdentifierInfo(nullptr);
 
   switch (PeekToken.GetKind()) {
   default:
     if (IdentifierInfo *II = PeekToken.GetIdentifierInfo()) {
-      if (II->GetName() == "defined") {
+      if (II->GetName() == "defined")
         return EvaluateDefine(Result, PeekToken, DT, PP);
-      }
+
+      // Identifiers left after macro expansion evaluate to 0.
+      Result.Value = 0;
+      Result.SetIdentifierInfo(II);
+      PP.AdvanceTokenUncached(PeekToken);
+      return false;
     }
     break;
   case Eod:
   case RParen:
     return true;
-  case NumericConstant:
+  case NumericConstant: {
+    std::string Buffer;
+    unsigned Length;
+    const char *Spelling = PP.GetSpelling(PeekToken, Buffer, Length);
+    NumericLiteralParser Literal(Spelling, Length, PP.GetLangOptions());
+    if (Literal.HadError())
+      return true;
+
+    if (Literal.IsFloatingLiteral()) {
+      // error: floating point literal in preprocessor expression
+      return true;
+    }
+
+    uint64_t Value;
+    if (Literal.GetIntegerValue(Value)) {
+      // warning: integer literal is too large to be represented
+    }
+
+    Result.Value = Value;
+    PP.AdvanceTokenUncached(PeekToken);
     return false;
+  }
   case LParen:
-    // Lex next
+    PP.AdvanceTokenUncached(PeekToken);
     if (EvaluateValue(Result, PeekToken, DT, PP))
       return true;
 
-    if (PeekToken.GetKind() == RParen) {
-
-    } else {
-      // Lex next
-      return false;
+    if (PeekToken.GetKind() != RParen) {
+      // error: expected ')' in preprocessor expression
+      return true;
     }
 
+    // "(defined(X))" is still defined(X), keep DT as is.
+    PP.AdvanceTokenUncached(PeekToken);
+    return false;
+
   case Exclaim:
-    // Lex Next
+    PP.AdvanceTokenUncached(PeekToken);
     if (EvaluateValue(Result, PeekToken, DT, PP))
       return true;
 
+    Result.Value = Result.Value == 0;
+    Result.SetIdentifierInfo(nullptr);
+
     if (DT.State == DefinedTracker::DefinedMacro) {
       DT.State = DefinedTracker::NotDefinedMacro;
     } else if (DT.State == DefinedTracker::NotDefinedMacro) {
@@ -179,23 +703,28 @@ EvaluateValue(PPExprResult &Result, Token &PeekToken, DefinedTracker &DT,
 
   case KW_true:
   case KW_false:
-    // Lex Next
+    Result.Value = PeekToken.GetKind() == KW_true;
+    PP.AdvanceTokenUncached(PeekToken);
     return false;
   }
-}
 
-static bool
-EvaluateDirectiveSubExpr(PPExprResult &Result, Token &PeekToken,
-                         Preprocessor &PP) {}
+  // error: token is not a valid preprocessor expression
+  return true;
+}
 
 bool
 Preprocessor::EvaluateDirectiveExpression(IdentifierInfo *&IfNDefMacro) {
   Token Tok;
-  AdvanceToken(Tok);
+  AdvanceTokenUncached(Tok);
 
   PPExprResult Result;
+  Result.Value = 0;
   DefinedTracker DT;
-  if (EvaluateValue(Result, Tok, DT, *this)) {
+  if (PPExprEvaluator::EvaluateValue(Result, Tok, DT, *this)) {
+    // error: invalid preprocessor expression, taken as false
+    if (Tok.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return false;
   }
 
   if (Tok.GetKind() == Eod) {
@@ -204,11 +733,62 @@ Preprocessor::EvaluateDirectiveExpression(IdentifierInfo *&IfNDefMacro) {
     if (DT.State == DefinedTracker::NotDefinedMacro) {
       IfNDefMacro = DT.TheMacro;
     }
+  } else {
+    // error: binary operators are not supported yet, taken as false
+    DiscardUntilEndOfDirective();
+    return false;
   }
+
+  return Result.Value != 0;
+}
+
+bool
+Preprocessor::HandleIdentifier(Token &Identifier) {
+  IdentifierInfo *II = Identifier.GetIdentifierInfo();
+  assert(II && "Identifier token without IdentifierInfo!");
+
+  if (DisableMacroExpansion)
+    return true;
+
+  MacroInfo *MI = GetMacroInfo(II);
+  if (!MI)
+    return true;
+
+  // The name of a macro in its own expansion is not replaced.
+  if (!MI->IsEnabled())
+    return true;
+
+  // Function-like macros need their arguments collected, which is not
+  // supported yet. Their name is returned as is.
+  if (MI->IsFunctionLike())
+    return true;
+
+  // The name was read from the file, even if it expands to nothing.
+  if (CurLexerKind == CLK_Lexer)
+    CurLexer->MIOpt.ReadToken();
+
+  // First expansion of this macro, materialize its body.
+  LexMacroBody(*MI);
+  EnterMacro(Identifier, MI);
+  return false;
 }
 
 void
-Preprocessor::HandleIdentifier(Token &Identifier) {}
+Preprocessor::EnterMacro(Token &Tok, MacroInfo *MI) {
+  PushIncludeMacroStack();
+  CurLexerKind = CLK_TokenLexer;
+  CurTokenLexer.reset(new TokenLexer(Tok, MI, *this));
+}
+
+bool
+Preprocessor::HandleEndOfTokenLexer(Token &Result) {
+  assert(CurTokenLexer && !IncludeMacroStack.empty() &&
+         "Ending a macro expansion that was never entered!");
+
+  // Destroys the TokenLexer calling us, which enables the macro again.
+  PopIncludeMacroStack();
+  return false;
+}
 
 /*=============== Directive Handling Methods =======================*/
 
@@ -220,6 +800,11 @@ Preprocessor::HandleDirective(Token &Result) {
   // converted into Eod token (which terminates the directive).
   CurLexer->ParsingPreprocessorDirective = true;
 
+  // Whether the directive can start the include guard of the file, the
+  // directive itself does not count.
+  const bool bReadAnyTokensBeforeDirective =
+      CurLexer->MIOpt.HasReadAnyTokens();
+
   // Save the '#' token
   Token HashToken = Result;
 
@@ -241,11 +826,15 @@ Preprocessor::HandleDirective(Token &Result) {
 
     // Conditional Inclusion
     case PP_If:
-      return HandleIfDirective(Result);
+      return HandleIfDirective(Result, bReadAnyTokensBeforeDirective);
     case PP_Ifdef:
-      return HandleIfdefDirective(Result, false);
+      return HandleIfdefDirective(Result, false,
+                                  bReadAnyTokensBeforeDirective);
     case PP_Ifndef:
-      return HandleIfdefDirective(Result, true);
+      return HandleIfdefDirective(Result, true,
+                                  bReadAnyTokensBeforeDirective);
+    case PP_Elif:
+      return HandleElifDirective(Result);
     case PP_Else:
       return HandleElseDirective(Result);
     case PP_Endif:
@@ -253,7 +842,7 @@ Preprocessor::HandleDirective(Token &Result) {
 
     // Source File Inclusion
     case PP_Include:
-      return HandleIncludeDirective(Result);
+      return HandleIncludeDirective(Result, nullptr);
 
     // Macro Replacement
     case PP_Define:
@@ -278,12 +867,35 @@ Preprocessor::HandleDirective(Token &Result) {
 
 bool
 Preprocessor::HandleEndOfFile(Token &Result) {
+  assert(CurLexer && "Got EOF but no current lexer set!");
+
+  PPConditionalInfo CondInfo;
+  while (!CurLexer->PopConditionalLevel(CondInfo)) {
+    // error: unterminated conditional directive at CondInfo.IfLocation
+  }
+
+  // Remember the include guard of the file, so that it is not entered again
+  // while the guard is defined.
+  if (const IdentifierInfo *ControllingMacro =
+          CurLexer->MIOpt.GetControllingMacroAtEndOfFile()) {
+    const FileContentCache &Content =
+        SourceMgr.GetContentCache(CurLexer->GetFileID());
+    if (const FileEntry *File = Content.GetFileEntry())
+      SetFileControllingMacro(File, ControllingMacro);
+  }
+
   // If this is a #include'd file, pop it and continue lexing the #include'r
-  // file
+  // file. This destroys the lexer calling us.
   if (!IncludeMacroStack.empty()) {
+    PopIncludeMacroStack();
+    if (Callbacks && CurLexer) {
+      Callbacks->FileChanged(
+          CurLexer->GetSourceLocation(CurLexer->GetBufferLocation()),
+          PPCallbacks::ExitFile);
+    }
+    return false;
   }
 
-  assert(CurLexer && "Got EOF but no current lexer set!");
   const char *EndPos = GetCurLexerEndPos();
   Result.ResetToken();
   CurLexer->BufferPtr = EndPos;
@@ -302,7 +914,7 @@ Preprocessor::HandleEndOfFile(Token &Result) {
 void
 Preprocessor::HandleLineDirective() {
   Token DigitToken;
-  AdvanceToken(DigitToken);
+  AdvanceTokenUncached(DigitToken);
 
   unsigned LineNo;
 }
@@ -331,9 +943,44 @@ Preprocessor::HandleIncludeDirective(Token &Result,
     return;
   }
 
-  if (FilenameToken.GetKind() != HeaderName) {
+  CheckEndOfDirective();
+
+  std::string Spelling = GetSpelling(FilenameToken);
+  const bool bIsAngled = Spelling.front() == '<';
+  std::string Filename = Spelling.substr(1, Spelling.size() - 2);
+  if (Filename.empty()) {
+    // error: empty filename
+    return;
+  }
+
+  const DirectoryLookup *CurDir;
+  const FileEntry *File = LookupFile(Filename, bIsAngled, LookupFrom, CurDir);
+  if (!File) {
+    // error: 'Filename' file not found
+    return;
+  }
+
+  CurLexer->AddInclude(Filename, *File, FilenameToken.GetLocation());
+
+  // Skip files with #pragma once, and files whose include guard is defined,
+  // without reading them.
+  if (!ShouldEnterIncludeFile(File))
+    return;
+
+  // LookupFile only finds files through HS.
+  FileContentCache *Content =
+      SourceMgr.CreateContentCache(File, HS->GetFileMgr());
+  if (!Content) {
+    // error: could not read 'Filename'
     return;
   }
+
+  if (std::find(IncludedFiles.begin(), IncludedFiles.end(), File) ==
+      IncludedFiles.end())
+    IncludedFiles.push_back(File);
+
+  FileID FID = SourceMgr.CreateFileID(*Content, FilenameToken.GetLocation());
+  EnterSourceFile(FID, CurDir);
 }
 
 void
@@ -342,23 +989,88 @@ Preprocessor::HandleErrorDirective(Token &Result) {}
 /*================= Preprocessor Conditional Directives ================*/
 // Implements the #ifdef / #ifndef directive
 void
-Preprocessor::HandleIfdefDirective(Token &IfdefToken, bool bIsIfndef) {}
+Preprocessor::HandleIfdefDirective(Token &IfdefToken, bool bIsIfndef,
+                                   bool bReadAnyTokensBeforeDirective) {
+  Token MacroNameToken;
+  LexUnexpanedToken(MacroNameToken);
+
+  IdentifierInfo *II = MacroNameToken.GetIdentifierInfo();
+  if (MacroNameToken.GetKind() != Identifier || !II) {
+    // error: macro name must be an identifier
+    if (MacroNameToken.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return;
+  }
+
+  CheckEndOfDirective();
+
+  // An #ifndef that starts the file may be its include guard.
+  if (CurLexer->GetConditionalStackDepth() == 0) {
+    if (bIsIfndef && !bReadAnyTokensBeforeDirective)
+      CurLexer->MIOpt.EnterTopLevelIfndef(II);
+    else
+      CurLexer->MIOpt.EnterTopLevelConditional();
+  }
+
+  // Constant time, the macro bit lives in the IdentifierInfo.
+  const bool bIsDefined = IsMacroDefined(II);
+  const bool bSkipBlock = bIsIfndef ? bIsDefined : !bIsDefined;
+
+  if (bSkipBlock) {
+    SkipExcludedConditionalBlock(IfdefToken.GetLocation(),
+                                 /*bFoundNonSkip=*/false,
+                                 /*bFoundElse=*/false);
+  } else {
+    CurLexer->PushConditionalLevel(IfdefToken.GetLocation(),
+                                   /*bWasSkipping=*/false,
+                                   /*bFoundNonSkip=*/true,
+                                   /*bFoundElse=*/false);
+  }
+}
 
 // Implements the #if directive.
 void
-Preprocessor::HandleIfDirective(Token &IfToken) {
+Preprocessor::HandleIfDirective(Token &IfToken,
+                                bool bReadAnyTokensBeforeDirective) {
   IdentifierInfo *IfNDefMacro = nullptr;
   const bool EvalResult = EvaluateDirectiveExpression(IfNDefMacro);
 
   if (!CurLexer)
     return;
+
+  // "#if !defined(X)" that starts the file may be its include guard.
+  if (CurLexer->GetConditionalStackDepth() == 0) {
+    if (IfNDefMacro && !bReadAnyTokensBeforeDirective)
+      CurLexer->MIOpt.EnterTopLevelIfndef(IfNDefMacro);
+    else
+      CurLexer->MIOpt.EnterTopLevelConditional();
+  }
+
+  if (EvalResult) {
+    CurLexer->PushConditionalLevel(IfToken.GetLocation(),
+                                   /*bWasSkipping=*/false,
+                                   /*bFoundNonSkip=*/true,
+                                   /*bFoundElse=*/false);
+  } else {
+    SkipExcludedConditionalBlock(IfToken.GetLocation(),
+                                 /*bFoundNonSkip=*/false,
+                                 /*bFoundElse=*/false);
+  }
 }
 
 // Implement the #endif directive.
 void
 Preprocessor::HandleEndifDirective(Token &EndifToken) {
+  CheckEndOfDirective();
+
   PPConditionalInfo CondInfo;
-  CurLexer->PopConditionalLevel(CondInfo);
+  if (CurLexer->PopConditionalLevel(CondInfo)) {
+    // error: #endif without #if
+    return;
+  }
+
+  if (CurLexer->GetConditionalStackDepth() == 0)
+    CurLexer->MIOpt.ExitTopLevelConditional();
 
   // Info MI optimizer
 }
@@ -366,12 +1078,391 @@ Preprocessor::HandleEndifDirective(Token &EndifToken) {
 // Implements the #else directive.
 void
 Preprocessor::HandleElseDirective(Token &ElseToken) {
+  CheckEndOfDirective();
+
   PPConditionalInfo CondInfo;
-  CurLexer->PopConditionalLevel(CondInfo);
+  if (CurLexer->PopConditionalLevel(CondInfo)) {
+    // error: #else without #if
+    return;
+  }
+
+  // An include guard has no #else.
+  if (CurLexer->GetConditionalStackDepth() == 0)
+    CurLexer->MIOpt.EnterTopLevelConditional();
 
   // If this is an else with else before it error
   if (CondInfo.FoundElse) {
-    // error
+    // error: #else after #else
+  }
+
+  // The block before the #else was entered, skip the rest of the conditional.
+  SkipExcludedConditionalBlock(CondInfo.IfLocation, /*bFoundNonSkip=*/true,
+                               /*bFoundElse=*/true);
+}
+
+// Implements the #elif directive.
+void
+Preprocessor::HandleElifDirective(Token &ElifToken) {
+  // The block before the #elif was entered, the condition is not evaluated.
+  DiscardUntilEndOfDirective();
+
+  PPConditionalInfo CondInfo;
+  if (CurLexer->PopConditionalLevel(CondInfo)) {
+    // error: #elif without #if
+    return;
+  }
+
+  // An include guard has no #elif.
+  if (CurLexer->GetConditionalStackDepth() == 0)
+    CurLexer->MIOpt.EnterTopLevelConditional();
+
+  if (CondInfo.FoundElse) {
+    // error: #elif after #else
+  }
+
+  SkipExcludedConditionalBlock(CondInfo.IfLocation, /*bFoundNonSkip=*/true,
+                               CondInfo.FoundElse);
+}
+
+/*
+ * Skip the lines of a conditional block that is not entered, up to the
+ * #else, #elif or #endif that ends it. Nested conditionals are skipped whole.
+ *
+ * The lexer runs in raw mode meanwhile: nothing is macro expanded, and only
+ * the names of directives are looked up.
+ */
+void
+Preprocessor::SkipExcludedConditionalBlock(SourceLocation IfLocation,
+                                           bool bFoundNonSkip,
+                                           bool bFoundElse) {
+  CurLexer->PushConditionalLevel(IfLocation, /*bWasSkipping=*/false,
+                                 bFoundNonSkip, bFoundElse);
+
+  CurLexer->LexingRawMode = true;
+  Token Tok;
+  while (true) {
+    CurLexer->AdvanceToken(Tok);
+
+    // The open conditionals are diagnosed by HandleEndOfFile.
+    if (Tok.GetKind() == Eof)
+      break;
+
+    if (Tok.GetKind() != Hash || !Tok.HasFlag(Token::StartOfLine))
+      continue;
+
+    // A # at the start of a line, read the directive name.
+    CurLexer->ParsingPreprocessorDirective = true;
+    CurLexer->AdvanceToken(Tok);
+    if (Tok.GetKind() == Eod)
+      continue;
+
+    if (Tok.GetKind() != Identifier) {
+      DiscardUntilEndOfDirective();
+      continue;
+    }
+
+    IdentifierInfo *II = LookUpIdentifierInfo(
+        Tok, CurLexer->GetBufferLocation() - Tok.GetLength());
+
+    switch (II->GetPPKeyword()) {
+    default:
+      // Any other directive in a skipped block is ignored.
+      DiscardUntilEndOfDirective();
+      continue;
+
+    case PP_If:
+    case PP_Ifdef:
+    case PP_Ifndef:
+      // Nested conditional, none of its branches can be entered.
+      DiscardUntilEndOfDirective();
+      CurLexer->PushConditionalLevel(Tok.GetLocation(), /*bWasSkipping=*/true,
+                                     /*bFoundNonSkip=*/true,
+                                     /*bFoundElse=*/false);
+      continue;
+
+    case PP_Endif: {
+      DiscardUntilEndOfDirective();
+
+      PPConditionalInfo CondInfo;
+      bool bEmpty = CurLexer->PopConditionalLevel(CondInfo);
+      assert(!bEmpty && "Skipped block without conditional level!");
+      (void)bEmpty;
+
+      // The #endif of the block we started skipping, lex normally again.
+      if (!CondInfo.WasSkipping) {
+        if (CurLexer->GetConditionalStackDepth() == 0)
+          CurLexer->MIOpt.ExitTopLevelConditional();
+        break;
+      }
+      continue;
+    }
+
+    case PP_Else: {
+      DiscardUntilEndOfDirective();
+
+      if (CurLexer->GetConditionalStackDepth() == 1)
+        CurLexer->MIOpt.EnterTopLevelConditional();
+
+      PPConditionalInfo &CondInfo = CurLexer->PeekConditionalLevel();
+      if (CondInfo.FoundElse) {
+        // error: #else after #else
+      }
+      CondInfo.FoundElse = true;
+
+      // Enter the #else if no branch of our conditional was entered.
+      if (CondInfo.WasSkipping || CondInfo.FoundNonSkip)
+        continue;
+      CondInfo.FoundNonSkip = true;
+      break;
+    }
+
+    case PP_Elif: {
+      if (CurLexer->GetConditionalStackDepth() == 1)
+        CurLexer->MIOpt.EnterTopLevelConditional();
+
+      PPConditionalInfo &CondInfo = CurLexer->PeekConditionalLevel();
+      if (CondInfo.FoundElse) {
+        // error: #elif after #else
+      }
+
+      if (CondInfo.WasSkipping || CondInfo.FoundNonSkip) {
+        DiscardUntilEndOfDirective();
+        continue;
+      }
+
+      // The condition may use macros, evaluate it out of raw mode.
+      CurLexer->LexingRawMode = false;
+      IdentifierInfo *IfNDefMacro = nullptr;
+      bool bEnter = EvaluateDirectiveExpression(IfNDefMacro);
+      CurLexer->LexingRawMode = true;
+
+      if (!bEnter)
+        continue;
+      CondInfo.FoundNonSkip = true;
+      break;
+    }
+    }
+
+    // A branch is entered.
+    break;
+  }
+
+  CurLexer->LexingRawMode = false;
+}
+
+/*================= Macro Replacement Directives ======================*/
+
+/*
+ * Implements the #define directive.
+ *
+ * Only the macro name and its parameter list are lexed here. The replacement
+ * list is recorded as a source range and lexed the first time the macro is
+ * expanded (see LexMacroBody). Most macros of system headers are never
+ * expanded in a given translation unit.
+ */
+void
+Preprocessor::HandleDefineDirective() {
+  ++NumDefined;
+
+  Token MacroNameToken;
+  LexUnexpanedToken(MacroNameToken);
+
+  IdentifierInfo *II = MacroNameToken.GetIdentifierInfo();
+  if (MacroNameToken.GetKind() != Identifier || !II) {
+    // error: macro name must be an identifier
+    if (MacroNameToken.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return;
+  }
+
+  // A ( immediately following the macro name, without any whitespace in
+  // between, starts the parameter list of a function-like macro.
+  bool bIsFunctionLike = false;
+  bool bIsVariadic = false;
+  std::vector<IdentifierInfo *> Parameters;
+  if (*CurLexer->GetBufferLocation() == '(') {
+    Token LParenToken;
+    LexUnexpanedToken(LParenToken);
+
+    bIsFunctionLike = true;
+    if (!ReadMacroParameterList(Parameters, bIsVariadic))
+      return;
+  }
+
+  // The definition is well formed, only now does it get a MacroInfo.
+  MacroInfo *MI = AllocateMacroInfo(MacroNameToken.GetLocation());
+  if (bIsFunctionLike) {
+    MI->SetIsFunctionLike();
+    if (bIsVariadic)
+      MI->SetIsC99Varargs();
+    MI->SetParameterList(Parameters, MacroAllocator);
+  }
+
+  // Record where the replacement list is, without lexing it.
+  SourceLocation BodyLoc;
+  unsigned BodyLength;
+  CurLexer->SkipMacroBody(BodyLoc, BodyLength);
+  MI->SetBodyRange(BodyLoc, BodyLength);
+  NumDeferredBodyBytes += BodyLength;
+
+  Token EodToken;
+  LexUnexpanedToken(EodToken);
+  MI->SetDefinitionEndLoc(EodToken.GetLocation());
+
+  // Redefinitions are only valid if they are identical (C99 6.10.3p2).
+  MacroInfo *OtherMI = GetMacroInfo(II);
+  if (OtherMI && !OtherMI->IsIdenticalTo(*MI, *this)) {
+    // warning: macro redefined
+  }
+
+  AppendMacroDirective(II, AllocateMacroDirective(MacroDirective::MD_Define,
+                                                  MacroNameToken.GetLocation(),
+                                                  MI));
+}
+
+/*
+ * Implements the #undef directive. The definition is kept in the history of
+ * the identifier, only the HasMacroDefinition bit is cleared.
+ */
+void
+Preprocessor::HandleUndefDirective() {
+  ++NumUndefined;
+
+  Token MacroNameToken;
+  LexUnexpanedToken(MacroNameToken);
+
+  IdentifierInfo *II = MacroNameToken.GetIdentifierInfo();
+  if (MacroNameToken.GetKind() != Identifier || !II) {
+    // error: macro name must be an identifier
+    if (MacroNameToken.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return;
+  }
+
+  CheckEndOfDirective();
+
+  // #undef of something that is not a macro is a no-op.
+  if (!IsMacroDefined(II))
+    return;
+
+  AppendMacroDirective(II, AllocateMacroDirective(MacroDirective::MD_Undefine,
+                                                  MacroNameToken.GetLocation(),
+                                                  nullptr));
+}
+
+/*================= Pragma Directives ==================================*/
+
+void
+Preprocessor::HandlePragmaDirective(PragmaKind Kind) {
+  Token PragmaNameToken;
+  LexUnexpanedToken(PragmaNameToken);
+
+  IdentifierInfo *II = PragmaNameToken.GetIdentifierInfo();
+  if (PragmaNameToken.GetKind() == Identifier && II) {
+    std::string Name = II->GetName();
+    if (Name == "once")
+      return HandlePragmaOnce(PragmaNameToken);
+    if (Name == "push_macro")
+      return HandlePragmaPushMacro(PragmaNameToken);
+    if (Name == "pop_macro")
+      return HandlePragmaPopMacro(PragmaNameToken);
+  }
+
+  // Unknown pragmas are ignored.
+  if (PragmaNameToken.GetKind() != Eod)
+    DiscardUntilEndOfDirective();
+}
+
+IdentifierInfo *
+Preprocessor::ParsePragmaPushOrPopMacro() {
+  Token Tok;
+  LexUnexpanedToken(Tok);
+  if (Tok.GetKind() != LParen) {
+    // error: expected ( in pragma
+    if (Tok.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return nullptr;
+  }
+
+  LexUnexpanedToken(Tok);
+  if (Tok.GetKind() != StringLiteral) {
+    // error: expected string literal in pragma
+    if (Tok.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return nullptr;
+  }
+
+  // Only a plain "name" is accepted. Encoding prefixes lex into other kinds
+  // already, a raw string R"(name)" does not.
+  std::string Spelling = GetSpelling(Tok);
+  if (Spelling.size() < 2 || Spelling.front() != '"' ||
+      Spelling.back() != '"') {
+    // error: expected string literal without prefix in pragma
+    DiscardUntilEndOfDirective();
+    return nullptr;
+  }
+
+  LexUnexpanedToken(Tok);
+  if (Tok.GetKind() != RParen) {
+    // error: expected ) in pragma
+    if (Tok.GetKind() != Eod)
+      DiscardUntilEndOfDirective();
+    return nullptr;
+  }
+
+  CheckEndOfDirective();
+
+  // Strip the quotes of "name".
+  std::string MacroName = Spelling.substr(1, Spelling.size() - 2);
+  return &Identifiers->GetOrCreate(MacroName);
+}
+
+// Implements #pragma once
+void
+Preprocessor::HandlePragmaOnce(Token &OnceToken) {
+  CheckEndOfDirective();
+
+  const FileContentCache &Content =
+      SourceMgr.GetContentCache(CurLexer->GetFileID());
+  if (const FileEntry *File = Content.GetFileEntry())
+    MarkFileIncludeOnce(File);
+}
+
+// Implements #pragma push_macro("name")
+void
+Preprocessor::HandlePragmaPushMacro(Token &PushMacroToken) {
+  IdentifierInfo *II = ParsePragmaPushOrPopMacro();
+  if (!II)
+    return;
+
+  // Save the current definition, null if II is not a macro.
+  PragmaPushMacroInfo[II].push_back(GetMacroInfo(II));
+}
+
+// Implements #pragma pop_macro("name")
+void
+Preprocessor::HandlePragmaPopMacro(Token &PopMacroToken) {
+  IdentifierInfo *II = ParsePragmaPushOrPopMacro();
+  if (!II)
+    return;
+
+  auto It = PragmaPushMacroInfo.find(II);
+  if (It == PragmaPushMacroInfo.end() || It->second.empty()) {
+    // warning: pop_macro without matching push_macro
+    return;
+  }
 
+  MacroInfo *MI = It->second.back();
+  It->second.pop_back();
+
+  // Reinstate the saved definition as a new directive, so the history of II
+  // stays in order.
+  SourceLocation Loc = PopMacroToken.GetLocation();
+  if (MI) {
+    AppendMacroDirective(
+        II, AllocateMacroDirective(MacroDirective::MD_Define, Loc, MI));
+  } else if (IsMacroDefined(II)) {
+    AppendMacroDirective(
+        II, AllocateMacroDirective(MacroDirective::MD_Undefine, Loc, nullptr));
   }
 }
@@ -1,19 +1,26 @@
 #ifndef PREPROCESSOR_H
 #define PREPROCESSOR_H
 
+#include "ContentHash.h"
 #include "Header.h"
+#include "IdentifierTable.h"
 #include "Lexer.h"
+#include "MacroTable.h"
+#include "PPCallbacks.h"
 #include "PPRecord.h"
 #include "Pragma.h"
 #include "Token.h"
 #include "TokenLexer.h"
 
 #include <memory>
-#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class FileEntry;
 class IdentifierInfoTable;
+class StreamFingerprint;
+class TokenCache;
 
 /* ========================================================
  *  Preprocessor
@@ -21,25 +28,47 @@ class IdentifierInfoTable;
  */
 
 class Preprocessor {
+  friend class PCHReader;
+  friend class PPExprEvaluator;
+
   LanguageOptions &LangOptions;
 
-  HeaderSearch *HS;
+  SourceManager &SourceMgr;
+
+  /** Finds the files of #include, null if includes are not supported. */
+  HeaderSearch *HS = nullptr;
+
+  /** Raw tokens of the files entered, or null to lex them. */
+  TokenCache *TokCache = nullptr;
+
+  /** Told about file changes, may be null. */
+  PPCallbacks *Callbacks = nullptr;
 
   /** Value of __COUNTER__. */
   unsigned CounterValue = 0;
 
   /** True if macro expansion is disabled. */
-  bool DisableMacroExpansion : 1;
+  bool DisableMacroExpansion = false;
 
   /**
    * Keeps information of all identifiers in the program, including language
    * keywords.
    */
-  IdentifierInfoTable *Identifiers;
+  IdentifierInfoTable *Identifiers = nullptr;
 
   /** The files that have been included. */
   std::vector<const FileEntry *> IncludedFiles;
 
+  /** Files that contained #pragma once. */
+  std::unordered_set<const FileEntry *> OnceOnlyFiles;
+
+  /**
+   * Macro guarding the entire contents of a file, "#ifndef X #define X ...
+   * #endif". The file does not need to be entered again while X is defined.
+   */
+  std::unordered_map<const FileEntry *, const IdentifierInfo *>
+      ControllingMacros;
+
   std::unique_ptr<Lexer> CurLexer;
   std::unique_ptr<TokenLexer> CurTokenLexer;
 
@@ -49,48 +78,312 @@ class Preprocessor {
     CLK_TokenLexer,
   } CurLexerKind = CLK_Lexer;
 
-  /** Linked-list of Macro Infos. */
-  struct MacroInfoList {
-    MacroInfo MInfo;
-    MacroInfoList *Next;
-  };
+  /** Holds MacroInfos, MacroDirectives and their parameter lists. */
+  BumpAllocator MacroAllocator;
+
+  /**
+   * Most recent #define or #undef of each identifier that ever had a macro
+   * definition. Older directives are reachable through the chain. Only looked
+   * up if the identifier has its HasMacroDefinition bit set, or to walk the
+   * history.
+   *
+   * The table is persistent, see TakeMacroSnapshot.
+   */
+  MacroTable Macros;
 
-  MacroInfoList *MacroInfoListHead;
+  /** Definitions saved by #pragma push_macro, null if it was not defined. */
+  std::unordered_map<const IdentifierInfo *, std::vector<MacroInfo *>>
+      PragmaPushMacroInfo;
+
+  /** The directory the current file was found in, see LookupFile. */
+  const DirectoryLookup *CurDirLookup = nullptr;
 
   struct IncludeStackInfo {
     enum CurLexerKind CurLexerKind;
     std::unique_ptr<Lexer> TheLexer;
+    std::unique_ptr<TokenLexer> TheTokenLexer;
     const DirectoryLookup *TheDirLookup;
   };
 
+  /** Lexers of the files and macros we are in, but not lexing from. */
   std::vector<IncludeStackInfo> IncludeMacroStack;
 
+  /** Save the current lexer, before entering a file or a macro. */
+  void PushIncludeMacroStack() {
+    IncludeMacroStack.push_back({CurLexerKind, std::move(CurLexer),
+                                 std::move(CurTokenLexer), CurDirLookup});
+  }
+
+  /** Return to the lexer saved by the last PushIncludeMacroStack. */
+  void PopIncludeMacroStack() {
+    IncludeStackInfo &Info = IncludeMacroStack.back();
+    CurLexerKind = Info.CurLexerKind;
+    CurLexer = std::move(Info.TheLexer);
+    CurTokenLexer = std::move(Info.TheTokenLexer);
+    CurDirLookup = Info.TheDirLookup;
+    IncludeMacroStack.pop_back();
+  }
+
+  /*=============== Token Cache =======================================*/
+  /**
+   * Ring buffer of tokens lexed ahead of the consumer, or kept for a
+   * possible Backtrack. The capacity is a power of two. Positions are
+   * absolute token numbers, the token at position P lives at
+   * CachedTokens[P & (CachedTokens.size() - 1)].
+   *
+   * CachedBegin <= BacktrackPositions <= CachedLexPos <= CachedEnd
+   */
+  std::vector<Token> CachedTokens;
+  uint64_t CachedBegin = 0;
+  uint64_t CachedEnd = 0;
+
+  /** Position of the next token returned by AdvanceToken. */
+  uint64_t CachedLexPos = 0;
+
+  /** Positions saved by EnableBacktrackAtThisPos, innermost last. */
+  std::vector<uint64_t> BacktrackPositions;
+
+  /*=============== Stream Fingerprint ================================*/
+  /** Hash of the tokens returned by AdvanceToken, if enabled. */
+  std::unique_ptr<StreamFingerprint> Fingerprint;
+
+  /**
+   * Position in the stream of the next token returned by AdvanceToken, and
+   * the number of tokens hashed. Tokens replayed after a Backtrack are behind
+   * the hashed ones and are not hashed again.
+   */
+  uint64_t StreamPos = 0;
+  uint64_t NumFingerprintedTokens = 0;
+
+  /** Reused by AddToFingerprint for tokens that need cleaning. */
+  std::string FingerprintSpelling;
+
+  /** File of the last hashed token, valid if bFingerprintHasFile. */
+  FileID FingerprintFID = 0;
+  bool bFingerprintHasFile = false;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumDefined = 0;
+  unsigned NumUndefined = 0;
+
+  /** Number of macro bodies lexed on demand and the tokens they produced. */
+  unsigned NumMacroBodiesLexed = 0;
+  unsigned NumMacroBodyTokens = 0;
+
+  /** Bytes of replacement lists recorded at #define, and how many of those
+   * were lexed later on. */
+  uint64_t NumDeferredBodyBytes = 0;
+  uint64_t NumLexedBodyBytes = 0;
+
 public:
-  Preprocessor(LanguageOptions &Options);
+  Preprocessor(LanguageOptions &Options, SourceManager &SM);
   ~Preprocessor();
 
+  /** Add the keywords to the identifier table, which must be set. */
   void Init();
 
-  bool EnterSourceFile(FileID FID);
-  void EnterMacro(MacroInfo *MI);
+  /** The identifier table must be set before Init and before lexing. */
+  void SetIdentifierTable(IdentifierInfoTable *Table) { Identifiers = Table; }
 
-private:
-  /** Lex the next token for this preprocessor. */
+  /** Without a HeaderSearch, every #include fails to find its file. */
+  void SetHeaderSearch(HeaderSearch *Search) { HS = Search; }
+  HeaderSearch *GetHeaderSearch() const { return HS; }
+
+  /**
+   * Callbacks must be set before the file they should hear about is entered.
+   * Null removes them.
+   */
+  void SetPPCallbacks(PPCallbacks *InCallbacks) { Callbacks = InCallbacks; }
+  PPCallbacks *GetPPCallbacks() const { return Callbacks; }
+
+  SourceManager &GetSourceManager() const { return SourceMgr; }
+  const LanguageOptions &GetLangOptions() const { return LangOptions; }
+
+  /**
+   * Returns the spelling of Tok and sets Length to its length, without
+   * allocating. Identifiers are spelled by their IdentifierInfo and other
+   * clean tokens point into their buffer. Only tokens with escaped newlines
+   * or trigraphs are cleaned into Buffer, see Lexer::GetSpelling.
+   */
+  const char *GetSpelling(const Token &Tok, std::string &Buffer,
+                          unsigned &Length) const;
+
+  /** Print statistics about the work done so far to stderr. */
+  void PrintStats() const;
+
+  unsigned GetNumDefined() const { return NumDefined; }
+  unsigned GetNumMacroBodiesLexed() const { return NumMacroBodiesLexed; }
+  unsigned GetNumMacroBodyTokens() const { return NumMacroBodyTokens; }
+  uint64_t GetNumDeferredBodyBytes() const { return NumDeferredBodyBytes; }
+  uint64_t GetNumLexedBodyBytes() const { return NumLexedBodyBytes; }
+
+  /*=============== Checkpoints =======================================*/
+  /**
+   * State of the preprocessor between two top-level files.
+   *
+   * Translation units that start with the same sequence of #includes can
+   * preprocess that prefix once, take a checkpoint, and restore it before
+   * entering each main file. The resulting token stream is identical to
+   * preprocessing the prefix again. Alternatively the process can be forked
+   * right after the prefix; all of this state lives in memory.
+   */
+  struct Checkpoint {
+    MacroTable Macros;
+    std::unordered_map<const IdentifierInfo *, std::vector<MacroInfo *>>
+        PragmaPushMacroInfo;
+
+    std::vector<const FileEntry *> IncludedFiles;
+    std::unordered_set<const FileEntry *> OnceOnlyFiles;
+    std::unordered_map<const FileEntry *, const IdentifierInfo *>
+        ControllingMacros;
+
+    SourceManager::Checkpoint SourceMgrCheckpoint;
+
+    unsigned CounterValue;
+  };
+
+  /**
+   * Capture the current state. Must be called between files, when nothing is
+   * being lexed. The macro table is shared, not copied.
+   */
+  Checkpoint TakeCheckpoint() const;
+
+  /**
+   * Return to the state captured by C. Everything entered since then,
+   * including SourceManager entries, is dropped.
+   */
+  void RestoreCheckpoint(const Checkpoint &C);
+
+  /*=============== Include Guards ====================================*/
+  void MarkFileIncludeOnce(const FileEntry *File) {
+    OnceOnlyFiles.insert(File);
+  }
+
+  void SetFileControllingMacro(const FileEntry *File,
+                               const IdentifierInfo *ControllingMacro) {
+    ControllingMacros[File] = ControllingMacro;
+  }
+
+  /**
+   * Return false if File has #pragma once and was entered before, or if its
+   * controlling macro is defined.
+   */
+  bool ShouldEnterIncludeFile(const FileEntry *File) const;
+
+  /**
+   * Continue lexing at the start of FID, returning to the current lexer at
+   * its end. Dir is the search directory it was found in, see LookupFile.
+   */
+  void EnterSourceFile(FileID FID, const DirectoryLookup *Dir = nullptr);
+
+  /**
+   * Start returning the replacement tokens of MI, whose name is Tok. The body
+   * of MI must be lexed.
+   */
+  void EnterMacro(Token &Tok, MacroInfo *MI);
+
+  /*=============== Token Stream ======================================*/
+  /**
+   * Lex the next token for this preprocessor. Tokens that were looked ahead
+   * or backtracked over are returned from the cache without being lexed or
+   * macro expanded again.
+   */
   void AdvanceToken(Token &Result);
 
-  /** Same as advance token by prevent macro expansion for identifiers. */
+  /**
+   * Peek the token N positions ahead without consuming it, LookAhead(0) is
+   * the token the next AdvanceToken returns.
+   */
+  const Token &LookAhead(unsigned N);
+
+  /**
+   * Remember the current position. Every EnableBacktrackAtThisPos must be
+   * paired with either Backtrack or CommitBacktrackedTokens; they nest.
+   */
+  void EnableBacktrackAtThisPos() {
+    BacktrackPositions.push_back(CachedLexPos);
+  }
+
+  /** Forget the innermost saved position, keeping the consumed tokens. */
+  void CommitBacktrackedTokens();
+
+  /** Return to the innermost saved position; tokens are replayed. */
+  void Backtrack();
+
+  bool IsBacktrackEnabled() const { return !BacktrackPositions.empty(); }
+
+  /*=============== Stream Fingerprint ================================*/
+  /**
+   * Hash every token returned by AdvanceToken from now on, see
+   * StreamFingerprint. Lets a compile cache tell whether the output changed
+   * without running -E.
+   */
+  void EnableStreamFingerprint();
+
+  /** Fingerprint of the tokens returned since EnableStreamFingerprint. */
+  ContentHash GetStreamFingerprint() const;
+
+  struct Dependency {
+    std::string Path;
+    ContentHash Hash;
+  };
+
+  /**
+   * The files entered so far with the hash of their contents, each once in
+   * the order they were first entered. A compile cache in direct mode can
+   * check these instead of preprocessing. Files entered from a PCH are not
+   * listed, nor is the PCH file; whoever loads the PCH has to add it.
+   */
+  std::vector<Dependency> GetDependencies() const;
+
+private:
+  /** Hash Tok into the stream fingerprint. */
+  void AddToFingerprint(const Token &Tok);
+
+  /** Lex the next token from the lexer stack, bypassing the token cache. */
+  void AdvanceTokenUncached(Token &Result);
+
+  /** Append Tok to the token cache, growing it if full. */
+  void PushCachedToken(const Token &Tok);
+
+  /** Drop the consumed tokens nobody can backtrack to anymore. */
+  void TrimTokenCache() {
+    if (BacktrackPositions.empty())
+      CachedBegin = CachedLexPos;
+  }
+
+  /**
+   * Same as advance token by prevent macro expansion for identifiers.
+   *
+   * Only used while handling directives, which always read from the lexer
+   * and never from the token cache.
+   */
   void LexUnexpanedToken(Token &Result) {
     bool Backup = DisableMacroExpansion;
-    DisableMacroExpansion = false;
+    DisableMacroExpansion = true;
 
-    AdvanceToken(Result);
+    AdvanceTokenUncached(Result);
 
     DisableMacroExpansion = Backup;
   }
 
-  /** Lex a token, forming a HeaderName token if possible. */
+  /**
+   * Lex the file name of an #include into a HeaderName token. Returns true
+   * on error, once the rest of the directive is discarded.
+   */
   bool LexHeaderName(Token &Result);
 
+  /** Read and discard all tokens remaining on the current line. */
+  void DiscardUntilEndOfDirective();
+
+  /**
+   * The ( starting a parameter list of a function-like macro has just been
+   * lexed, read the parameters. Returns false on error, once the rest of the
+   * directive is discarded.
+   */
+  bool ReadMacroParameterList(std::vector<IdentifierInfo *> &Parameters,
+                              bool &bIsVariadic);
+
   const char *GetCurLexerEndPos();
 
   /**
@@ -102,16 +395,117 @@ private:
   bool EvaluateDirectiveExpression(IdentifierInfo *&IfNDefMacro);
 
 public:
-  /** Given a "foo" or <foo> reference, lookup the indicated file. */
-  std::optional<FileEntry &> LookupFile(std::string &Filename, bool bIsAngled);
+  /**
+   * Given a "foo" or <foo> reference, lookup the indicated file. See
+   * HeaderSearch::LookupFile.
+   */
+  const FileEntry *LookupFile(const std::string &Filename, bool bIsAngled,
+                              const DirectoryLookup *FromDir,
+                              const DirectoryLookup *&CurDir);
+
+  /**
+   * Start reading the headers FID includes in the background, so that
+   * entering them does not wait for the disk. Called by EnterSourceFile, it
+   * only has an effect if prefetching is enabled in the FileManager.
+   */
+  void PrefetchIncludes(FileID FID);
+
+  /**
+   * Replay the raw tokens of files from Cache instead of lexing them. The
+   * cache must outlive the preprocessor.
+   */
+  void SetTokenCache(TokenCache *Cache) { TokCache = Cache; }
+
+  /**
+   * Make L replay the cached tokens of its file. Called by EnterSourceFile,
+   * it only has an effect if a token cache is set.
+   */
+  void UseCachedTokens(Lexer &L);
+
+public:
+  /*=============== Macro Definitions ================================*/
+  /** Create a new MacroInfo defined at Location. */
+  MacroInfo *AllocateMacroInfo(SourceLocation Location);
+
+  /** Create a directive; MI must be null for MD_Undefine. */
+  MacroDirective *AllocateMacroDirective(MacroDirective::Kind Kind,
+                                         SourceLocation Location,
+                                         MacroInfo *MI);
+
+  /**
+   * Make MD the most recent directive of II and update its HasMacroDefinition
+   * bit accordingly.
+   */
+  void AppendMacroDirective(IdentifierInfo *II, MacroDirective *MD);
+
+  /**
+   * Return the most recent #define or #undef of II, or null if it has never
+   * been a macro. Older directives are reachable through GetPrevious().
+   */
+  MacroDirective *GetMacroDirectiveHistory(const IdentifierInfo *II) const {
+    if (!II->GetHadMacroDefinition())
+      return nullptr;
+
+    return Macros.Lookup(II);
+  }
+
+  /** Return the current definition of II, or null if it is not a macro. */
+  MacroInfo *GetMacroInfo(const IdentifierInfo *II) const {
+    // Cheap bit test, most identifiers are not macros.
+    if (!II->GetHasMacroDefinition())
+      return nullptr;
+
+    MacroDirective *MD = GetMacroDirectiveHistory(II);
+    assert(MD && MD->IsDefined() && "Macro bit set without a definition!");
+    return MD->GetMacroInfo();
+  }
+
+  /** Return true if II is currently defined as a macro. */
+  bool IsMacroDefined(const IdentifierInfo *II) const {
+    return II->GetHasMacroDefinition();
+  }
+
+  /*=============== Macro Snapshots ==================================*/
+  /**
+   * Capture the state of all macros in O(1). The snapshot shares its storage
+   * with the live table; later #define and #undef copy only the parts of the
+   * table they modify.
+   */
+  MacroTable TakeMacroSnapshot() const { return Macros; }
+
+  /**
+   * Return all macros to the state captured by Snapshot. The table is not
+   * copied, only the identifiers whose state differs are visited to update
+   * their HasMacroDefinition bit.
+   */
+  void RestoreMacroSnapshot(const MacroTable &Snapshot);
+
+  /**
+   * Lex the replacement list of MI into its token vector, if that has not
+   * happened yet. Called on first expansion or when checking redefinitions.
+   */
+  void LexMacroBody(MacroInfo &MI);
+
+  /** Return the spelling of the token, cleaned, as a string. */
+  std::string GetSpelling(const Token &Tok) const;
+
+  /**
+   * Look up the IdentifierInfo of the identifier token starting at Start and
+   * store it in the token. Tokens that need cleaning are looked up by their
+   * cleaned spelling.
+   */
+  IdentifierInfo *LookUpIdentifierInfo(Token &Identifier, const char *Start);
 
 public:
   /**
    * Callback when the lexer lexes an identifier. This callback looksup the
    * identifier in the map and/or potentially macro expands it or turns it into
    * a named token (like 'for').
+   *
+   * Returns false if the identifier was macro expanded and the caller has to
+   * lex again to get the next token.
    */
-  void HandleIdentifier(Token &Identifier);
+  bool HandleIdentifier(Token &Identifier);
 
   /*=============== Directive Handling Methods =======================*/
   /**
@@ -127,6 +521,12 @@ public:
    */
   bool HandleEndOfFile(Token &Result);
 
+  /**
+   * Callback when the TokenLexer runs out of replacement tokens. Returns to
+   * the lexer the macro was expanded from; always returns false.
+   */
+  bool HandleEndOfTokenLexer(Token &Result);
+
   /** Handle GNU line marker directive. */
   // void HandleDigitDirective(Token &Result);
 
@@ -134,11 +534,25 @@ public:
   void CheckEndOfDirective();
 
   /*=============== Conditional Directives ============================*/
-  void HandleIfDirective(Token &Result);
-  void HandleIfdefDirective(Token &Result, bool bIsIfndef);
+  /**
+   * bReadAnyTokensBeforeDirective tells if the directive can start the
+   * include guard of the file, see MultipleIncludeOpt.
+   */
+  void HandleIfDirective(Token &Result, bool bReadAnyTokensBeforeDirective);
+  void HandleIfdefDirective(Token &Result, bool bIsIfndef,
+                            bool bReadAnyTokensBeforeDirective);
+  void HandleElifDirective(Token &Result);
   void HandleElseDirective(Token &Result);
   void HandleEndifDirective(Token &Result);
 
+  /**
+   * Skip a conditional block that is not entered, up to the directive that
+   * ends it or enters one of its other branches. Pushes the conditional
+   * level of the block.
+   */
+  void SkipExcludedConditionalBlock(SourceLocation IfLocation,
+                                    bool bFoundNonSkip, bool bFoundElse);
+
   /*=============== Macro Replacement Directives =======================*/
   void HandleDefineDirective();
   void HandleUndefDirective();
@@ -152,6 +566,16 @@ public:
   /*====================== Pragma Directives ============================*/
   void HandlePragmaDirective(PragmaKind Kind);
 
+  /** Handle #pragma once. */
+  void HandlePragmaOnce(Token &OnceToken);
+
+  /** Handle #pragma push_macro("name") and #pragma pop_macro("name"). */
+  void HandlePragmaPushMacro(Token &PushMacroToken);
+  void HandlePragmaPopMacro(Token &PopMacroToken);
+
+  /** Read ("name") of push_macro/pop_macro, returns null on error. */
+  IdentifierInfo *ParsePragmaPushOrPopMacro();
+
   void HandleIncludeDirective(Token &Result, const DirectoryLookup *LookupFrom);
 };
 
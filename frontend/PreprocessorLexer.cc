@@ -1 +1,29 @@
 #include "PreprocessorLexer.h"
+
+#include "Lexer.h"
+#include "Preprocessor.h"
+
+PreprocessorLexer::PreprocessorLexer(Preprocessor *InOwnerPP, FileID InFid)
+    : OwnerPP(InOwnerPP)
+    , FID(InFid) {
+  if (OwnerPP) {
+    SourceManager &SM = OwnerPP->GetSourceManager();
+    PinnedContent = &SM.GetContentCache(FID);
+    SM.PinContentCache(*PinnedContent);
+  }
+}
+
+PreprocessorLexer::~PreprocessorLexer() {
+  if (PinnedContent)
+    OwnerPP->GetSourceManager().UnpinContentCache(*PinnedContent);
+}
+
+void
+PreprocessorLexer::LexIncludeFilename(Token &FilenameToken) {
+  assert(ParsingPreprocessorDirective && !ParsingFilename &&
+         "Include filename lexed outside of a directive!");
+
+  ParsingFilename = true;
+  static_cast<Lexer *>(this)->AdvanceToken(FilenameToken);
+  ParsingFilename = false;
+}
@@ -2,6 +2,7 @@
 #define PREPROCESSOR_LEXER_H
 
 #include "Mixins.h"
+#include "MultipleIncludeOpt.h"
 #include "PPConditionalDirective.h"
 #include "SourceManager.h"
 
@@ -23,18 +24,31 @@ class PreprocessorLexer : private NonCopyable<PreprocessorLexer> {
   /** FileID corresponding to the file being lexed. */
   const FileID FID;
 
+  /** The buffer of FID, kept in memory while we lex it. */
+  const FileContentCache *PinnedContent = nullptr;
+
   /** True when parsing #X; turns '\\n' into a Eod token. */
   bool ParsingPreprocessorDirective = false;
 
   /** True after #include; turns <foo> or "foo" into HeaderName token. */
   bool ParsingFilename = false;
 
+  /**
+   * True if the lexer is not attached to a live include stack. Raw lexers
+   * never call back into the preprocessor for directives, identifiers or the
+   * end of file. Used to lex macro bodies on demand.
+   */
+  bool LexingRawMode = false;
+
   /**
    * Information about the set of #if / #ifdef / #ifndef blocks we are
    * currently in.
    */
   std::vector<PPConditionalInfo> ConiditionalStack;
 
+  /** Tracks whether the file has an include guard. */
+  MultipleIncludeOpt MIOpt;
+
   struct IncludeEntry {
     const FileEntry *File;
     SourceLocation Location;
@@ -44,8 +58,13 @@ class PreprocessorLexer : private NonCopyable<PreprocessorLexer> {
   std::map<std::string, IncludeEntry> IncludeHistory;
 
   PreprocessorLexer(Preprocessor *InOwnerPP, FileID InFid);
+  ~PreprocessorLexer();
 
 public:
+  /**
+   * Lex the file name of an #include, "foo" or <foo>. Must be called in a
+   * directive.
+   */
   void LexIncludeFilename(Token &FilenameToken);
 
   Preprocessor *GetOwnerPP() { return OwnerPP; }
@@ -63,6 +82,36 @@ public:
 
   ConditionalIterator ConditionalEnd() const { return ConiditionalStack.end(); }
 
+  /** Enter a #if, #ifdef or #ifndef block at IfLocation. */
+  void PushConditionalLevel(SourceLocation IfLocation, bool bWasSkipping,
+                            bool bFoundNonSkip, bool bFoundElse) {
+    ConiditionalStack.push_back(
+        {IfLocation, bWasSkipping, bFoundNonSkip, bFoundElse});
+  }
+
+  /**
+   * Leave the innermost conditional block and return its information in
+   * CondInfo. Returns true if there is no block to leave.
+   */
+  bool PopConditionalLevel(PPConditionalInfo &CondInfo) {
+    if (ConiditionalStack.empty())
+      return true;
+
+    CondInfo = ConiditionalStack.back();
+    ConiditionalStack.pop_back();
+    return false;
+  }
+
+  /** The innermost conditional block, there must be one. */
+  PPConditionalInfo &PeekConditionalLevel() {
+    assert(!ConiditionalStack.empty() && "No conditional block entered!");
+    return ConiditionalStack.back();
+  }
+
+  unsigned GetConditionalStackDepth() const {
+    return ConiditionalStack.size();
+  }
+
   /** Insert into the list of  */
   void AddInclude(const std::string &Filename, const FileEntry &InFile,
                   SourceLocation InSourceLocation) {
@@ -0,0 +1,264 @@
+#include "PrintPreprocessedOutput.h"
+
+#include "CharInfo.h"
+#include "Preprocessor.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+PreprocessedOutputWriter::PreprocessedOutputWriter()
+    : Buffer(new char[BufferSize])
+    , BufferCur(Buffer.get()) {}
+
+bool
+PreprocessedOutputWriter::Print(Preprocessor &InPP, int OutFD,
+                                const PreprocessorOutputOptions &Opts) {
+  FD = OutFD;
+  bWriteFailed = false;
+  Options = Opts;
+  PP = &InPP;
+  SM = &InPP.GetSourceManager();
+
+  bHaveFile = false;
+  CurLine = 0;
+  bEmittedTokensOnThisLine = false;
+  PrevKind = Unknown;
+  PrevLastChar = 0;
+
+  // Hear about the #includes entered and left. The main file was entered
+  // before that.
+  PPCallbacks *OldCallbacks = InPP.GetPPCallbacks();
+  InPP.SetPPCallbacks(this);
+  SourceManager &SourceMgr = InPP.GetSourceManager();
+  FileChanged(SourceMgr.GetComposedLoc(SourceMgr.GetMainFileID(), 0),
+              EnterFile);
+
+  Token Tok;
+  while (true) {
+    InPP.AdvanceToken(Tok);
+    if (Tok.GetKind() == Eof)
+      break;
+
+    PrintToken(Tok);
+  }
+
+  InPP.SetPPCallbacks(OldCallbacks);
+
+  if (bEmittedTokensOnThisLine)
+    WriteChar('\n');
+
+  Flush();
+  return !bWriteFailed;
+}
+
+void
+PreprocessedOutputWriter::PrintToken(const Token &Tok) {
+  // Tokens of macro expansions are printed where the macro was expanded.
+  std::pair<FileID, unsigned> LocInfo =
+      SM->GetDecomposedExpansionLoc(Tok.GetLocation());
+
+  unsigned Length;
+  const char *Spelling = PP->GetSpelling(Tok, SpellingBuffer, Length);
+
+  // Files are entered through FileChanged, except for tokens the
+  // preprocessor did not lex from a file it entered.
+  if (!bHaveFile || LocInfo.first != CurFID) {
+    SwitchToFile(LocInfo.first,
+                 SM->GetLineNumber(LocInfo.first, LocInfo.second), "");
+  } else if (Tok.HasFlag(Token::StartOfLine)) {
+    MoveToLine(SM->GetLineNumber(LocInfo.first, LocInfo.second));
+  } else if (Tok.HasFlag(Token::LeadingSpace) ||
+             (bEmittedTokensOnThisLine && AvoidConcat(Spelling[0]))) {
+    WriteChar(' ');
+  }
+
+  // Indent the first token of a line to its column, like the source.
+  if (!bEmittedTokensOnThisLine && Tok.HasFlag(Token::LeadingSpace)) {
+    unsigned Column = SM->GetColumnNumber(LocInfo.first, LocInfo.second);
+    for (unsigned I = 1; I < Column; ++I)
+      WriteChar(' ');
+  }
+
+  Write(Spelling, Length);
+  bEmittedTokensOnThisLine = true;
+
+  PrevKind = Tok.GetKind();
+  PrevLastChar = Length ? Spelling[Length - 1] : 0;
+}
+
+void
+PreprocessedOutputWriter::MoveToLine(unsigned Line) {
+  // Same line, e.g. the previous token ended with an escaped newline.
+  if (Line == CurLine) {
+    if (bEmittedTokensOnThisLine)
+      WriteChar(' ');
+    return;
+  }
+
+  if (bEmittedTokensOnThisLine) {
+    WriteChar('\n');
+    ++CurLine;
+    bEmittedTokensOnThisLine = false;
+  }
+
+  if (!Options.ShowLineMarkers) {
+    // -P, blank lines are not preserved.
+    CurLine = Line;
+    return;
+  }
+
+  // A few newlines are shorter than a line marker.
+  if (Line >= CurLine && Line - CurLine <= MaxNewlinesForLineJump) {
+    for (; CurLine < Line; ++CurLine)
+      WriteChar('\n');
+    return;
+  }
+
+  CurLine = Line;
+  WriteLineMarker(Line, "");
+}
+
+void
+PreprocessedOutputWriter::FileChanged(SourceLocation Loc,
+                                      FileChangeReason Reason) {
+  std::pair<FileID, unsigned> LocInfo = SM->GetDecomposedExpansionLoc(Loc);
+  unsigned Line = SM->GetLineNumber(LocInfo.first, LocInfo.second);
+
+  // GNU line marker flags: 1 when entering an #include, 2 when returning to
+  // the including file.
+  const char *Flag = "";
+  if (Reason == ExitFile) {
+    Flag = " 2";
+  } else if (SM->GetSLocEntryByID(LocInfo.first)
+                 .GetFile()
+                 .GetIncludeLocation()
+                 .IsValid()) {
+    Flag = " 1";
+  }
+
+  SwitchToFile(LocInfo.first, Line, Flag);
+}
+
+void
+PreprocessedOutputWriter::SwitchToFile(FileID FID, unsigned Line,
+                                       const char *Flag) {
+  if (bEmittedTokensOnThisLine) {
+    WriteChar('\n');
+    bEmittedTokensOnThisLine = false;
+  }
+
+  bHaveFile = true;
+  CurFID = FID;
+  CurLine = Line;
+  PrevKind = Unknown;
+  PrevLastChar = 0;
+
+  if (Options.ShowLineMarkers)
+    WriteLineMarker(Line, Flag);
+}
+
+void
+PreprocessedOutputWriter::WriteLineMarker(unsigned Line, const char *Flag) {
+  // # <line> "<filename>"<flag>
+  char Digits[16];
+  char *DigitsEnd = Digits + sizeof(Digits);
+  char *DigitsBegin = DigitsEnd;
+  do {
+    *--DigitsBegin = '0' + Line % 10;
+    Line /= 10;
+  } while (Line);
+
+  Write("# ", 2);
+  Write(DigitsBegin, DigitsEnd - DigitsBegin);
+  Write(" \"", 2);
+
+  std::string FileName = SM->GetContentCache(CurFID).GetFileName();
+  for (char C : FileName) {
+    if (C == '\\' || C == '"')
+      WriteChar('\\');
+    WriteChar(C);
+  }
+
+  WriteChar('"');
+  Write(Flag, strlen(Flag));
+  WriteChar('\n');
+}
+
+bool
+PreprocessedOutputWriter::AvoidConcat(char FirstChar) const {
+  // Identifiers, numbers, and literal prefixes such as L"x" or u8'x'.
+  if (IsAsciiIdentifierContinue(PrevLastChar) &&
+      (IsAsciiIdentifierContinue(FirstChar) || FirstChar == '\'' ||
+       FirstChar == '"'))
+    return true;
+
+  // pp-numbers: 1. .5 1e+5
+  if (PrevKind == NumericConstant &&
+      (FirstChar == '.' || FirstChar == '+' || FirstChar == '-'))
+    return true;
+  if (PrevLastChar == '.' && FirstChar >= '0' && FirstChar <= '9')
+    return true;
+
+  switch (FirstChar) {
+  case '=': // +=, <<=, ==, ...
+    switch (PrevKind) {
+    case Plus: case Minus: case Star: case Slash: case Percent: case Less:
+    case Greater:
+    case LessLess: case GreaterGreater: case Equal: case Exclaim: case Amp:
+    case Pipe: case Caret:
+      return true;
+    default:
+      return false;
+    }
+  case '>': // ->, >>, :>, %>
+    return PrevLastChar == '-' || PrevLastChar == '>' || PrevLastChar == ':' ||
+           PrevLastChar == '%';
+  case '*': // .*, /* comment
+    return PrevLastChar == '.' || PrevLastChar == '/';
+  case '/': // // comment
+    return PrevLastChar == '/';
+  case '+': case '-': case '&': case '|': case '<': case ':': case '#':
+  case '.': // ++, --, &&, ||, <<, ::, ##, ...
+    return PrevLastChar == FirstChar;
+  default:
+    return false;
+  }
+}
+
+void
+PreprocessedOutputWriter::Write(const char *Data, size_t Length) {
+  if (Length > size_t(Buffer.get() + BufferSize - BufferCur)) {
+    Flush();
+
+    // Larger than the whole buffer, write it out directly.
+    if (Length > BufferSize)
+      return WriteToFD(Data, Length);
+  }
+
+  memcpy(BufferCur, Data, Length);
+  BufferCur += Length;
+}
+
+void
+PreprocessedOutputWriter::Flush() {
+  WriteToFD(Buffer.get(), BufferCur - Buffer.get());
+  BufferCur = Buffer.get();
+}
+
+void
+PreprocessedOutputWriter::WriteToFD(const char *Data, size_t Length) {
+  while (Length && !bWriteFailed) {
+    ssize_t Written = ::write(FD, Data, Length);
+    if (Written < 0) {
+      if (errno == EINTR)
+        continue;
+
+      bWriteFailed = true;
+      return;
+    }
+
+    Data += Written;
+    Length -= Written;
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef PRINT_PREPROCESSED_OUTPUT_H
+#define PRINT_PREPROCESSED_OUTPUT_H
+
+#include "Mixins.h"
+#include "Options.h"
+#include "PPCallbacks.h"
+#include "SourceManager.h"
+#include "Token.h"
+
+#include <memory>
+#include <string>
+
+class Preprocessor;
+
+/* ========================================================
+ *  PreprocessedOutputWriter
+ * ========================================================
+ */
+
+/**
+ * Writes the preprocessed token stream (-E, -P) to a file descriptor.
+ *
+ * Output is collected in a large buffer, so a translation unit takes only a
+ * few write calls. The buffer is reused when the writer prints more
+ * translation units. Spacing is rebuilt from the token flags; the source is
+ * only read for the token spellings. Line markers are emitted when the
+ * preprocessor enters or leaves a file, see FileChanged, or when the line
+ * jumps further than a few newlines would.
+ */
+class PreprocessedOutputWriter : public PPCallbacks,
+                                 private NonCopyable<PreprocessedOutputWriter> {
+  static constexpr size_t BufferSize = 256 * 1024;
+
+  /** Once the line jumps by more than this, emit a line marker instead. */
+  static constexpr unsigned MaxNewlinesForLineJump = 8;
+
+  std::unique_ptr<char[]> Buffer;
+  char *BufferCur;
+
+  /** Output file descriptor. */
+  int FD = -1;
+
+  /** Set once a write to FD failed, the rest of the output is dropped. */
+  bool bWriteFailed = false;
+
+  PreprocessorOutputOptions Options;
+  const Preprocessor *PP = nullptr;
+  const SourceManager *SM = nullptr;
+
+  /** Holds the spelling of tokens that need cleaning. */
+  std::string SpellingBuffer;
+
+  /** File and line the output is currently at. */
+  bool bHaveFile = false;
+  FileID CurFID = 0;
+  unsigned CurLine = 0;
+
+  /** True if a token was written since the last newline. */
+  bool bEmittedTokensOnThisLine = false;
+
+  /** Kind and last character of the previous token written. */
+  TokenKind PrevKind = Unknown;
+  char PrevLastChar = 0;
+
+public:
+  PreprocessedOutputWriter();
+
+  /**
+   * Lex all tokens of InPP until the end of the translation unit and write
+   * them to OutFD. InPP must have entered the main file of its SourceManager
+   * and not lexed from it yet. Returns false if writing failed.
+   */
+  bool Print(Preprocessor &InPP, int OutFD,
+             const PreprocessorOutputOptions &Opts);
+
+  /** Emit the line marker of the file entered or returned to. */
+  void FileChanged(SourceLocation Loc, FileChangeReason Reason) override;
+
+private:
+  void PrintToken(const Token &Tok);
+
+  /** Start a new line for a token at Line of the current file. */
+  void MoveToLine(unsigned Line);
+
+  /**
+   * Continue at Line of FID, which is not the current file. Flag is the
+   * flag of the line marker.
+   */
+  void SwitchToFile(FileID FID, unsigned Line, const char *Flag);
+
+  void WriteLineMarker(unsigned Line, const char *Flag);
+
+  /**
+   * Return true if a space is needed between the previous token and a token
+   * starting with FirstChar, so that they are not lexed as one.
+   */
+  bool AvoidConcat(char FirstChar) const;
+
+  void Write(const char *Data, size_t Length);
+  void WriteChar(char C) {
+    if (BufferCur == Buffer.get() + BufferSize)
+      Flush();
+    *BufferCur++ = C;
+  }
+
+  void Flush();
+  void WriteToFD(const char *Data, size_t Length);
+};
+
+#endif
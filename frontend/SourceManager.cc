@@ -1,5 +1,14 @@
 #include "SourceManager.h"
 
+#include "FileManager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+/** Source of SourceManager::Generation values, 0 is never used. */
+static std::atomic<uint64_t> NextGeneration{1};
+
 SourceManager::SourceManager(bool _Dummy) { Reset(); }
 
 SourceManager::~SourceManager() {}
@@ -7,162 +16,645 @@ SourceManager::~SourceManager() {}
 /* Create a new FileID for specified include position. */
 FileID
 SourceManager::CreateFileID(FileContentCache &File, SourceLocation IncludePos,
-                            int LoadedID) {
+                            int LoadedID, UIntTy LoadedOffset) {
   // Loaded entry
   if (LoadedID < 0) {
     // Loaded FileID
     assert(LoadedID != -1 && "Loading sentinel FileID");
     unsigned Index = unsigned(-LoadedID) - 2;
-    assert(Index < LoadedSrcLocEntryTable.size() && "FileID out of range");
-    assert(!SLocEntryLoaded[Index] && "FileID already loaded");
-    // TODO : work this out
-    // LoadedSrcLocEntryTable[Index] = SourceLocationEntry::Create(LoadedO)
-    SLocEntryLoaded[Index] = true;
+    assert(Index < LoadedSLocEntryRefs.size() && "FileID out of range");
+    assert(!SLocEntryLoaded.Test(Index) && "FileID already loaded");
+    assert(LoadedFileInfos.size() < LoadedFileInfos.capacity() &&
+           "Loaded infos would move!");
+    LoadedSLocEntryRefs[Index] = LoadedFileInfos.size();
+    LoadedFileInfos.push_back(FileInfo::Create(IncludePos, File));
+    SetLoadedOffsetIfUnset(Index, LoadedOffset);
+    SLocEntryLoaded.SetRelease(Index);
+    return LoadedID;
   }
 
   // Local entry
-  LocalSrcLocEntryTable.emplace_back(SourceLocationEntry::Create(
-      NextLocalOffset, FileInfo::Create(IncludePos)));
+  LocalSLocEntryRefs.push_back(LocalFileInfos.size());
+  LocalFileInfos.push_back(FileInfo::Create(IncludePos, File));
+  LocalSLocEntryOffsets.push_back(NextLocalOffset);
 
   // We do a +1 here because we want a SourceLocation that means "the end of the
   // file"
   NextLocalOffset += File.GetSize() + 1;
 
   // FileID is just the last insert index
-  FileID FID = LocalSrcLocEntryTable.size() - 1;
-  return LastFileIDLookup = FID;
+  FileID FID = LocalSLocEntryRefs.size() - 1;
+  if (const FileEntry *Entry = File.GetFileEntry())
+    LocalFileIDs.emplace(Entry, FID);
+  RememberFileID(FID, GetThreadLookupCache());
+  return FID;
 }
 
-FileID
-SourceManager::GetFileID_CM(uint32_t SLocOffset) const {
-  if (SLocOffset < NextLocalOffset) {
-    return GetFileID_CM_Local(SLocOffset);
-  }
-  return GetFileID_CM_Loaded(SLocOffset);
+SourceLocation
+SourceManager::CreateExpansionLoc(SourceLocation SpellingLoc,
+                                  SourceLocation ExpansionLocStart,
+                                  SourceLocation ExpansionLocEnd,
+                                  unsigned Length) {
+  LocalSLocEntryRefs.push_back(LocalExpansionInfos.size() | ExpansionRef);
+  LocalExpansionInfos.push_back(
+      ExpansionInfo::Create(SpellingLoc, ExpansionLocStart, ExpansionLocEnd));
+  LocalSLocEntryOffsets.push_back(NextLocalOffset);
+
+  // As for files, +1 so that the end of the expansion has a location.
+  SourceLocation Loc = SourceLocation::GetMacroLoc(NextLocalOffset);
+  NextLocalOffset += Length + 1;
+  return Loc;
 }
 
-FileID
-SourceManager::GetFileID_CM_Local(uint32_t SLocOffset) const {
-  assert(SLocOffset < NextLocalOffset && "Bad function choice");
+void
+SourceManager::CreateLoadedExpansion(const ExpansionInfo &Info, int LoadedID,
+                                     UIntTy LoadedOffset) {
+  assert(LoadedID < -1 && "Not a loaded FileID!");
+  unsigned Index = unsigned(-LoadedID) - 2;
+  assert(Index < LoadedSLocEntryRefs.size() && "FileID out of range");
+  assert(!SLocEntryLoaded.Test(Index) && "FileID already loaded");
+  assert(LoadedExpansionInfos.size() < LoadedExpansionInfos.capacity() &&
+         "Loaded infos would move!");
+  LoadedSLocEntryRefs[Index] = LoadedExpansionInfos.size() | ExpansionRef;
+  LoadedExpansionInfos.push_back(Info);
+  SetLoadedOffsetIfUnset(Index, LoadedOffset);
+  SLocEntryLoaded.SetRelease(Index);
+}
 
-  SourceLocationEntryTable::const_iterator I;
+std::pair<int, SourceLocation::UIntTy>
+SourceManager::AllocateLoadedSLocEntries(unsigned NumEntries,
+                                         UIntTy TotalSize) {
+  assert(CurrentLoadedOffset - NextLocalOffset >= TotalSize &&
+         "Out of source location space!");
 
-  // First we are going to lookup for offset in the LastFileIDLookup
-  if (LastFileIDLookup < 0 ||
-      LocalSrcLocEntryTable[LastFileIDLookup].GetOffset() < SLocOffset) {
-    // set this to end we are going to search by decrementing the pointer
-    I = LocalSrcLocEntryTable.end();
-  } else {
-    // start from LastFileIDLookup
-    I = (LocalSrcLocEntryTable.begin() + LastFileIDLookup);
+  unsigned NumLoaded = LoadedSLocEntryRefs.size() + NumEntries;
+  LoadedSLocEntryRefs.resize(NumLoaded);
+  LoadedSLocEntryOffsets.resize(NumLoaded);
+  SLocEntryLoaded.resize(NumLoaded);
+  CurrentLoadedOffset -= TotalSize;
+
+  // Room for every entry of either kind, the entries are read while others
+  // may be looking at the infos. Pages that are never used are never
+  // touched.
+  LoadedFileInfos.reserve(NumLoaded);
+  LoadedExpansionInfos.reserve(NumLoaded);
+
+  // Entry 0 of the file gets the highest index, see GetSLocEntryByID.
+  int BaseID = -static_cast<int>(NumLoaded) - 1;
+  return std::make_pair(BaseID, CurrentLoadedOffset);
+}
+
+void
+SourceManager::LoadSLocEntry(unsigned Index) const {
+  assert(ExternalSLocEntries && "Loaded entry without a source!");
+  std::lock_guard<std::mutex> Lock(LoadMutex);
+
+  // Another thread may have read it while we waited.
+  if (SLocEntryLoaded.Test(Index))
+    return;
+
+  bool bRead =
+      ExternalSLocEntries->ReadSLocEntry(-static_cast<int>(Index) - 2);
+  assert((!bRead || SLocEntryLoaded.Test(Index)) && "Entry read but not set!");
+  if (!bRead || !SLocEntryLoaded.Test(Index)) {
+    // error: corrupt serialized file, leave an empty entry at the offset so
+    // we do not come back for it.
+    ExpansionInfo Empty = ExpansionInfo::Create(
+        SourceLocation(), SourceLocation(), SourceLocation());
+    LoadedSLocEntryRefs[Index] = LoadedExpansionInfos.size() | ExpansionRef;
+    LoadedExpansionInfos.push_back(Empty);
+    SLocEntryLoaded.SetRelease(Index);
   }
+}
 
-  // decrement the Iterator to find the FileID we are looking for
-  unsigned NumProbes = 0;
-  for (; NumProbes < 8; NumProbes++, --I) {
-    if (I->GetOffset() <= SLocOffset) {
-      FileID ResultIndex = (I - LocalSrcLocEntryTable.begin());
-      LastFileIDLookup = ResultIndex; // Save it to cache.
-      return ResultIndex;
+const char *
+FileContentCache::ReloadBuffer() const {
+  assert(Owner && "Buffer was never set!");
+  return Owner->ReloadContentCache(*this);
+}
+
+/* Return a pointer to the character data at the specified location. */
+const char *
+SourceManager::GetCharacterData(SourceLocation SL) const {
+  std::pair<FileID, unsigned> LocInfo = GetDecomposedSpellingLoc(SL);
+  return GetContentCache(LocInfo.first).GetBufferStart() + LocInfo.second;
+}
+
+void
+FileContentCache::ComputeContentHash() const {
+  std::lock_guard<std::mutex> Lock(LazyMutex);
+  if (bHashComputed.load(std::memory_order_relaxed))
+    return;
+
+  // Buffers are only dropped once hashed.
+  Hash = ContentHash::Compute(BufferData.load(), BufferSize);
+  bHashComputed.store(true, std::memory_order_release);
+}
+
+void
+FileContentCache::ComputeLineOffsets() const {
+  // Reloading a dropped buffer takes the lock of the owner, before ours.
+  const char *Start = GetBufferStart();
+  const char *End = Start + BufferSize;
+
+  std::lock_guard<std::mutex> Lock(LazyMutex);
+  if (bLineOffsetsComputed.load(std::memory_order_relaxed))
+    return;
+
+  LineOffsets.push_back(0);
+
+  for (const char *Ptr = Start; Ptr != End; ++Ptr) {
+    // Skip quickly to the next line terminator.
+    if (*Ptr != '\n' && *Ptr != '\r') {
+      const char *NL =
+          static_cast<const char *>(memchr(Ptr, '\n', End - Ptr));
+      const char *CR =
+          static_cast<const char *>(memchr(Ptr, '\r', (NL ? NL : End) - Ptr));
+      Ptr = CR ? CR : NL;
+      if (!Ptr)
+        break;
     }
+
+    // Handle \r\n as a single line terminator.
+    if (Ptr[0] == '\r' && Ptr + 1 != End && Ptr[1] == '\n')
+      ++Ptr;
+    LineOffsets.push_back(Ptr + 1 - Start);
   }
 
-  unsigned GreaterIndex = I - LocalSrcLocEntryTable.begin();
-  NumProbes = 0;
-  while (true) {
-    break;
+  bLineOffsetsComputed.store(true, std::memory_order_release);
+}
+
+unsigned
+SourceManager::GetLineNumber(FileID FID, unsigned Offset) const {
+  const std::vector<unsigned> &LineOffsets =
+      GetContentCache(FID).GetLineOffsets();
+
+  // Number of lines starting at or before Offset.
+  return std::upper_bound(LineOffsets.begin(), LineOffsets.end(), Offset) -
+         LineOffsets.begin();
+}
+
+/**
+ * Number of leading elements of Offsets that satisfy Pred, which holds for a
+ * prefix of them. The search halves the range without branching on the
+ * comparison, which is turned into a conditional move, and prefetches both
+ * possible next probes, so it costs a few cache misses on large tables
+ * instead of mispredictions on every level.
+ */
+template <typename OffsetT, typename PredT>
+static unsigned
+PartitionPoint(const OffsetT *Offsets, unsigned Size, PredT Pred) {
+  if (Size == 0)
+    return 0;
+
+  const OffsetT *Base = Offsets;
+  while (Size > 1) {
+    unsigned Half = Size / 2;
+    __builtin_prefetch(Base + Half / 2);
+    __builtin_prefetch(Base + Half + Half / 2);
+    Base = Pred(Base[Half]) ? Base + Half : Base;
+    Size -= Half;
   }
+  return Base - Offsets + Pred(*Base);
 }
 
 FileID
-SourceManager::GetFileID_CM_Loaded(uint32_t SLocOffset) const {
-  assert(SLocOffset < CurrentLoadedOffset && "Bad function choice");
+SourceManager::GetFileID_CM(UIntTy SLocOffset, LookupCache &Cache) const {
+  NumFileIDLookupMisses.fetch_add(1, std::memory_order_relaxed);
 
-  unsigned I;
-  if (LastFileIDLookup >= 0 ||
-      GetSLocEntryByID(LastFileIDLookup).GetOffset() < SLocOffset) {
-    I = 0;
-  } else {
-    I = (-LastFileIDLookup + 2) + 1;
-  }
+  FileID FID = SLocOffset < NextLocalOffset ? GetFileID_CM_Local(SLocOffset)
+                                            : GetFileID_CM_Loaded(SLocOffset);
+  RememberFileID(FID, Cache);
+  return FID;
+}
 
-  unsigned NumProbes = 0;
-  for (NumProbes = 0; NumProbes < 8; NumProbes++, ++I) {
-    const SourceLocationEntry &Entry = GetLoadedSLocEntry(I);
-    if (Entry.GetOffset() <= SLocOffset) {
-      FileID Result = (-I - 2);
-      LastFileIDLookup = Result;
-      return Result;
-    }
-  }
+FileID
+SourceManager::GetFileID_CM_Local(UIntTy SLocOffset) const {
+  assert(SLocOffset < NextLocalOffset && "Bad function choice");
+
+  // The last entry starting at or before SLocOffset. The invalid location
+  // comes before every entry and ends up in the first one.
+  unsigned NumBefore = PartitionPoint(
+      LocalSLocEntryOffsets.data(), LocalSLocEntryOffsets.size(),
+      [SLocOffset](UIntTy Offset) { return Offset <= SLocOffset; });
+  return NumBefore ? NumBefore - 1 : 0;
+}
+
+FileID
+SourceManager::GetFileID_CM_Loaded(UIntTy SLocOffset) const {
+  assert(SLocOffset >= CurrentLoadedOffset && "Bad function choice");
+
+  // Offsets decrease with the index, look for the first entry starting at or
+  // before SLocOffset. Only the offsets are searched, so none of the entries
+  // passed over have to be loaded.
+  unsigned Index = PartitionPoint(
+      LoadedSLocEntryOffsets.data(), LoadedSLocEntryOffsets.size(),
+      [SLocOffset](UIntTy Offset) { return Offset > SLocOffset; });
+  assert(Index < LoadedSLocEntryOffsets.size() && "Offset out of range!");
+
+  return -static_cast<int>(Index) - 2;
 }
 
 std::pair<FileID, unsigned>
-SourceManager::GetDecomposedExpansionLocSlow(
-    const SourceLocationEntry *Entry) const {
-  FileID FID;
-  SourceLocation Loc;
-  unsigned Offset;
-  do {
-    Loc = Entry->GetExpansion().GetExpansionLocStart();
-    FID = GetFileID(Loc);
+SourceManager::GetDecomposedExpansionLocSlow(FileID FID) const {
+  LookupCache &Cache = GetThreadLookupCache();
+  ValidateLookupCache(Cache);
 
-    Entry = &GetSLocEntryByID(FID);
-    Offset = Loc.GetOffset() - Entry->GetOffset();
-  } while (!Loc.IsFileID());
+  std::pair<FileID, unsigned> Result;
+  while (true) {
+    auto It = Cache.ExpansionLocs.find(FID);
+    if (It != Cache.ExpansionLocs.end()) {
+      Result = It->second;
+      break;
+    }
 
-  return std::make_pair(FID, Offset);
+    Cache.Chain.emplace_back(FID, 0);
+    SourceLocation Loc =
+        GetSLocEntryByID(FID).GetExpansion().GetExpansionLocStart();
+    FID = GetFileID(Loc, Cache);
+    if (Loc.IsFileID()) {
+      Result = std::make_pair(FID, Loc.GetOffset() - GetSLocEntryOffset(FID));
+      break;
+    }
+  }
+
+  // Every entry on the chain expands at the same place.
+  for (const std::pair<FileID, UIntTy> &Walked : Cache.Chain)
+    Cache.ExpansionLocs[Walked.first] = Result;
+  Cache.Chain.clear();
+  return Result;
 }
 
 std::pair<FileID, unsigned>
-SourceManager::GetDecomposedSpellingLocSlow(const SourceLocationEntry *Entry,
-                                            uint32_t Offset) const {
-  FileID FID;
-  SourceLocation Loc;
-  do {
-    Loc = Entry->GetExpansion().GetSpellingLoc();
+SourceManager::GetDecomposedSpellingLocSlow(FileID FID, UIntTy Offset) const {
+  LookupCache &Cache = GetThreadLookupCache();
+  ValidateLookupCache(Cache);
+
+  std::pair<FileID, unsigned> Result;
+  while (true) {
+    // The characters of an expansion are spelled one after the other, the
+    // remembered spelling of its first one is moved by Offset. It has to
+    // stay in the file, otherwise walk the chain for this offset.
+    auto It = Cache.SpellingLocs.find(FID);
+    if (It != Cache.SpellingLocs.end()) {
+      std::pair<UIntTy, UIntTy> Range = GetSLocEntryRange(It->second.first);
+      if (It->second.second + Offset < Range.second - Range.first) {
+        Result = std::make_pair(It->second.first, It->second.second + Offset);
+        break;
+      }
+    }
+
+    Cache.Chain.emplace_back(FID, Offset);
+    SourceLocation Loc = GetSLocEntryByID(FID).GetExpansion().GetSpellingLoc();
     Loc = Loc.GetLocWithOffset(Offset);
-    FID = GetFileID(Loc);
+    FID = GetFileID(Loc, Cache);
+    Offset = Loc.GetOffset() - GetSLocEntryOffset(FID);
+    if (Loc.IsFileID()) {
+      Result = std::make_pair(FID, Offset);
+      break;
+    }
+  }
+
+  // Offsets only grow along the chain, the spelling of the first character
+  // of each walked entry is as far before the result as Offset was.
+  for (const std::pair<FileID, UIntTy> &Walked : Cache.Chain)
+    Cache.SpellingLocs[Walked.first] =
+        std::make_pair(Result.first, Result.second - Walked.second);
+  Cache.Chain.clear();
+  return Result;
+}
+
+void
+SourceManager::DecomposeSortedLocs(const SourceLocation *Locs, size_t N,
+                                   std::pair<FileID, unsigned> *Out,
+                                   bool bSpelling) const {
+  LookupCache &Cache = GetThreadLookupCache();
+
+  // The entry of the previous location and the offsets it spans.
+  FileID FID = InvalidFileID;
+  UIntTy Start = 0;
+  UIntTy End = 0;
+  for (size_t I = 0; I < N; ++I) {
+    assert((!I || Locs[I - 1].GetRawEncoding() <= Locs[I].GetRawEncoding()) &&
+           "Locations are not sorted!");
+    UIntTy SLocOffset = Locs[I].GetOffset();
+    if (SLocOffset - Start >= End - Start) {
+      FID = GetFileIDAfter(FID, SLocOffset, Cache);
+      std::tie(Start, End) = GetSLocEntryRange(FID);
+    }
+
+    unsigned Offset = SLocOffset - Start;
+    if (Locs[I].IsFileID())
+      Out[I] = std::make_pair(FID, Offset);
+    else if (bSpelling)
+      Out[I] = GetDecomposedSpellingLocSlow(FID, Offset);
+    else
+      Out[I] = GetDecomposedExpansionLocSlow(FID);
+  }
+}
+
+FileID
+SourceManager::GetFileIDAfter(FileID Hint, UIntTy SLocOffset,
+                              LookupCache &Cache) const {
+  if (Hint < 0 || SLocOffset >= NextLocalOffset ||
+      SLocOffset < LocalSLocEntryOffsets[Hint])
+    return GetFileID(SourceLocation::GetFileLoc(SLocOffset), Cache);
 
-    Entry = &GetSLocEntryByID(FID);
-    Offset = Loc.GetOffset() - Entry->GetOffset();
-  } while (!Loc.IsFileID());
+  // Offsets[Low] <= SLocOffset < Offsets[High], or High is the end.
+  const UIntTy *Offsets = LocalSLocEntryOffsets.data();
+  unsigned Size = LocalSLocEntryOffsets.size();
+  unsigned Low = Hint;
+  unsigned Step = 1;
+  while (Low + Step < Size && Offsets[Low + Step] <= SLocOffset) {
+    Low += Step;
+    Step *= 2;
+  }
+  unsigned High = std::min(Low + Step, Size);
 
-  return std::make_pair(FID, Offset);
+  return Low + PartitionPoint(Offsets + Low, High - Low,
+                              [SLocOffset](UIntTy Offset) {
+                                return Offset <= SLocOffset;
+                              }) -
+         1;
+}
+
+void
+SourceManager::RestoreCheckpoint(const Checkpoint &C) {
+  assert(C.NumLocalEntries <= LocalSLocEntryRefs.size() &&
+         C.NextLocalOffset <= NextLocalOffset && "Checkpoint from the future!");
+
+  // The infos are in entry order, the first dropped entry of each kind tells
+  // how many of its infos to keep.
+  bool bFoundFile = false;
+  bool bFoundExpansion = false;
+  for (unsigned Index = C.NumLocalEntries; Index < LocalSLocEntryRefs.size();
+       ++Index) {
+    uint32_t Ref = LocalSLocEntryRefs[Index];
+    if (Ref & ExpansionRef) {
+      if (!bFoundExpansion)
+        LocalExpansionInfos.resize(Ref & ~ExpansionRef);
+      bFoundExpansion = true;
+    } else {
+      if (!bFoundFile)
+        LocalFileInfos.resize(Ref);
+      bFoundFile = true;
+    }
+    if (bFoundFile && bFoundExpansion)
+      break;
+  }
+
+  for (auto It = LocalFileIDs.begin(); It != LocalFileIDs.end();) {
+    if (It->second >= static_cast<FileID>(C.NumLocalEntries))
+      It = LocalFileIDs.erase(It);
+    else
+      ++It;
+  }
+
+  LocalSLocEntryRefs.resize(C.NumLocalEntries);
+  LocalSLocEntryOffsets.resize(C.NumLocalEntries);
+  NextLocalOffset = C.NextLocalOffset;
+
+  // The cached FileIDs might have been dropped.
+  StartNewGeneration();
+  if (MainFileID >= static_cast<FileID>(C.NumLocalEntries))
+    MainFileID = 0;
+}
+
+void
+SourceManager::StartNewGeneration() {
+  Generation = NextGeneration.fetch_add(1, std::memory_order_relaxed);
 }
 
 void
 SourceManager::Reset() {
   MainFileID = 0;
-  LastFileIDLookup = 0;
+  StartNewGeneration();
+
+  // Offset 0 is the invalid SourceLocation.
+  NextLocalOffset = 1;
 
-  LoadedSrcLocEntryTable.clear();
-  LocalSrcLocEntryTable.clear();
+  CurrentLoadedOffset = MaxLoadedOffset;
+
+  LoadedSLocEntryRefs.clear();
+  LoadedFileInfos.clear();
+  LoadedExpansionInfos.clear();
+  LoadedSLocEntryOffsets.clear();
+  SLocEntryLoaded.clear();
+  ExternalSLocEntries = nullptr;
+  LocalFileIDs.clear();
+  LoadedFileIDs.clear();
+  LocalSLocEntryRefs.clear();
+  LocalFileInfos.clear();
+  LocalExpansionInfos.clear();
+  LocalSLocEntryOffsets.clear();
+  ContentCachesByHash.clear();
 }
 
 FileContentCache &
 SourceManager::CreateContentCache(std::string &Buf) {
-  FileContentCache *Entry = new FileContentCache();
-  Entry->SetBuffer(Buf);
-  return *Entry;
+  return CreateContentCache(Buf, ContentHash::Compute(Buf.data(), Buf.size()));
 }
 
-FileID
-SourceManager::TranslateFile(const FileEntry *SourceFile) {
-  assert(SourceFile && "Null source file!");
+FileContentCache &
+SourceManager::CreateContentCache(std::string &Buf, const ContentHash &Hash) {
+  ContentCaches.emplace_back(new FileContentCache());
+  FileContentCache *Entry = ContentCaches.back().get();
+  Entry->Owner = this;
+
+  // The first content cache with these contents lends its buffer, which is
+  // then kept in memory. The hash only finds it, a collision must not make
+  // two different files share their contents.
+  FileContentCache *&Existing = ContentCachesByHash[Hash];
+  bool bSameContents =
+      Existing && Existing->GetSize() == Buf.size() &&
+      std::memcmp(Existing->GetBufferStart(), Buf.data(), Buf.size()) == 0;
+  if (bSameContents) {
+    Entry->SetUnownedBuffer(Existing->GetBufferStart(), Existing->GetSize());
+    ++NumSharedBuffers;
+    NumSharedBufferBytes += Buf.size();
 
-  // Look through all the local source locations
-  for (unsigned Index = 0; Index < LocalSrcLocEntryTable.size(); ++Index) {
-    const SourceLocationEntry &Entry = GetLocalSLocEntry(Index);
-    if (Entry.IsFile()) {
-      return Index;
+    std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+    Existing->bBufferLent = true;
+    if (Existing->bInLRU) {
+      ContentCacheLRU.erase(Existing->LRUPosition);
+      Existing->bInLRU = false;
     }
+  } else {
+    Entry->SetBuffer(Buf);
+    if (!Existing)
+      Existing = Entry;
+
+    // Make room for the new buffer before it can be dropped itself.
+    {
+      std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+      ContentCacheBytes += Buf.size();
+    }
+    EvictContentCaches();
+
+    std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+    AddToContentCacheLRU(*Entry);
+  }
+
+  Entry->SetContentHash(Hash);
+  return *Entry;
+}
+
+FileContentCache *
+SourceManager::CreateContentCache(const FileEntry *File,
+                                  FileManager &FileMgr) {
+  FileContentCache *Entry;
+  if (File->IsVirtual()) {
+    ContentCaches.emplace_back(new FileContentCache());
+    Entry = ContentCaches.back().get();
+    Entry->Owner = this;
+    Entry->SetUnownedBuffer(File->GetVirtualData(), File->GetSize());
+  } else {
+    std::string Buf;
+    ContentHash Hash;
+    if (!FileMgr.GetBufferForFile(File, Buf, Hash))
+      return nullptr;
+    Entry = &CreateContentCache(Buf, Hash);
   }
 
-  for (unsigned Index = 0; Index < LoadedSrcLocEntryTable.size(); ++Index) {
-    const SourceLocationEntry &Entry = GetLoadedSLocEntry(Index);
-    if (Entry.IsFile()) {
-      return Index;
+  Entry->SetFileEntry(File);
+  Entry->SetFileName(File->GetRealPathName());
+  return Entry;
+}
+
+void
+SourceManager::SetContentCacheBudget(uint64_t Bytes) {
+  ContentCacheBudget = Bytes;
+  EvictContentCaches();
+}
+
+void
+SourceManager::PinContentCache(const FileContentCache &Content) {
+  if (Content.Owner != this)
+    return;
+
+  {
+    std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+    if (Content.NumPins++ == 0 && Content.bInLRU) {
+      ContentCacheLRU.erase(Content.LRUPosition);
+      Content.bInLRU = false;
+    }
+    if (Content.BufferData.load(std::memory_order_relaxed)) {
+      ++NumContentCacheHits;
+      return;
     }
   }
+
+  Content.GetBufferStart();
+}
+
+void
+SourceManager::UnpinContentCache(const FileContentCache &Content) {
+  if (Content.Owner != this)
+    return;
+
+  {
+    std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+    assert(Content.NumPins && "Content cache is not pinned!");
+    if (--Content.NumPins == 0)
+      AddToContentCacheLRU(Content);
+  }
+  EvictContentCaches();
+}
+
+uint64_t
+SourceManager::GetContentCacheBytes() const {
+  std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+  return ContentCacheBytes;
+}
+
+std::vector<const FileEntry *>
+SourceManager::GetStaleFiles() const {
+  std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+  return StaleFiles;
+}
+
+/* Called with ContentCacheMutex held. */
+void
+SourceManager::AddToContentCacheLRU(const FileContentCache &Content) const {
+  // Borrowed and mapped buffers are not ours to drop, and blanks kept for
+  // a changed file could not be read back.
+  const char *Data = Content.BufferData.load(std::memory_order_relaxed);
+  if (Content.NumPins || Content.bBufferLent || !Content.BufferSize ||
+      Data != Content.OwnedBuffer.data() ||
+      Content.bStale.load(std::memory_order_relaxed))
+    return;
+
+  if (Content.bInLRU)
+    ContentCacheLRU.erase(Content.LRUPosition);
+  Content.LRUPosition =
+      ContentCacheLRU.insert(ContentCacheLRU.end(), &Content);
+  Content.bInLRU = true;
+}
+
+void
+SourceManager::EvictContentCaches() {
+  std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+  while (ContentCacheBytes > ContentCacheBudget && !ContentCacheLRU.empty()) {
+    const FileContentCache *Content = ContentCacheLRU.front();
+    ContentCacheLRU.pop_front();
+    Content->bInLRU = false;
+
+    // Memory buffers cannot be read again, they go back to the list when a
+    // lexer is done with them.
+    if (!Content->OrigEntry || Content->bBufferLent)
+      continue;
+
+    // Identical contents must not borrow the buffer once it is gone.
+    auto It = ContentCachesByHash.find(Content->GetContentHash());
+    if (It != ContentCachesByHash.end() && It->second == Content)
+      ContentCachesByHash.erase(It);
+
+    Content->BufferData.store(nullptr, std::memory_order_relaxed);
+    std::string().swap(Content->OwnedBuffer);
+    ContentCacheBytes -= Content->BufferSize;
+    ++NumContentCacheEvictions;
+  }
+}
+
+const char *
+SourceManager::ReloadContentCache(const FileContentCache &Content) const {
+  std::lock_guard<std::mutex> Lock(ContentCacheMutex);
+
+  // Another reader may have been first.
+  if (const char *Data = Content.BufferData.load(std::memory_order_acquire))
+    return Data;
+
+  std::string Buffer;
+  bool bStale = !FileManager::ReadFile(Content.OrigEntry, Buffer) ||
+                Buffer.size() != Content.BufferSize ||
+                ContentHash::Compute(Buffer.data(), Buffer.size()) !=
+                    Content.GetContentHash();
+  if (bStale) {
+    // The contents we dropped are gone, and tokens, macros and locations
+    // still refer to them. Keep the size so those stay valid, and leave it
+    // to the caller to throw away what was produced.
+    Buffer.assign(Content.BufferSize, ' ');
+    Content.bStale.store(true, std::memory_order_release);
+    StaleFiles.push_back(Content.OrigEntry);
+  }
+
+  Content.OwnedBuffer.swap(Buffer);
+  Content.BufferData.store(Content.OwnedBuffer.data(),
+                           std::memory_order_release);
+  ContentCacheBytes += Content.BufferSize;
+  ++NumContentCacheReloads;
+  AddToContentCacheLRU(Content);
+  return Content.OwnedBuffer.data();
+}
+
+FileID
+SourceManager::TranslateFile(const FileEntry *SourceFile) {
+  assert(SourceFile && "Null source file!");
+
+  auto It = LocalFileIDs.find(SourceFile);
+  if (It != LocalFileIDs.end())
+    return It->second;
+
+  It = LoadedFileIDs.find(SourceFile);
+  return It != LoadedFileIDs.end() ? It->second : InvalidFileID;
 }
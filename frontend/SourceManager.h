@@ -1,12 +1,18 @@
 #ifndef SOURCE_MANAGER_H
 #define SOURCE_MANAGER_H
 
+#include "BitVector.h"
+#include "ContentHash.h"
 #include "File.h"
 #include "Mixins.h"
 
+#include <atomic>
 #include <cassert>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -21,14 +27,28 @@
  *
  * Stores File or macro expansion. The MacroIDBit (reserved) can be used to
  * access the information whether the location is in a file or macro expansion.
+ *
+ * Locations are 32 bits, which limits a translation unit to 2 GB of files and
+ * macro expansions. Build with SOURCE_LOCATION_64 defined for 64-bit
+ * locations, at the cost of larger tokens and SourceLocationEntries.
  */
 class SourceLocation {
   friend class SourceManager;
 
-  uint32_t ID = 0;
+public:
+#ifdef SOURCE_LOCATION_64
+  using UIntTy = uint64_t;
+  using IntTy = int64_t;
+#else
+  using UIntTy = uint32_t;
+  using IntTy = int32_t;
+#endif
+
+private:
+  UIntTy ID = 0;
 
-  // 1 << 31
-  enum : uint32_t { IsMacroBit = 1ULL << (8 * sizeof(uint32_t) - 1) };
+  // 1 << 31, or 1 << 63
+  static constexpr UIntTy IsMacroBit = UIntTy(1) << (8 * sizeof(UIntTy) - 1);
 
 public:
   bool IsFileID() const { return (ID & IsMacroBit) == 0; }
@@ -39,30 +59,56 @@ public:
 
 private:
   /** Get pure offset without the Macro test bit. */
-  uint32_t GetOffset() const { return ID & ~IsMacroBit; }
+  UIntTy GetOffset() const { return ID & ~IsMacroBit; }
 
   /** Creates SourceLocation from ID. */
-  static SourceLocation GetFileLoc(uint32_t ID) {
+  static SourceLocation GetFileLoc(UIntTy ID) {
     SourceLocation L;
     L.ID = ID;
     return L;
   }
 
   /** Creates SourceLoction from ID. Set the MacroIDBit. */
-  static SourceLocation GetMacroLoc(uint32_t ID) {
+  static SourceLocation GetMacroLoc(UIntTy ID) {
     SourceLocation L;
     L.ID = IsMacroBit | ID;
     return L;
   }
 
 public:
+  /** The opaque value of the location, for serialization. */
+  UIntTy GetRawEncoding() const { return ID; }
+
+  /** Turn a value from GetRawEncoding back into a location. */
+  static SourceLocation GetFromRawEncoding(UIntTy Encoding) {
+    SourceLocation L;
+    L.ID = Encoding;
+    return L;
+  }
+
+  /**
+   * The encoding of a 32-bit build, which serialized files use whatever the
+   * width of locations. The offset must fit in 31 bits.
+   */
+  uint32_t GetRawEncoding32() const {
+    assert(GetOffset() < (1U << 31) && "Location does not fit in 32 bits!");
+    return static_cast<uint32_t>(GetOffset()) | (IsMacroID() ? 1U << 31 : 0);
+  }
+
+  /** Turn a value from GetRawEncoding32 back into a location. */
+  static SourceLocation GetFromRawEncoding32(uint32_t Encoding) {
+    SourceLocation L;
+    L.ID = (Encoding & ~(1U << 31)) | (Encoding >> 31 ? IsMacroBit : 0);
+    return L;
+  }
+
   /**
    * Returns a source location with the specified offset from this source
    * location.
    */
-  SourceLocation GetLocWithOffset(int32_t Offset) const {
+  SourceLocation GetLocWithOffset(IntTy Offset) const {
     // make sure the offset doesn't affect the IsMacroBit
-    assert(((ID + Offset) & IsMacroBit) == 0 && "Offset overflow!");
+    assert(((GetOffset() + Offset) & IsMacroBit) == 0 && "Offset overflow!");
     SourceLocation L;
     L.ID = ID + Offset;
     return L;
@@ -76,19 +122,29 @@ typedef int FileID;
  * ========================================================
  */
 
+class FileContentCache;
+class FileManager;
+class SourceManager;
+
 /** Information each corresponding to a FileID. */
 class FileInfo {
   SourceLocation IncludeLocation;
 
+  /** The buffer holding the contents of this file. */
+  const FileContentCache *ContentCache;
+
 public:
   /** Creates a new FileInfo object. */
-  static FileInfo Create(SourceLocation IncludeLoc) {
+  static FileInfo Create(SourceLocation IncludeLoc,
+                         const FileContentCache &Content) {
     FileInfo FI;
     FI.IncludeLocation = IncludeLoc;
+    FI.ContentCache = &Content;
     return FI;
   }
 
   SourceLocation GetIncludeLocation() const { return IncludeLocation; }
+  const FileContentCache *GetContentCache() const { return ContentCache; }
 };
 
 /* ========================================================
@@ -96,16 +152,121 @@ public:
  * ========================================================
  */
 class FileContentCache {
-  std::string Buffer;
+  friend class SourceManager;
+
+  /** Contents read into memory by us, if any. */
+  mutable std::string OwnedBuffer;
+
+  /**
+   * The contents, OwnedBuffer or memory owned by somebody else. Null while
+   * the owning SourceManager has dropped OwnedBuffer to stay in its budget.
+   */
+  mutable std::atomic<const char *> BufferData{""};
+  unsigned BufferSize = 0;
 
   std::string FileName;
 
+  /** The file this buffer was read from, null for memory buffers. */
+  const FileEntry *OrigEntry = nullptr;
+
+  /** Offsets of the start of each line, computed on first use. */
+  mutable std::vector<unsigned> LineOffsets;
+  mutable std::atomic<bool> bLineOffsetsComputed{false};
+
+  /** Hash of the contents, given by the reader or computed on first use. */
+  mutable ContentHash Hash;
+  mutable std::atomic<bool> bHashComputed{false};
+
+  /** Taken to compute the above, readers may ask from several threads. */
+  mutable std::mutex LazyMutex;
+
+  /*=============== Owned by a SourceManager ==========================*/
+  /** The SourceManager that created this and can read it again, if any. */
+  const SourceManager *Owner = nullptr;
+
+  /** Number of lexers reading the buffer, which cannot be dropped. */
+  mutable unsigned NumPins = 0;
+
+  /** True if other content caches share the buffer. */
+  mutable bool bBufferLent = false;
+
+  /** Position in the list of buffers that may be dropped, if in it. */
+  mutable std::list<const FileContentCache *>::iterator LRUPosition;
+  mutable bool bInLRU = false;
+
+  /** True if the file changed after the buffer was dropped. */
+  mutable std::atomic<bool> bStale{false};
+
 public:
   std::string GetFileName() const { return FileName; }
+  void SetFileName(const std::string &Name) { FileName = Name; }
+
+  const FileEntry *GetFileEntry() const { return OrigEntry; }
+  void SetFileEntry(const FileEntry *Entry) { OrigEntry = Entry; }
+
+  unsigned GetSize() const { return BufferSize; }
+
+  /**
+   * True if the buffer was dropped and the file had changed when it was read
+   * again. The buffer then holds blanks in place of the lost contents.
+   */
+  bool IsStale() const { return bStale.load(std::memory_order_acquire); }
+
+  /**
+   * The buffer is always null terminated at GetBufferEnd(). A buffer that was
+   * dropped is read again from its file first.
+   */
+  const char *GetBufferStart() const {
+    const char *Data = BufferData.load(std::memory_order_acquire);
+    return Data ? Data : ReloadBuffer();
+  }
+  const char *GetBufferEnd() const { return GetBufferStart() + BufferSize; }
+
+  void SetBuffer(std::string &InBuffer) {
+    OwnedBuffer = InBuffer;
+    BufferData = OwnedBuffer.data();
+    BufferSize = OwnedBuffer.size();
+    bHashComputed = false;
+  }
 
-  unsigned GetSize() const { return Buffer.size(); }
+  /**
+   * Use memory owned by somebody else, e.g. a mapped file, as the contents.
+   * Data[Size] must be a null character, and the memory must outlive this.
+   */
+  void SetUnownedBuffer(const char *Data, unsigned Size) {
+    assert(Data[Size] == '\0' && "Buffer is not null terminated!");
+    OwnedBuffer.clear();
+    BufferData = Data;
+    BufferSize = Size;
+    bHashComputed = false;
+  }
+
+  /** Hash of the contents, the key of caches derived from them. */
+  const ContentHash &GetContentHash() const {
+    if (!bHashComputed.load(std::memory_order_acquire))
+      ComputeContentHash();
+    return Hash;
+  }
+
+  /** Use InHash, computed by whoever read the contents, as the hash. */
+  void SetContentHash(const ContentHash &InHash) {
+    Hash = InHash;
+    bHashComputed.store(true, std::memory_order_release);
+  }
+
+  /** Offsets of the first character of every line, LineOffsets[0] is 0. */
+  const std::vector<unsigned> &GetLineOffsets() const {
+    if (!bLineOffsetsComputed.load(std::memory_order_acquire))
+      ComputeLineOffsets();
+    return LineOffsets;
+  }
 
-  void SetBuffer(std::string &InBuffer) { Buffer = InBuffer; }
+private:
+  void ComputeContentHash() const;
+  void ComputeLineOffsets() const;
+
+  /** Have the owner read the dropped buffer again. */
+  const char *ReloadBuffer() const;
 };
 
 /* ========================================================
@@ -148,13 +309,17 @@ public:
  */
 
 /**
- * 31 bits Offset.
+ * 31 bits Offset, 63 with SOURCE_LOCATION_64.
  * 1 Bit Exansion.
+ *
+ * Handed out by value; the SourceManager stores the parts separately.
  */
 class SourceLocationEntry {
-  static constexpr int OffsetBits = 8 * sizeof(uint32_t) - 1;
-  uint32_t Offset : OffsetBits;
-  uint32_t bIsExpansion : 1;
+  using UIntTy = SourceLocation::UIntTy;
+
+  static constexpr int OffsetBits = 8 * sizeof(UIntTy) - 1;
+  UIntTy Offset : OffsetBits;
+  UIntTy bIsExpansion : 1;
   union {
     FileInfo File;
     ExpansionInfo Expansion;
@@ -168,8 +333,8 @@ public:
 
 public:
   /** Creates a FileInfo type SourceLocationEntry. */
-  static SourceLocationEntry Create(uint32_t InOffset, const FileInfo &FI) {
-    assert(!(InOffset & (1 << OffsetBits)) && "Offset size overflow!");
+  static SourceLocationEntry Create(UIntTy InOffset, const FileInfo &FI) {
+    assert(!(InOffset >> OffsetBits) && "Offset size overflow!");
     SourceLocationEntry Entry;
     Entry.Offset = InOffset;
     Entry.File = FI;
@@ -178,9 +343,8 @@ public:
   }
 
   /** Creates a ExapansionInfo type SourceLocationEntry. */
-  static SourceLocationEntry Create(uint32_t InOffset,
-                                    const ExpansionInfo &EI) {
-    assert(!(InOffset & (1 << OffsetBits)) && "Offset size overflow!");
+  static SourceLocationEntry Create(UIntTy InOffset, const ExpansionInfo &EI) {
+    assert(!(InOffset >> OffsetBits) && "Offset size overflow!");
     SourceLocationEntry Entry;
     Entry.Offset = InOffset;
     Entry.Expansion = EI;
@@ -189,7 +353,7 @@ public:
   }
 
 public:
-  uint32_t GetOffset() const { return Offset; }
+  UIntTy GetOffset() const { return Offset; }
 
   bool IsExpansion() const { return bIsExpansion; }
   bool IsFile() const { return !IsExpansion(); }
@@ -200,80 +364,300 @@ public:
   }
 
   const ExpansionInfo &GetExpansion() const {
-    assert(IsFile() && "Not a macro expansion SourceLocationEntry!");
+    assert(IsExpansion() && "Not a macro expansion SourceLocationEntry!");
     return Expansion;
   }
 };
 
+/* ========================================================
+ *  ExternalSLocEntrySource
+ * ========================================================
+ */
+
+/**
+ * Provider of loaded SourceLocationEntries. A serialized file only reserves
+ * its entries up front; they are read from it when they are first used.
+ */
+class ExternalSLocEntrySource {
+public:
+  virtual ~ExternalSLocEntrySource() = default;
+
+  /**
+   * Fill in the loaded entry ID with CreateFileID or CreateLoadedExpansion.
+   * Returns false if the entry cannot be read.
+   */
+  virtual bool ReadSLocEntry(int ID) = 0;
+};
+
 /* ========================================================
  *  SourceManager
  * ========================================================
  */
 
+/**
+ * SourceLocationEntries are not stored as such. Every entry is a starting
+ * offset in a dense array searched by GetFileID, and a reference to its
+ * FileInfo or ExpansionInfo, each kind in a table of its own; expansions far
+ * outnumber files and do not pay for the larger FileInfo. Entries are put
+ * back together by value when asked for.
+ */
 class SourceManager : private NonCopyable<SourceManager> {
-  using SourceLocationEntryTable = std::vector<SourceLocationEntry>;
+  using UIntTy = SourceLocation::UIntTy;
+
+  /** Set in a reference to an ExpansionInfo, clear for a FileInfo. */
+  static constexpr uint32_t ExpansionRef = 1U << 31;
+
+  /**
+   * Entries that are local to this module: the index of the info of every
+   * entry, or'ed with ExpansionRef for expansions, and the infos in the
+   * order the entries were created.
+   */
+  std::vector<uint32_t> LocalSLocEntryRefs;
+  std::vector<FileInfo> LocalFileInfos;
+  std::vector<ExpansionInfo> LocalExpansionInfos;
+
+  /**
+   * Starting offset of every local entry, increasing with the index. Kept
+   * apart from the entries so that GetFileID searches a dense array.
+   */
+  std::vector<UIntTy> LocalSLocEntryOffsets;
+
+  /**
+   * Entries that were loaded from other modules, as above. References and
+   * infos are filled in on first use, see GetLoadedSLocEntry; the info
+   * tables have room reserved for every loaded entry, so that adding to them
+   * never moves the infos under concurrent readers.
+   */
+  mutable std::vector<uint32_t> LoadedSLocEntryRefs;
+  mutable std::vector<FileInfo> LoadedFileInfos;
+  mutable std::vector<ExpansionInfo> LoadedExpansionInfos;
 
-  /** Table of SourceLocationEntries that are local to this module. */
-  SourceLocationEntryTable LocalSrcLocEntryTable;
+  /**
+   * Starting offset of every loaded entry, known before the entries are
+   * loaded. Decreasing with the index.
+   */
+  std::vector<UIntTy> LoadedSLocEntryOffsets;
 
-  /** Table of SourceLocationEntries that were loaded from other modules. */
-  SourceLocationEntryTable LoadedSrcLocEntryTable;
+  /** Bit N is set if loaded entry N has been read from the external source. */
+  mutable BitVector SLocEntryLoaded;
 
-  // TODO: replace with a bit vector for better effeciency
-  /** A Boolean vector that indicates whether the entries of
-   * LoadedSLocEntryTable have already been loaded from external source. */
-  std::vector<bool> SLocEntryLoaded;
+  /** Where the loaded entries come from, or null. */
+  ExternalSLocEntrySource *ExternalSLocEntries = nullptr;
+
+  /**
+   * The first local and the first loaded file entry of every FileEntry, see
+   * TranslateFile. Loaded entries are indexed by their source up front,
+   * see SetLoadedFileID, without being read.
+   */
+  std::unordered_map<const FileEntry *, FileID> LocalFileIDs;
+  std::unordered_map<const FileEntry *, FileID> LoadedFileIDs;
 
   /** The starting offset of the next local SourceLocationEntry. */
-  uint32_t NextLocalOffset;
+  UIntTy NextLocalOffset;
 
   /** The starting offset of the next loaded SourceLocationEntry. */
-  uint32_t CurrentLoadedOffset;
+  UIntTy CurrentLoadedOffset;
+
+  /** Loaded offsets grow down from here, one past the largest offset. */
+  static constexpr UIntTy MaxLoadedOffset = SourceLocation::IsMacroBit;
 
   /**
-   * Single-entry cache to speed up GetFileID. On cache miss fallback to
-   * GetFileID_CM method.
-   *
-   * One entry cache. Store the last FileID looked up, or created.
+   * Changes whenever entries are dropped, invalidating the ranges held by
+   * LookupCaches. Unique across SourceManagers, so a cache used with several
+   * of them never mixes them up.
    */
-  mutable FileID LastFileIDLookup;
+  uint64_t Generation = 0;
+
+  /** Taken to read loaded entries from the external source. */
+  mutable std::mutex LoadMutex;
 
   /** The File ID for the main source file of the translation unit.  */
   FileID MainFileID;
 
+  /**
+   * Content caches by the hash of their contents. Files with the same
+   * contents, e.g. copies of a header, share the buffer of the first one.
+   */
+  std::unordered_map<ContentHash, FileContentCache *, ContentHashHasher>
+      ContentCachesByHash;
+
+  /** Every content cache created by CreateContentCache. */
+  std::vector<std::unique_ptr<FileContentCache>> ContentCaches;
+
+  /**
+   * Buffers no lexer reads, least recently used first. Once the buffers
+   * take more than ContentCacheBudget bytes, those that can be read again
+   * from their file are dropped from the front.
+   */
+  mutable std::list<const FileContentCache *> ContentCacheLRU;
+  mutable uint64_t ContentCacheBytes = 0;
+  uint64_t ContentCacheBudget = UINT64_MAX;
+
+  /** Taken to drop or read back buffers, readers may reload them. */
+  mutable std::mutex ContentCacheMutex;
+
+  /** Files that changed after their buffer was dropped, see IsStale. */
+  mutable std::vector<const FileEntry *> StaleFiles;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumSharedBuffers = 0;
+  uint64_t NumSharedBufferBytes = 0;
+  mutable std::atomic<unsigned> NumFileIDLookupMisses{0};
+  unsigned NumContentCacheHits = 0;
+  unsigned NumContentCacheEvictions = 0;
+  mutable std::atomic<unsigned> NumContentCacheReloads{0};
+
 public:
+  /**
+   * The last few entries found by GetFileID, with the offsets they span,
+   * replaced round robin. Locations tend to come from a handful of files and
+   * expansions at a time.
+   *
+   * The cache lives outside the SourceManager, so that the const queries do
+   * not write to it: once the entries are created, any number of threads can
+   * query the same SourceManager without locks. Every thread gets a cache of
+   * its own, see GetThreadLookupCache, and a query can bring its own as well.
+   */
+  class LookupCache {
+    friend class SourceManager;
+
+    struct Entry {
+      UIntTy Start = 0;
+      UIntTy Size = 0;
+      FileID FID = 0;
+    };
+
+    static constexpr unsigned NumEntries = 4;
+    Entry Entries[NumEntries];
+    unsigned NextEntry = 0;
+
+    /**
+     * Where the chains of expansion entries walked so far end up: the file
+     * location of the expansion, and the file location that the first
+     * character of the entry is spelled at. Every entry on a walked chain is
+     * added, so later walks stop at the first entry seen before.
+     */
+    std::unordered_map<FileID, std::pair<FileID, unsigned>> ExpansionLocs;
+    std::unordered_map<FileID, std::pair<FileID, unsigned>> SpellingLocs;
+
+    /** The entries on the chain being walked, with offsets into them. */
+    std::vector<std::pair<FileID, UIntTy>> Chain;
+
+    /** SourceManager::Generation the entries belong to. */
+    uint64_t Generation = 0;
+  };
+
   SourceManager(bool _Dummy);
   ~SourceManager();
 
+  /**
+   * Create a new FileID for File included at IncludePos. If LoadedID is
+   * negative, it fills in the loaded entry LoadedID starting at LoadedOffset,
+   * out of a range from AllocateLoadedSLocEntries, instead of a local one.
+   */
   FileID CreateFileID(FileContentCache &File, SourceLocation IncludePos,
-                      int LoadedID);
+                      int LoadedID = 0, UIntTy LoadedOffset = 0);
+
+  /**
+   * Create a local entry for a macro expansion from ExpansionLocStart to
+   * ExpansionLocEnd, whose Length characters are spelled at SpellingLoc.
+   * Returns the location of its first character; the character at offset I
+   * of the spelling is at that location plus I.
+   */
+  SourceLocation CreateExpansionLoc(SourceLocation SpellingLoc,
+                                    SourceLocation ExpansionLocStart,
+                                    SourceLocation ExpansionLocEnd,
+                                    unsigned Length);
+
+  /**
+   * Fill in the loaded entry LoadedID, see CreateFileID, with a macro
+   * expansion.
+   */
+  void CreateLoadedExpansion(const ExpansionInfo &Info, int LoadedID,
+                             UIntTy LoadedOffset);
+
+  /**
+   * Reserve NumEntries loaded entries spanning TotalSize offsets, for a
+   * serialized file. Returns the FileID of the first entry and its offset;
+   * entry I of the file gets FileID BaseID + I and its offsets are relative
+   * to the returned one. Loaded offsets are allocated from the top of the
+   * offset space down.
+   */
+  std::pair<int, UIntTy> AllocateLoadedSLocEntries(unsigned NumEntries,
+                                                   UIntTy TotalSize);
+
+  /**
+   * Record the starting offset of the loaded entry LoadedID ahead of loading
+   * it. Every allocated entry needs one before locations are looked up.
+   */
+  void SetLoadedSLocEntryOffset(int LoadedID, UIntTy LoadedOffset) {
+    assert(LoadedID < -1 && "Not a loaded FileID!");
+    unsigned Index = unsigned(-LoadedID) - 2;
+    assert(Index < LoadedSLocEntryOffsets.size() && "FileID out of range");
+    LoadedSLocEntryOffsets[Index] = LoadedOffset;
+  }
+
+  /**
+   * Record that the loaded entry LoadedID, not read yet, is the first
+   * inclusion of File, for TranslateFile.
+   */
+  void SetLoadedFileID(const FileEntry *File, int LoadedID) {
+    assert(LoadedID < -1 && "Not a loaded FileID!");
+    auto Inserted = LoadedFileIDs.emplace(File, LoadedID);
+    if (!Inserted.second && Inserted.first->second < LoadedID)
+      Inserted.first->second = LoadedID;
+  }
+
+  /** Read loaded entries from Source when they are first used. */
+  void SetExternalSLocEntrySource(ExternalSLocEntrySource *Source) {
+    ExternalSLocEntries = Source;
+  }
+
+  unsigned GetNumLocalSLocEntries() const {
+    return LocalSLocEntryRefs.size();
+  }
+
+  /** Number of loaded entries, and how many of them have been read. */
+  unsigned GetNumLoadedSLocEntries() const {
+    return LoadedSLocEntryRefs.size();
+  }
+  unsigned GetNumReadLoadedSLocEntries() const {
+    return SLocEntryLoaded.Count();
+  }
 
   std::string GetFilename(SourceLocation Location) const;
-  const char *GetCharacterData(SourceLocation SL);
+  const char *GetCharacterData(SourceLocation SL) const;
 
   FileID GetFileID(SourceLocation Loc) const {
-    // fast path; look up single-entry cache
-    unsigned SourceLocOffset = Loc.GetOffset();
+    return GetFileID(Loc, GetThreadLookupCache());
+  }
 
-    if (IsOffsetInFileID(LastFileIDLookup, SourceLocOffset)) {
-      uint32_t SourceLocOffset = Loc.GetOffset();
-      return 0;
-    }
+  /** Same as above, remembering the entries found in Cache. */
+  FileID GetFileID(SourceLocation Loc, LookupCache &Cache) const {
+    // fast path; look up the recently used entries
+    UIntTy SLocOffset = Loc.GetOffset();
+    if (Cache.Generation == Generation)
+      for (const LookupCache::Entry &Recent : Cache.Entries)
+        if (SLocOffset - Recent.Start < Recent.Size)
+          return Recent.FID;
+
+    return GetFileID_CM(SLocOffset, Cache);
+  }
 
-    return GetFileID_CM(SourceLocOffset);
+  /** The LookupCache of the calling thread. */
+  static LookupCache &GetThreadLookupCache() {
+    static thread_local LookupCache Cache;
+    return Cache;
   }
 
   /** Form source location from a FileID and Offset pair. */
   SourceLocation GetComposedLoc(FileID FID, unsigned Offset) {
-    auto *Entry = GetSLocEntryOrNull(FID);
-    if (!Entry) {
-      return SourceLocation();
-    }
+    SourceLocationEntry Entry = GetSLocEntryByID(FID);
 
     // FileID offset + Offset of loc
-    uint32_t GlobalOffset = Entry->GetOffset() + Offset;
-    return Entry->IsFile() ? SourceLocation::GetFileLoc(GlobalOffset)
-                           : SourceLocation::GetMacroLoc(GlobalOffset);
+    UIntTy GlobalOffset = Entry.GetOffset() + Offset;
+    return Entry.IsFile() ? SourceLocation::GetFileLoc(GlobalOffset)
+                          : SourceLocation::GetMacroLoc(GlobalOffset);
   }
 
   /**
@@ -284,37 +668,47 @@ public:
    */
   std::pair<FileID, unsigned> GetDecomposedLoc(SourceLocation Loc) const {
     FileID FID = GetFileID(Loc);
-    auto *Entry = GetSLocEntryOrNull(FID);
-    if (!Entry) {
-      return std::make_pair(0, 0);
-    }
-    return std::make_pair(FID, Loc.GetOffset() - Entry->GetOffset());
+    return std::make_pair(FID, Loc.GetOffset() - GetSLocEntryOffset(FID));
   }
 
   std::pair<FileID, unsigned>
   GetDecomposedExpansionLoc(SourceLocation Loc) const {
     FileID FileIndex = GetFileID(Loc);
-    auto *Entry = GetSLocEntryOrNull(FileIndex);
-    if (!Entry) {
-      return std::make_pair(0, 0);
-    }
-
-    unsigned Offset = Loc.GetOffset() - Entry->GetOffset();
+    unsigned Offset = Loc.GetOffset() - GetSLocEntryOffset(FileIndex);
     return Loc.IsFileID() ? std::make_pair(FileIndex, Offset)
-                          : GetDecomposedExpansionLocSlow(Entry);
+                          : GetDecomposedExpansionLocSlow(FileIndex);
   }
 
   std::pair<FileID, unsigned>
   GetDecomposedSpellingLoc(SourceLocation Loc) const {
     FileID FID = GetFileID(Loc);
-    auto *Entry = GetSLocEntryOrNull(FID);
-    if (!Entry) {
-      return std::make_pair(0, 0);
-    }
-
-    unsigned Offset = Loc.GetOffset() - Entry->GetOffset();
+    unsigned Offset = Loc.GetOffset() - GetSLocEntryOffset(FID);
     return Loc.IsFileID() ? std::make_pair(FID, Offset)
-                          : GetDecomposedSpellingLocSlow(Entry, Offset);
+                          : GetDecomposedSpellingLocSlow(FID, Offset);
+  }
+
+  /**
+   * GetDecomposedSpellingLoc and GetDecomposedExpansionLoc of the N
+   * locations at Locs into Out, in a single pass. The locations must be
+   * sorted by GetRawEncoding; each is looked up from the entry of the one
+   * before instead of searching all the entries.
+   */
+  void GetDecomposedSpellingLocs(const SourceLocation *Locs, size_t N,
+                                 std::pair<FileID, unsigned> *Out) const {
+    DecomposeSortedLocs(Locs, N, Out, /*bSpelling=*/true);
+  }
+  void GetDecomposedExpansionLocs(const SourceLocation *Locs, size_t N,
+                                  std::pair<FileID, unsigned> *Out) const {
+    DecomposeSortedLocs(Locs, N, Out, /*bSpelling=*/false);
+  }
+
+  /** Returns the 1-based line number of Offset in the file FID. */
+  unsigned GetLineNumber(FileID FID, unsigned Offset) const;
+
+  /** Returns the 1-based column number of Offset in the file FID. */
+  unsigned GetColumnNumber(FileID FID, unsigned Offset) const {
+    unsigned Line = GetLineNumber(FID, Offset);
+    return Offset - GetContentCache(FID).GetLineOffsets()[Line - 1] + 1;
   }
 
   /**
@@ -325,63 +719,247 @@ public:
     return GetDecomposedLoc(Loc).second;
   }
 
-  bool IsOffsetInFileID(SourceLocation Loc, FileID FID) { return false; }
+  bool IsOffsetInFileID(SourceLocation Loc, FileID FID) const {
+    return IsOffsetInFileID(FID, Loc.GetOffset());
+  }
 
   /** Returns true if the specified FileID contains the specifier offset. */
-  inline bool IsOffsetInFileID(FileID FID, uint32_t Offset) const {
-    return false;
+  inline bool IsOffsetInFileID(FileID FID, UIntTy Offset) const {
+    std::pair<UIntTy, UIntTy> Range = GetSLocEntryRange(FID);
+    return Offset >= Range.first && Offset < Range.second;
   }
 
-  const SourceLocationEntry &GetSLocEntryByID(int ID) const {
+  /**
+   * The offsets [Start, End) spanned by the entry FID, up to the start of
+   * the next one. Only needs the offsets, loaded entries are not read.
+   */
+  std::pair<UIntTy, UIntTy> GetSLocEntryRange(FileID FID) const {
+    if (FID < 0) {
+      unsigned Index = unsigned(-FID) - 2;
+      assert(Index < LoadedSLocEntryOffsets.size() && "Invalid FileID");
+      return std::make_pair(LoadedSLocEntryOffsets[Index],
+                            Index ? LoadedSLocEntryOffsets[Index - 1]
+                                  : MaxLoadedOffset);
+    }
+
+    unsigned Index = FID;
+    assert(Index < LocalSLocEntryOffsets.size() && "Invalid FileID");
+    return std::make_pair(LocalSLocEntryOffsets[Index],
+                          Index + 1 < LocalSLocEntryOffsets.size()
+                              ? LocalSLocEntryOffsets[Index + 1]
+                              : NextLocalOffset);
+  }
+
+  SourceLocationEntry GetSLocEntryByID(int ID) const {
     // Load either form loaded or local entry table
     if (ID < 0)
       return GetLoadedSLocEntry(static_cast<unsigned>(-ID - 2));
     return GetLocalSLocEntry(static_cast<unsigned>(ID));
   }
 
-  const SourceLocationEntry &GetLoadedSLocEntry(int Index) const {
-    assert(Index < LoadedSrcLocEntryTable.size() && "Invalid Index");
-    // TODO: check whether the entry has been loaded else load it
-    // if (SLocEntryLoaded[Index]) {
-    // }
-    return LoadedSrcLocEntryTable[Index];
-    // else load the SLocEntry
+  SourceLocationEntry GetLoadedSLocEntry(unsigned Index) const {
+    assert(Index < LoadedSLocEntryRefs.size() && "Invalid Index");
+    if (!SLocEntryLoaded.TestAcquire(Index))
+      LoadSLocEntry(Index);
+    uint32_t Ref = LoadedSLocEntryRefs[Index];
+    UIntTy Offset = LoadedSLocEntryOffsets[Index];
+    return Ref & ExpansionRef
+               ? SourceLocationEntry::Create(
+                     Offset, LoadedExpansionInfos[Ref & ~ExpansionRef])
+               : SourceLocationEntry::Create(Offset, LoadedFileInfos[Ref]);
   }
 
-  const SourceLocationEntry &GetLocalSLocEntry(int Index) const {
-    assert(Index < LocalSrcLocEntryTable.size() && "Invalid Index");
-    return LocalSrcLocEntryTable[Index];
+  SourceLocationEntry GetLocalSLocEntry(unsigned Index) const {
+    assert(Index < LocalSLocEntryRefs.size() && "Invalid Index");
+    uint32_t Ref = LocalSLocEntryRefs[Index];
+    UIntTy Offset = LocalSLocEntryOffsets[Index];
+    return Ref & ExpansionRef
+               ? SourceLocationEntry::Create(
+                     Offset, LocalExpansionInfos[Ref & ~ExpansionRef])
+               : SourceLocationEntry::Create(Offset, LocalFileInfos[Ref]);
   }
 
-  const SourceLocationEntry *GetSLocEntryOrNull(FileID FID) const {
-    return &GetSLocEntryByID(FID);
+  /** The starting offset of the entry FID, without reading the entry. */
+  UIntTy GetSLocEntryOffset(FileID FID) const {
+    return FID < 0 ? LoadedSLocEntryOffsets[unsigned(-FID) - 2]
+                   : LocalSLocEntryOffsets[FID];
   }
 
+  /**
+   * Read the loaded entry Index from the external source. Only one thread
+   * reads at a time.
+   */
+  void LoadSLocEntry(unsigned Index) const;
+
   /** Fallback path in case GetFileID cache miss. */
-  FileID GetFileID_CM(uint32_t SLocOffset) const;
-  FileID GetFileID_CM_Local(uint32_t SLocOffset) const;
-  FileID GetFileID_CM_Loaded(uint32_t SLocOffset) const;
+  FileID GetFileID_CM(UIntTy SLocOffset, LookupCache &Cache) const;
+  FileID GetFileID_CM_Local(UIntTy SLocOffset) const;
+  FileID GetFileID_CM_Loaded(UIntTy SLocOffset) const;
+
+  /** Empty Cache if it holds entries of another generation. */
+  void ValidateLookupCache(LookupCache &Cache) const {
+    if (Cache.Generation != Generation) {
+      Cache = LookupCache();
+      Cache.Generation = Generation;
+    }
+  }
 
-  std::pair<FileID, unsigned>
-  GetDecomposedExpansionLocSlow(const SourceLocationEntry *Entry) const;
+  /** Add FID to the entries of Cache checked first by GetFileID. */
+  void RememberFileID(FileID FID, LookupCache &Cache) const {
+    ValidateLookupCache(Cache);
 
-  std::pair<FileID, unsigned>
-  GetDecomposedSpellingLocSlow(const SourceLocationEntry *Entry,
-                               uint32_t Offset) const;
+    std::pair<UIntTy, UIntTy> Range = GetSLocEntryRange(FID);
+    LookupCache::Entry &Recent = Cache.Entries[Cache.NextEntry];
+    Recent.Start = Range.first;
+    Recent.Size = Range.second - Range.first;
+    Recent.FID = FID;
+    Cache.NextEntry = (Cache.NextEntry + 1) % LookupCache::NumEntries;
+  }
+
+  /** Invalidate every LookupCache, after entries were dropped. */
+  void StartNewGeneration();
+
+  /** Read the dropped buffer of Content from its file again. */
+  const char *ReloadContentCache(const FileContentCache &Content) const;
+
+  /** Make Content, which no lexer reads, the most recently used buffer. */
+  void AddToContentCacheLRU(const FileContentCache &Content) const;
+
+  /** Drop the least recently used buffers until the budget is met. */
+  void EvictContentCaches();
+
+  /**
+   * Record the offset of the loaded entry Index, unless
+   * SetLoadedSLocEntryOffset did already: other threads may be searching the
+   * offsets while the entry is read.
+   */
+  void SetLoadedOffsetIfUnset(unsigned Index, UIntTy LoadedOffset) {
+    if (LoadedSLocEntryOffsets[Index] != LoadedOffset)
+      LoadedSLocEntryOffsets[Index] = LoadedOffset;
+  }
+
+  /**
+   * Follow the chain of expansion entries from the expansion FID to a file,
+   * remembering where it ends in the LookupCache of the thread.
+   */
+  std::pair<FileID, unsigned> GetDecomposedExpansionLocSlow(FileID FID) const;
+
+  std::pair<FileID, unsigned> GetDecomposedSpellingLocSlow(FileID FID,
+                                                           UIntTy Offset) const;
+
+  void DecomposeSortedLocs(const SourceLocation *Locs, size_t N,
+                           std::pair<FileID, unsigned> *Out,
+                           bool bSpelling) const;
+
+  /**
+   * GetFileID for SLocOffset, which comes at or after the start of Hint.
+   * Local entries are searched forward from Hint with steps that double.
+   */
+  FileID GetFileIDAfter(FileID Hint, UIntTy SLocOffset,
+                        LookupCache &Cache) const;
+
+  /** Returns the buffer of the file entry identified by FID. */
+  const FileContentCache &GetContentCache(FileID FID) const {
+    const FileContentCache *Content =
+        GetSLocEntryByID(FID).GetFile().GetContentCache();
+    assert(Content && "FileID has no content!");
+    return *Content;
+  }
 
   FileID GetMainFileID() const { return MainFileID; }
   void SetMainFileID(FileID FID) { MainFileID = FID; }
 
+  /**
+   * Create a content cache holding Buf. If a buffer with the same contents
+   * exists, it is shared instead of keeping another copy.
+   */
   FileContentCache &CreateContentCache(std::string &Buf);
 
+  /** Same as above, with Hash computed by the reader of Buf. */
+  FileContentCache &CreateContentCache(std::string &Buf,
+                                       const ContentHash &Hash);
+
   /**
-   * Given a source file return the FileID for it.
+   * Create a content cache holding the contents of File, or return null if
+   * it cannot be read. In-memory files, see FileManager::AddVirtualFile, are
+   * used in place without a copy.
+   */
+  FileContentCache *CreateContentCache(const FileEntry *File,
+                                       FileManager &FileMgr);
+
+  /** Number of content caches that share the buffer of an earlier one. */
+  unsigned GetNumSharedBuffers() const { return NumSharedBuffers; }
+  uint64_t GetNumSharedBufferBytes() const { return NumSharedBufferBytes; }
+
+  /**
+   * Keep the buffers of the content caches within Bytes, dropping those no
+   * lexer reads in least recently used order. A dropped buffer is read from
+   * its file again when it is next needed. If the file changed meanwhile,
+   * the buffer is filled with blanks so that locations into it stay valid,
+   * and the file is reported by GetStaleFiles; whatever was produced from
+   * it is wrong and the caller decides what to do. Memory buffers, and
+   * buffers that other content caches share, are never dropped.
+   *
+   * Pointers into buffers that are not pinned stay valid until the next
+   * call to CreateContentCache, UnpinContentCache or this.
+   */
+  void SetContentCacheBudget(uint64_t Bytes);
+
+  /**
+   * Keep the buffer of Content while a lexer reads it, reading it again if
+   * it was dropped. Every pin is undone by UnpinContentCache.
+   */
+  void PinContentCache(const FileContentCache &Content);
+  void UnpinContentCache(const FileContentCache &Content);
+
+  /** Bytes taken by the buffers of the content caches. */
+  uint64_t GetContentCacheBytes() const;
+
+  /** Files whose dropped buffer could not be read back unchanged. */
+  std::vector<const FileEntry *> GetStaleFiles() const;
+
+  /** Number of pins that found the buffer in memory. */
+  unsigned GetNumContentCacheHits() const { return NumContentCacheHits; }
+  unsigned GetNumContentCacheEvictions() const {
+    return NumContentCacheEvictions;
+  }
+  unsigned GetNumContentCacheReloads() const { return NumContentCacheReloads; }
+
+  /** Number of GetFileID calls that had to search the offsets. */
+  unsigned GetNumFileIDLookupMisses() const { return NumFileIDLookupMisses; }
+
+  /** Not the FileID of any entry. */
+  static constexpr FileID InvalidFileID = -1;
+
+  /**
+   * Given a source file return the FileID for it, or InvalidFileID if it was
+   * never entered.
    *
    * If the source file is included multiple times, the FileID will be the first
-   * inclusion.
+   * inclusion. Local entries are preferred over loaded ones.
    */
   FileID TranslateFile(const FileEntry *SourceFile);
 
+  /**
+   * A point in the lifetime of the SourceManager. Local entries are only
+   * ever appended, so their number and the next offset identify the state.
+   */
+  struct Checkpoint {
+    unsigned NumLocalEntries;
+    UIntTy NextLocalOffset;
+  };
+
+  Checkpoint TakeCheckpoint() const {
+    return {static_cast<unsigned>(LocalSLocEntryRefs.size()),
+            NextLocalOffset};
+  }
+
+  /**
+   * Drop all the local entries created after C was taken. FileIDs and
+   * SourceLocations handed out afterwards are reused.
+   */
+  void RestoreCheckpoint(const Checkpoint &C);
+
   void Reset();
 };
 
@@ -0,0 +1,85 @@
+#include "StreamFingerprint.h"
+
+#include <cstring>
+
+/**
+ * Markers in the flags byte of location records. Token records only have
+ * StartOfLine and LeadingSpace there, so they never match.
+ */
+static constexpr char FileChangeMarker = '\xff';
+static constexpr char LineMarker = '\xfe';
+
+void
+StreamFingerprint::AddToken(TokenKind Kind, uint16_t Flags,
+                            const char *Spelling, unsigned Length) {
+  ++NumTokens;
+
+  // Only the spacing that shows in the output counts.
+  char Record[2 + sizeof(uint32_t)];
+  Record[0] = static_cast<char>(Kind);
+  Record[1] =
+      static_cast<char>(Flags & (Token::StartOfLine | Token::LeadingSpace));
+  uint32_t Length32 = Length;
+  std::memcpy(Record + 2, &Length32, sizeof(Length32));
+  Append(Record, Spelling, Length);
+}
+
+void
+StreamFingerprint::AddFileChange(const std::string &Name, unsigned Line) {
+  char Record[2 + sizeof(uint32_t)];
+  Record[0] = 0;
+  Record[1] = FileChangeMarker;
+  uint32_t Length32 = Name.size();
+  std::memcpy(Record + 2, &Length32, sizeof(Length32));
+  Append(Record, Name.data(), Name.size());
+  AddLine(Line);
+}
+
+void
+StreamFingerprint::AddLine(unsigned Line) {
+  char Record[2 + sizeof(uint32_t)];
+  Record[0] = 0;
+  Record[1] = LineMarker;
+  uint32_t Line32 = Line;
+  std::memcpy(Record + 2, &Line32, sizeof(Line32));
+  Append(Record, nullptr, 0);
+}
+
+void
+StreamFingerprint::Append(const char (&Record)[2 + sizeof(uint32_t)],
+                          const char *Data, unsigned Length) {
+  if (Chunk.size() + sizeof(Record) + Length > ChunkSize) {
+    State = Combine(State, Chunk.data(), Chunk.size());
+    Chunk.clear();
+
+    // Data larger than a chunk goes in on its own.
+    if (sizeof(Record) + Length > ChunkSize) {
+      State = Combine(State, Record, sizeof(Record));
+      State = Combine(State, Data, Length);
+      return;
+    }
+  }
+
+  Chunk.append(Record, sizeof(Record));
+  if (Length)
+    Chunk.append(Data, Length);
+}
+
+ContentHash
+StreamFingerprint::GetFingerprint() const {
+  ContentHash Result = Combine(State, Chunk.data(), Chunk.size());
+
+  char Count[sizeof(NumTokens)];
+  std::memcpy(Count, &NumTokens, sizeof(NumTokens));
+  return Combine(Result, Count, sizeof(Count));
+}
+
+ContentHash
+StreamFingerprint::Combine(const ContentHash &State, const char *Data,
+                           size_t Size) {
+  ContentHash DataHash = ContentHash::Compute(Data, Size);
+
+  uint64_t Words[4] = {State.Low, State.High, DataHash.Low, DataHash.High};
+  return ContentHash::Compute(reinterpret_cast<const char *>(Words),
+                              sizeof(Words));
+}
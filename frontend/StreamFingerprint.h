@@ -0,0 +1,69 @@
+#ifndef STREAM_FINGERPRINT_H
+#define STREAM_FINGERPRINT_H
+
+#include "ContentHash.h"
+#include "Mixins.h"
+#include "Token.h"
+
+#include <string>
+
+/* ========================================================
+ *  StreamFingerprint
+ * ========================================================
+ */
+
+/**
+ * Incremental hash of a preprocessed token stream. Every token contributes
+ * its kind, whether it starts a line or follows whitespace, and its
+ * spelling. The presumed file and line are added where the output can show
+ * them: when the tokens move to another file and at the start of each line.
+ * Two streams with the same fingerprint print the same -E output, line
+ * markers included, up to the amount of whitespace, without any of it being
+ * rendered.
+ *
+ * Tokens are appended to a buffer that is hashed with ContentHash whenever
+ * it fills up, chaining the hashes of the chunks.
+ */
+class StreamFingerprint : private NonCopyable<StreamFingerprint> {
+  static constexpr size_t ChunkSize = 64 * 1024;
+
+  /** Tokens not hashed yet. */
+  std::string Chunk;
+
+  /** Hash of the chunks so far. */
+  ContentHash State;
+
+  uint64_t NumTokens = 0;
+
+public:
+  StreamFingerprint() { Chunk.reserve(ChunkSize); }
+
+  /** Add a token spelled as the Length bytes at Spelling. */
+  void AddToken(TokenKind Kind, uint16_t Flags, const char *Spelling,
+                unsigned Length);
+
+  /** The following tokens come from line Line of the file Name. */
+  void AddFileChange(const std::string &Name, unsigned Line);
+
+  /** The following tokens start line Line of the current file. */
+  void AddLine(unsigned Line);
+
+  /** The fingerprint of the tokens added so far. */
+  ContentHash GetFingerprint() const;
+
+  uint64_t GetNumTokens() const { return NumTokens; }
+
+private:
+  /**
+   * Append a record header and the Length bytes at Data, chunk by chunk.
+   * The second byte of a header holds token flags or a location marker.
+   */
+  void Append(const char (&Record)[2 + sizeof(uint32_t)], const char *Data,
+              unsigned Length);
+
+  /** Fold the hash of Data into State. */
+  static ContentHash Combine(const ContentHash &State, const char *Data,
+                             size_t Size);
+};
+
+#endif
@@ -26,12 +26,36 @@ class Token {
   uint32_t Length;
   void *DataPtr;
 
+  /** Bitwise OR of TokenFlags. */
+  uint16_t Flags;
+
 public:
+  enum TokenFlags : uint16_t {
+    /** First token on its line, possibly preceded by whitespace. */
+    StartOfLine = 0x01,
+
+    /** Whitespace precedes this token on the same line. */
+    LeadingSpace = 0x02,
+
+    /**
+     * The token contains escaped newlines or trigraphs, its spelling differs
+     * from the source text. See Preprocessor::GetSpelling.
+     */
+    NeedsCleaning = 0x04,
+  };
+
   void ResetToken() {
     Kind = Unknown;
     DataPtr = nullptr;
+    Flags = 0;
   }
 
+  bool HasFlag(TokenFlags Flag) const { return (Flags & Flag) != 0; }
+  void SetFlag(TokenFlags Flag) { Flags |= Flag; }
+  void ClearFlag(TokenFlags Flag) { Flags &= ~Flag; }
+  uint16_t GetFlags() const { return Flags; }
+  void SetFlags(uint16_t InFlags) { Flags = InFlags; }
+
   bool IsIdentifier() const { return Kind == Identifier; }
 
   bool IsStringLiteral() const {
@@ -67,10 +91,10 @@ public:
     DataPtr = const_cast<char *>(Data);
   }
 
-  uint32_t GetLength() { return Length; }
+  uint32_t GetLength() const { return Length; }
   void SetLength(uint32_t InLength) { Length = InLength; }
 
-  SourceLocation GetLocation() { return Location; }
+  SourceLocation GetLocation() const { return Location; }
   void SetLocation(SourceLocation InLocation) { Location = InLocation; }
 };
 
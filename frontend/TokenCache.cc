@@ -0,0 +1,286 @@
+#include "TokenCache.h"
+
+#include "Lexer.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/* ========================================================
+ *  Cache file layout
+ * ========================================================
+ */
+
+/**
+ * A TokenCacheHeader followed by the token arrays, found through byte
+ * offsets from the start of the file and aligned for direct access.
+ */
+constexpr uint32_t TokenCacheMagic = 0x4b4f5443; // "CTOK"
+constexpr uint32_t TokenCacheVersion = 4;
+
+struct TokenCacheHeader {
+  uint32_t Magic;
+  uint32_t Version;
+
+  /** LanguageOptions::Serialize() of the lexer. */
+  uint64_t LangOptions;
+
+  /** The buffer the tokens were lexed from. */
+  uint64_t ContentHashLow;
+  uint64_t ContentHashHigh;
+  uint32_t BufferSize;
+
+  /** Size of the whole file, to reject truncated files. */
+  uint32_t FileSize;
+
+  uint32_t NumTokens;
+  uint32_t NumIdentifiers;
+
+  uint32_t KindsOffset;
+  uint32_t FlagsOffset;
+  uint32_t OffsetsOffset;
+  uint32_t LengthsOffset;
+  uint32_t IdentifiersOffset;
+};
+
+static_assert(NumTokens <= 256, "Token kinds are stored in a byte!");
+
+/* ========================================================
+ *  CachedTokenStream
+ * ========================================================
+ */
+
+CachedTokenStream::~CachedTokenStream() {
+  if (Data)
+    ::munmap(const_cast<char *>(Data), DataSize);
+}
+
+/* ========================================================
+ *  TokenCache
+ * ========================================================
+ */
+
+const CachedTokenStream *
+TokenCache::GetTokens(const FileContentCache &Content) {
+  const ContentHash &Hash = Content.GetContentHash();
+
+  // Identical buffers share their stream.
+  auto It = Streams.find(Hash);
+  if (It != Streams.end())
+    return It->second.get();
+
+  std::string Path = GetCachePath(Hash);
+  std::unique_ptr<CachedTokenStream> Stream = MapTokens(Path, Content);
+  if (Stream) {
+    ++NumHits;
+  } else {
+    ++NumMisses;
+    if (WriteTokens(Path, Content))
+      Stream = MapTokens(Path, Content);
+    else
+      ++NumWriteFailures;
+  }
+
+  if (Stream)
+    NumTokensMapped += Stream->size();
+  return (Streams[Hash] = std::move(Stream)).get();
+}
+
+std::string
+TokenCache::GetCachePath(const ContentHash &Hash) const {
+  char Name[80];
+  std::snprintf(Name, sizeof(Name),
+                "/%016" PRIx64 "%016" PRIx64 "-%016" PRIx64 ".tok", Hash.High,
+                Hash.Low, LangOptions.Serialize());
+  return Directory + Name;
+}
+
+bool
+TokenCache::WriteTokens(const std::string &Path,
+                        const FileContentCache &Content) {
+  std::vector<uint8_t> Kinds;
+  std::vector<uint8_t> Flags;
+  std::vector<uint32_t> Offsets;
+  std::vector<uint32_t> Lengths;
+  std::vector<uint32_t> IdentifierRefs;
+  std::unordered_map<std::string, uint32_t> IdentifierIndices;
+
+  const char *Start = Content.GetBufferStart();
+  Lexer RawLexer(SourceLocation(), LangOptions, Start, Start,
+                 Content.GetBufferEnd());
+
+  Token Tok;
+  while (true) {
+    RawLexer.AdvanceToken(Tok);
+    if (Tok.GetKind() == Eof)
+      break;
+
+    uint16_t TokFlags = Tok.GetFlags();
+    assert(TokFlags <= 0xff && "Token flags are stored in a byte!");
+
+    // The lexer stops right after the token.
+    uint32_t Offset = RawLexer.GetBufferOffset() - Tok.GetLength();
+    uint32_t IdentifierRef = CachedTokenStream::NoIdentifier;
+    if (Tok.IsIdentifier()) {
+      std::string Name(Start + Offset, Tok.GetLength());
+      IdentifierRef =
+          IdentifierIndices.emplace(Name, IdentifierIndices.size())
+              .first->second;
+    }
+
+    Kinds.push_back(Tok.GetKind());
+    Flags.push_back(TokFlags);
+    Offsets.push_back(Offset);
+    Lengths.push_back(Tok.GetLength());
+    IdentifierRefs.push_back(IdentifierRef);
+  }
+
+  TokenCacheHeader Header;
+  std::memset(&Header, 0, sizeof(Header));
+  Header.Magic = TokenCacheMagic;
+  Header.Version = TokenCacheVersion;
+  Header.LangOptions = LangOptions.Serialize();
+  Header.ContentHashLow = Content.GetContentHash().Low;
+  Header.ContentHashHigh = Content.GetContentHash().High;
+  Header.BufferSize = Content.GetSize();
+  Header.NumTokens = Kinds.size();
+  Header.NumIdentifiers = IdentifierIndices.size();
+
+  std::string Buffer(sizeof(Header), '\0');
+  auto AddArray = [&Buffer](const void *Data, size_t Size) {
+    Buffer.resize((Buffer.size() + 7) & ~size_t(7), '\0');
+    uint32_t Offset = Buffer.size();
+    if (Size)
+      Buffer.append(static_cast<const char *>(Data), Size);
+    return Offset;
+  };
+  Header.KindsOffset = AddArray(Kinds.data(), Kinds.size());
+  Header.FlagsOffset = AddArray(Flags.data(), Flags.size());
+  Header.OffsetsOffset =
+      AddArray(Offsets.data(), Offsets.size() * sizeof(uint32_t));
+  Header.LengthsOffset =
+      AddArray(Lengths.data(), Lengths.size() * sizeof(uint32_t));
+  Header.IdentifiersOffset =
+      AddArray(IdentifierRefs.data(), IdentifierRefs.size() * sizeof(uint32_t));
+  Header.FileSize = Buffer.size();
+  std::memcpy(&Buffer[0], &Header, sizeof(Header));
+
+  // Readers must never see a partial file, and other compiles or threads may
+  // be writing the same one, write it aside under a unique name and rename.
+  size_t ThreadID = std::hash<std::thread::id>()(std::this_thread::get_id());
+  std::string TempPath = Path + "." + std::to_string(::getpid()) + "." +
+                         std::to_string(ThreadID) + ".tmp";
+  std::FILE *Out = std::fopen(TempPath.c_str(), "wb");
+  if (!Out)
+    return false;
+
+  bool bSucceeded =
+      std::fwrite(Buffer.data(), 1, Buffer.size(), Out) == Buffer.size();
+  bSucceeded &= std::fclose(Out) == 0;
+  if (bSucceeded)
+    bSucceeded = std::rename(TempPath.c_str(), Path.c_str()) == 0;
+  if (!bSucceeded)
+    std::remove(TempPath.c_str());
+  return bSucceeded;
+}
+
+std::unique_ptr<CachedTokenStream>
+TokenCache::MapTokens(const std::string &Path,
+                      const FileContentCache &Content) {
+  int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD < 0)
+    return nullptr;
+
+  struct stat StatBuf;
+  if (::fstat(FD, &StatBuf) != 0 ||
+      static_cast<size_t>(StatBuf.st_size) < sizeof(TokenCacheHeader)) {
+    ::close(FD);
+    return nullptr;
+  }
+
+  void *Mapping =
+      ::mmap(nullptr, StatBuf.st_size, PROT_READ, MAP_PRIVATE, FD, 0);
+  ::close(FD);
+  if (Mapping == MAP_FAILED)
+    return nullptr;
+
+  std::unique_ptr<CachedTokenStream> Stream(new CachedTokenStream());
+  Stream->Data = static_cast<const char *>(Mapping);
+  Stream->DataSize = StatBuf.st_size;
+
+  const auto *Header = reinterpret_cast<const TokenCacheHeader *>(Mapping);
+  if (Header->Magic != TokenCacheMagic ||
+      Header->Version != TokenCacheVersion ||
+      Header->FileSize != Stream->DataSize ||
+      Header->LangOptions != LangOptions.Serialize() ||
+      Header->ContentHashLow != Content.GetContentHash().Low ||
+      Header->ContentHashHigh != Content.GetContentHash().High ||
+      Header->BufferSize != Content.GetSize())
+    return nullptr;
+
+  size_t DataSize = Stream->DataSize;
+  auto IsInFile = [DataSize](uint32_t Offset, uint64_t Size) {
+    return Offset <= DataSize && Size <= DataSize - Offset;
+  };
+  uint64_t NumStoredTokens = Header->NumTokens;
+  uint64_t ArraySize = NumStoredTokens * sizeof(uint32_t);
+  if (!IsInFile(Header->KindsOffset, NumStoredTokens) ||
+      !IsInFile(Header->FlagsOffset, NumStoredTokens) ||
+      !IsInFile(Header->OffsetsOffset, ArraySize) ||
+      !IsInFile(Header->LengthsOffset, ArraySize) ||
+      !IsInFile(Header->IdentifiersOffset, ArraySize) ||
+      Header->OffsetsOffset % alignof(uint32_t) ||
+      Header->LengthsOffset % alignof(uint32_t) ||
+      Header->IdentifiersOffset % alignof(uint32_t))
+    return nullptr;
+
+  // The lexer trusts the tokens: every one must lie in the buffer, after the
+  // previous one, and identifiers must have a valid reference.
+  const char *Data = Stream->Data;
+  const auto *Kinds =
+      reinterpret_cast<const uint8_t *>(Data + Header->KindsOffset);
+  const auto *Offsets =
+      reinterpret_cast<const uint32_t *>(Data + Header->OffsetsOffset);
+  const auto *Lengths =
+      reinterpret_cast<const uint32_t *>(Data + Header->LengthsOffset);
+  const auto *IdentifierRefs =
+      reinterpret_cast<const uint32_t *>(Data + Header->IdentifiersOffset);
+  uint64_t PrevEnd = 0;
+  for (uint32_t I = 0; I != Header->NumTokens; ++I) {
+    uint64_t End = uint64_t(Offsets[I]) + Lengths[I];
+    if (Offsets[I] < PrevEnd || End > Header->BufferSize)
+      return nullptr;
+    PrevEnd = End;
+
+    uint32_t Ref = IdentifierRefs[I];
+    if (Kinds[I] >= NumTokens ||
+        (Kinds[I] == Identifier) != (Ref != CachedTokenStream::NoIdentifier) ||
+        (Ref != CachedTokenStream::NoIdentifier &&
+         Ref >= Header->NumIdentifiers))
+      return nullptr;
+  }
+
+  Stream->NumTokens = Header->NumTokens;
+  Stream->NumIdentifiers = Header->NumIdentifiers;
+  Stream->Kinds = Kinds;
+  Stream->Flags = reinterpret_cast<const uint8_t *>(Data + Header->FlagsOffset);
+  Stream->Offsets = Offsets;
+  Stream->Lengths = Lengths;
+  Stream->Identifiers = IdentifierRefs;
+  return Stream;
+}
+
+void
+TokenCache::PrintStats() const {
+  std::fprintf(stderr, "\n*** Token Cache Stats:\n");
+  std::fprintf(stderr, "%u buffers mapped, %u lexed (%u failed to write).\n",
+               NumHits, NumMisses, NumWriteFailures);
+  std::fprintf(stderr, "%llu tokens mapped.\n",
+               (unsigned long long)NumTokensMapped);
+}
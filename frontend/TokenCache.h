@@ -0,0 +1,125 @@
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include "ContentHash.h"
+#include "Mixins.h"
+#include "Options.h"
+#include "Token.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class FileContentCache;
+
+/* ========================================================
+ *  CachedTokenStream
+ * ========================================================
+ */
+
+/**
+ * The raw tokens of one buffer, as lexed by a raw Lexer, mapped from a
+ * TokenCache file. The tokens are stored as separate arrays of kinds, flags,
+ * offsets from the start of the buffer, lengths and identifier references,
+ * so that replaying them only touches what is used.
+ */
+class CachedTokenStream : private NonCopyable<CachedTokenStream> {
+  friend class TokenCache;
+
+  /** The mapped file. */
+  const char *Data = nullptr;
+  size_t DataSize = 0;
+
+  uint32_t NumTokens = 0;
+  const uint8_t *Kinds = nullptr;
+  const uint8_t *Flags = nullptr;
+  const uint32_t *Offsets = nullptr;
+  const uint32_t *Lengths = nullptr;
+
+  /**
+   * Per token, NoIdentifier or the index of its identifier among the
+   * distinct identifiers of the buffer, in order of first appearance.
+   */
+  const uint32_t *Identifiers = nullptr;
+  uint32_t NumIdentifiers = 0;
+
+  CachedTokenStream() = default;
+
+public:
+  static constexpr uint32_t NoIdentifier = ~0U;
+
+  ~CachedTokenStream();
+
+  uint32_t size() const { return NumTokens; }
+
+  TokenKind GetKind(uint32_t Index) const {
+    return static_cast<TokenKind>(Kinds[Index]);
+  }
+  uint16_t GetFlags(uint32_t Index) const { return Flags[Index]; }
+  uint32_t GetOffset(uint32_t Index) const { return Offsets[Index]; }
+  uint32_t GetLength(uint32_t Index) const { return Lengths[Index]; }
+
+  uint32_t GetIdentifier(uint32_t Index) const { return Identifiers[Index]; }
+  uint32_t GetNumIdentifiers() const { return NumIdentifiers; }
+};
+
+/* ========================================================
+ *  TokenCache
+ * ========================================================
+ */
+
+/**
+ * Persistent cache of the raw tokens of source buffers, one file per buffer
+ * in a cache directory. Files are keyed by the ContentHash of the buffer and
+ * by the language options, which change how it lexes, so a header that did
+ * not change is lexed once and mapped by every later translation unit. Files
+ * with the same contents share one stream.
+ *
+ * Streams stay mapped until the cache is destroyed; the cache must outlive
+ * the lexers replaying them.
+ */
+class TokenCache : private NonCopyable<TokenCache> {
+  std::string Directory;
+
+  LanguageOptions LangOptions;
+
+  /** Streams mapped so far by content hash, null if unavailable. */
+  std::unordered_map<ContentHash, std::unique_ptr<CachedTokenStream>,
+                     ContentHashHasher>
+      Streams;
+
+  /*=============== Statistics ========================================*/
+  unsigned NumHits = 0;
+  unsigned NumMisses = 0;
+  unsigned NumWriteFailures = 0;
+  uint64_t NumTokensMapped = 0;
+
+public:
+  TokenCache(const std::string &InDirectory,
+             const LanguageOptions &InLangOptions)
+      : Directory(InDirectory)
+      , LangOptions(InLangOptions) {}
+
+  /**
+   * Returns the tokens of Content, lexing it and adding it to the cache
+   * first if needed. Null if the cache cannot be read or written.
+   */
+  const CachedTokenStream *GetTokens(const FileContentCache &Content);
+
+  /** Print statistics about cache hits to stderr. */
+  void PrintStats() const;
+
+private:
+  /** Path of the cache file of a buffer with the given hash. */
+  std::string GetCachePath(const ContentHash &Hash) const;
+
+  /** Lex Content and write its tokens to Path. */
+  bool WriteTokens(const std::string &Path, const FileContentCache &Content);
+
+  /** Map the cache file at Path, null if it is not for this Content. */
+  std::unique_ptr<CachedTokenStream> MapTokens(const std::string &Path,
+                                               const FileContentCache &Content);
+};
+
+#endif
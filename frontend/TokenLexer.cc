@@ -1 +1,68 @@
 #include "TokenLexer.h"
+
+#include "IdentifierTable.h"
+#include "Preprocessor.h"
+
+void
+TokenLexer::Init(Token &Tok, MacroInfo *MI) {
+  assert(MI->IsBodyLexed() && "Macro body must be lexed before expansion!");
+  Macro = MI;
+  CurToken = 0;
+
+  ExpandLocStart = ExpandLocEnd = Tok.GetLocation();
+  MacroDefStart = MI->GetBodyLocation();
+  MacroDefLength = MI->GetBodyLength();
+
+  // The replacement tokens are located in an expansion entry of their own,
+  // so that they are placed at the macro name and spelled in the #define.
+  MacroExpansionStart = SourceLocation();
+  if (MI->GetNumTokens() != 0) {
+    MacroExpansionStart = PP.GetSourceManager().CreateExpansionLoc(
+        MacroDefStart, ExpandLocStart, ExpandLocEnd, MacroDefLength);
+  }
+
+  bAtStartOfLine = Tok.HasFlag(Token::StartOfLine);
+  bHasLeadingSpace = Tok.HasFlag(Token::LeadingSpace);
+
+  Macro->DisableMacro();
+}
+
+TokenLexer::~TokenLexer() {
+  if (Macro)
+    Macro->EnableMacro();
+}
+
+bool
+TokenLexer::AdvanceToken(Token &Result) {
+  if (CurToken == Macro->GetNumTokens())
+    return PP.HandleEndOfTokenLexer(Result);
+
+  bool bIsFirstToken = CurToken == 0;
+  Result = Macro->GetReplacementToken(CurToken++);
+
+  // Move the token from the #define into the expansion.
+  SourceLocation Loc = Result.GetLocation();
+  if (MacroExpansionStart.IsValid() && Loc.IsFileID()) {
+    // Both are file locations, their encodings are their offsets.
+    unsigned RelOffset = Loc.GetRawEncoding() - MacroDefStart.GetRawEncoding();
+    if (RelOffset < MacroDefLength)
+      Result.SetLocation(MacroExpansionStart.GetLocWithOffset(RelOffset));
+  }
+
+  if (bIsFirstToken) {
+    Result.ClearFlag(Token::StartOfLine);
+    Result.ClearFlag(Token::LeadingSpace);
+    if (bAtStartOfLine)
+      Result.SetFlag(Token::StartOfLine);
+    if (bHasLeadingSpace)
+      Result.SetFlag(Token::LeadingSpace);
+  } else {
+    // Tokens of a replacement list never start a line of the output.
+    Result.ClearFlag(Token::StartOfLine);
+  }
+
+  IdentifierInfo *II = Result.GetIdentifierInfo();
+  if (Result.GetKind() == Identifier && II && II->GetHasMacroDefinition())
+    return PP.HandleIdentifier(Result);
+  return true;
+}
@@ -8,22 +8,56 @@
 
 class Preprocessor;
 
+/**
+ * Returns the replacement tokens of an object-like macro expansion. The macro
+ * is disabled while its tokens are returned, so that its name is not expanded
+ * again (C99 6.10.3.4p2).
+ */
 class TokenLexer : private NonCopyable<TokenLexer> {
   friend class Preprocessor;
 
+  /** The macro being expanded. */
+  MacroInfo *Macro = nullptr;
+
+  Preprocessor &PP;
+
+  /** Next token of the replacement list to return. */
+  unsigned CurToken = 0;
+
   SourceLocation ExpandLocStart, ExpandLocEnd;
 
-  /** Location of the macro definition. */
+  /** Location and length of the replacement list in the #define. */
   SourceLocation MacroDefStart;
   unsigned MacroDefLength;
 
+  /**
+   * Start of the expansion entry of this expansion. A replacement token
+   * spelled at MacroDefStart + I is returned at MacroExpansionStart + I.
+   */
+  SourceLocation MacroExpansionStart;
+
+  /**
+   * Flags of the macro name token. The first token of the expansion takes
+   * its place on the line.
+   */
+  bool bAtStartOfLine = false;
+  bool bHasLeadingSpace = false;
+
 public:
-  TokenLexer(MacroInfo *MI, Preprocessor &PP) { Init(MI); }
+  TokenLexer(Token &Tok, MacroInfo *MI, Preprocessor &InPP) : PP(InPP) {
+    Init(Tok, MI);
+  }
+
+  ~TokenLexer();
 
-  /** Initialize a Token lexer to expand a macro. */
-  void Init(MacroInfo *MI);
+  /** Initialize a Token lexer to expand the macro named by Tok. */
+  void Init(Token &Tok, MacroInfo *MI);
 
-  /** Lex and return next token from this macro stream. */
+  /**
+   * Lex and return next token from this macro stream. Returns false if the
+   * token was macro expanded, or if the expansion ended and the lexer it was
+   * entered from was restored; the caller lexes again.
+   */
   bool AdvanceToken(Token &Result);
 };
 
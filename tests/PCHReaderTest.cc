@@ -0,0 +1,282 @@
+/**
+ * Writes a PCH of a small prefix, then loads it and corrupted copies of it.
+ */
+
+#include "FileManager.h"
+#include "IdentifierTable.h"
+#include "Options.h"
+#include "PCHFormat.h"
+#include "PCHReader.h"
+#include "PCHWriter.h"
+#include "Preprocessor.h"
+#include "SourceManager.h"
+#include "Test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static std::string Dir;
+static std::string PrefixPath, PCHPath, CorruptPath;
+
+/** A preprocessor with nothing entered yet. */
+struct TestPreprocessor {
+  LanguageOptions LangOpts;
+  FileManager FileMgr;
+  SourceManager SourceMgr{true};
+  IdentifierInfoTable Identifiers;
+  Preprocessor PP{LangOpts, SourceMgr};
+
+  TestPreprocessor() {
+    PP.SetIdentifierTable(&Identifiers);
+    PP.Init();
+  }
+
+  MacroInfo *GetMacro(const char *Name) {
+    std::string Str = Name;
+    return PP.GetMacroInfo(&Identifiers.GetOrCreate(Str));
+  }
+};
+
+static void
+WriteFile(const std::string &Path, const std::string &Contents) {
+  std::FILE *Out = std::fopen(Path.c_str(), "wb");
+  std::fwrite(Contents.data(), 1, Contents.size(), Out);
+  std::fclose(Out);
+}
+
+static std::string
+ReadFile(const std::string &Path) {
+  std::string Contents;
+  std::FILE *In = std::fopen(Path.c_str(), "rb");
+  for (int C; (C = std::fgetc(In)) != EOF;)
+    Contents += char(C);
+  std::fclose(In);
+  return Contents;
+}
+
+/** Preprocess the prefix and write its PCH. */
+static bool
+WritePCH() {
+  WriteFile(PrefixPath, "#define FOO 1 + 2\n#define BAR(x, y) x y\n");
+
+  TestPreprocessor Test;
+  const FileEntry *File = Test.FileMgr.GetFile(PrefixPath);
+  FileContentCache *Content =
+      Test.SourceMgr.CreateContentCache(File, Test.FileMgr);
+  FileID FID = Test.SourceMgr.CreateFileID(*Content, SourceLocation(), 0);
+  Test.SourceMgr.SetMainFileID(FID);
+  Test.PP.EnterSourceFile(FID);
+
+  Token Tok;
+  do
+    Test.PP.AdvanceToken(Tok);
+  while (Tok.GetKind() != Eof);
+
+  PCHWriter Writer(Test.PP);
+  return Writer.Write(PCHPath);
+}
+
+/** Offsets of all the identifier records of the PCH Data. */
+static std::vector<uint32_t>
+GetIdentifierRecords(const std::string &Data) {
+  PCHHeader Header;
+  std::memcpy(&Header, Data.data(), sizeof(Header));
+
+  std::vector<uint32_t> Records;
+  for (uint32_t I = 0; I < Header.NumBuckets; ++I) {
+    uint32_t Offset;
+    std::memcpy(&Offset, &Data[Header.BucketsOffset + 4 * I], 4);
+    while (Offset) {
+      Records.push_back(Offset);
+      PCHIdentifier Record;
+      std::memcpy(&Record, &Data[Offset], sizeof(Record));
+      Offset = Record.Next;
+    }
+  }
+  return Records;
+}
+
+template <typename T>
+static T
+Get(const std::string &Data, uint32_t Offset) {
+  T Value;
+  std::memcpy(&Value, &Data[Offset], sizeof(T));
+  return Value;
+}
+
+template <typename T>
+static void
+Set(std::string &Data, uint32_t Offset, const T &Value) {
+  std::memcpy(&Data[Offset], &Value, sizeof(T));
+}
+
+static void
+TestLoad() {
+  TestPreprocessor Test;
+  PCHReader Reader(Test.PP, Test.Identifiers, Test.FileMgr);
+  CHECK_EQ(Reader.ReadPCH(PCHPath), PCHReader::LR_Success);
+
+  // Nothing but the header and the tables is read up front.
+  CHECK_EQ(Test.SourceMgr.GetNumReadLoadedSLocEntries(), 0u);
+
+  MacroInfo *Foo = Test.GetMacro("FOO");
+  CHECK(Foo && !Foo->IsFunctionLike());
+  MacroInfo *Bar = Test.GetMacro("BAR");
+  CHECK(Bar && Bar->IsFunctionLike() && Bar->GetNumParameters() == 2);
+  CHECK(!Test.GetMacro("BAZ"));
+
+  if (Foo) {
+    SourceLocation Body = Foo->GetBodyLocation();
+    FileID FID = Test.SourceMgr.GetFileID(Body);
+    CHECK(Test.SourceMgr.GetSLocEntryByID(FID).IsFile());
+    CHECK(!std::strncmp(Test.SourceMgr.GetCharacterData(Body), "1 + 2", 5));
+  }
+}
+
+/**
+ * Load a copy of the PCH changed by Corrupt. Returns the load result; Check
+ * runs on the preprocessor after a successful load.
+ */
+template <typename CorruptFnT, typename CheckFnT>
+static PCHReader::LoadResult
+LoadCorrupt(CorruptFnT Corrupt, CheckFnT Check) {
+  std::string Data = ReadFile(PCHPath);
+  Corrupt(Data);
+  WriteFile(CorruptPath, Data);
+
+  TestPreprocessor Test;
+  PCHReader Reader(Test.PP, Test.Identifiers, Test.FileMgr);
+  PCHReader::LoadResult Result = Reader.ReadPCH(CorruptPath);
+  if (Result == PCHReader::LR_Success)
+    Check(Test);
+  return Result;
+}
+
+static void
+TestCorruptHeader() {
+  auto NoCheck = [](TestPreprocessor &) {};
+
+  CHECK_EQ(LoadCorrupt([](std::string &Data) { Data.resize(Data.size() - 8); },
+                       NoCheck),
+           PCHReader::LR_Failure);
+
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 PCHHeader Header = Get<PCHHeader>(Data, 0);
+                 Header.NumBuckets = 3;
+                 Set(Data, 0, Header);
+               },
+               NoCheck),
+           PCHReader::LR_Failure);
+
+  // The offset table is checked before entries are reserved.
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 PCHHeader Header = Get<PCHHeader>(Data, 0);
+                 Set<uint32_t>(Data, Header.SLocOffsetsOffset, 0);
+               },
+               NoCheck),
+           PCHReader::LR_Failure);
+
+  // The file table is read at load.
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 PCHHeader Header = Get<PCHHeader>(Data, 0);
+                 PCHFile File = Get<PCHFile>(Data, Header.FilesOffset);
+                 File.Path.Offset = 0xfffffff0;
+                 Set(Data, Header.FilesOffset, File);
+               },
+               NoCheck),
+           PCHReader::LR_Failure);
+}
+
+static void
+TestCorruptRecords() {
+  // Records are checked when they are read, a bad one is left out.
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 PCHHeader Header = Get<PCHHeader>(Data, 0);
+                 PCHSLocEntry Entry =
+                     Get<PCHSLocEntry>(Data, Header.SLocEntriesOffset);
+                 Entry.File.Buffer.Length = 1 << 30;
+                 Set(Data, Header.SLocEntriesOffset, Entry);
+               },
+               [](TestPreprocessor &Test) {
+                 MacroInfo *Foo = Test.GetMacro("FOO");
+                 CHECK(Foo);
+                 if (!Foo)
+                   return;
+                 FileID FID = Test.SourceMgr.GetFileID(Foo->GetBodyLocation());
+                 CHECK(!Test.SourceMgr.GetSLocEntryByID(FID).IsFile());
+               }),
+           PCHReader::LR_Success);
+
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 for (uint32_t Offset : GetIdentifierRecords(Data)) {
+                   PCHIdentifier Record = Get<PCHIdentifier>(Data, Offset);
+                   Record.NumParameters = 1000000;
+                   Set(Data, Offset, Record);
+                 }
+               },
+               [](TestPreprocessor &Test) {
+                 CHECK(!Test.GetMacro("FOO"));
+                 CHECK(!Test.GetMacro("BAR"));
+               }),
+           PCHReader::LR_Success);
+
+  // Chains that loop back on themselves end.
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 for (uint32_t Offset : GetIdentifierRecords(Data)) {
+                   PCHIdentifier Record = Get<PCHIdentifier>(Data, Offset);
+                   Record.Next = Offset;
+                   Set(Data, Offset, Record);
+                 }
+               },
+               [](TestPreprocessor &Test) {
+                 CHECK(Test.GetMacro("FOO"));
+                 for (char C = 'a'; C <= 'z'; ++C) {
+                   char Name[] = {'m', C, '\0'};
+                   CHECK(!Test.GetMacro(Name));
+                 }
+               }),
+           PCHReader::LR_Success);
+
+  CHECK_EQ(LoadCorrupt(
+               [](std::string &Data) {
+                 PCHHeader Header = Get<PCHHeader>(Data, 0);
+                 for (uint32_t I = 0; I < Header.NumBuckets; ++I)
+                   Set<uint32_t>(Data, Header.BucketsOffset + 4 * I, 0xfff0);
+               },
+               [](TestPreprocessor &Test) { CHECK(!Test.GetMacro("FOO")); }),
+           PCHReader::LR_Success);
+}
+
+int
+main() {
+  char Template[] = "/tmp/PCHReaderTest.XXXXXX";
+  if (!::mkdtemp(Template)) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  Dir = Template;
+  PrefixPath = Dir + "/prefix.h";
+  PCHPath = Dir + "/prefix.pch";
+  CorruptPath = Dir + "/corrupt.pch";
+
+  CHECK(WritePCH());
+  TestLoad();
+  TestCorruptHeader();
+  TestCorruptRecords();
+
+  ::unlink(PrefixPath.c_str());
+  ::unlink(PCHPath.c_str());
+  ::unlink(CorruptPath.c_str());
+  ::rmdir(Dir.c_str());
+  return NumFailures != 0;
+}
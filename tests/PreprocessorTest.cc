@@ -0,0 +1,335 @@
+/**
+ * Preprocesses small sources and checks the tokens that come out.
+ */
+
+#include "FileManager.h"
+#include "Header.h"
+#include "IdentifierTable.h"
+#include "Options.h"
+#include "Preprocessor.h"
+#include "PrintPreprocessedOutput.h"
+#include "SourceManager.h"
+#include "Test.h"
+
+#include <cstdio>
+#include <list>
+#include <string>
+
+/**
+ * A preprocessor over in-memory files. "x" includes are found next to the
+ * includer.
+ */
+struct TestPreprocessor {
+  LanguageOptions LangOpts;
+  FileManager FileMgr;
+  SourceManager SourceMgr{true};
+  IdentifierInfoTable Identifiers;
+  HeaderSearch Headers{FileMgr};
+  Preprocessor PP{LangOpts, SourceMgr};
+
+  /** Contents of the files, which are used in place. */
+  std::list<std::string> Buffers;
+
+  TestPreprocessor() {
+    PP.SetIdentifierTable(&Identifiers);
+    PP.SetHeaderSearch(&Headers);
+    PP.Init();
+  }
+
+  const FileEntry *AddFile(const char *Path, const char *Source) {
+    Buffers.emplace_back(Source);
+    return FileMgr.AddVirtualFile(Path, Buffers.back().c_str(),
+                                  Buffers.back().size());
+  }
+
+  /** Enter File as the main file. */
+  FileID EnterMainFile(const FileEntry *File) {
+    FileContentCache *Content = SourceMgr.CreateContentCache(File, FileMgr);
+    FileID FID = SourceMgr.CreateFileID(*Content, SourceLocation(), 0);
+    SourceMgr.SetMainFileID(FID);
+    PP.EnterSourceFile(FID);
+    return FID;
+  }
+
+  /** The -E output of the main file. */
+  std::string PrintPreprocessed() {
+    std::FILE *Out = std::tmpfile();
+    PreprocessedOutputWriter Writer;
+    Writer.Print(PP, fileno(Out), PreprocessorOutputOptions());
+
+    std::string Result;
+    std::rewind(Out);
+    for (int C; (C = std::fgetc(Out)) != EOF;)
+      Result += char(C);
+    std::fclose(Out);
+    return Result;
+  }
+};
+
+/**
+ * Preprocess Source as the main file and return the spelling of its tokens,
+ * separated by a space. "[guarded]" is appended if the file ends up with a
+ * defined include guard.
+ */
+static std::string
+Preprocess(const char *Source, bool bTrigraphs = false) {
+  TestPreprocessor Test;
+  Test.LangOpts.Trigraphs = bTrigraphs;
+  const FileEntry *File = Test.AddFile("/test/main.c", Source);
+  Test.EnterMainFile(File);
+
+  std::string Result;
+  Token Tok;
+  for (Test.PP.AdvanceToken(Tok); Tok.GetKind() != Eof;
+       Test.PP.AdvanceToken(Tok)) {
+    if (!Result.empty())
+      Result += ' ';
+    Result += Test.PP.GetSpelling(Tok);
+  }
+
+  // Files whose include guard is defined are not entered again.
+  if (!Test.PP.ShouldEnterIncludeFile(File))
+    Result += Result.empty() ? "[guarded]" : " [guarded]";
+  return Result;
+}
+
+/* ==========================================================================
+ *  Identifiers.
+ * ==========================================================================
+ */
+
+static void
+TestSplicedIdentifiers() {
+  CHECK_EQ(Preprocess("int c\\\nd;\n"), "int cd ;");
+  CHECK_EQ(Preprocess("int c\\\r\nd;\n"), "int cd ;");
+  CHECK_EQ(Preprocess("int c\\\n\\\nd;\n"), "int cd ;");
+  CHECK_EQ(Preprocess("int cd\\\n;\n"), "int cd ;");
+  CHECK_EQ(Preprocess("int c??/\nd;\n", true), "int cd ;");
+
+  // Spliced identifiers are the same identifiers, macros included.
+  CHECK_EQ(Preprocess("#define AB 1\nA\\\nB\n"), "1");
+  CHECK_EQ(Preprocess("#define A\\\nB 2\nAB\n"), "2");
+}
+
+static void
+TestSplicedDirectives() {
+  CHECK_EQ(Preprocess("#def\\\nine X 1\nX\n"), "1");
+  CHECK_EQ(Preprocess("#ifd\\\nef X\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if 0\n#el\\\nse\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#if 0\n#end\\\nif\nyes\n"), "yes");
+  CHECK_EQ(Preprocess("#def??/\nine X 1\nX\n", true), "1");
+
+  // Escaped newlines between tokens continue the directive.
+  CHECK_EQ(Preprocess("#define X 1 \\\n + 2\nX\n"), "1 + 2");
+}
+
+/* ==========================================================================
+ *  #if expressions.
+ * ==========================================================================
+ */
+
+static void
+TestIfDefined() {
+  CHECK_EQ(Preprocess("#define X\n#if defined(X)\nyes\n#else\nno\n#endif\n"),
+           "yes");
+  CHECK_EQ(Preprocess("#define X\n#if defined X\nyes\n#else\nno\n#endif\n"),
+           "yes");
+  CHECK_EQ(Preprocess("#if defined(X)\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if defined X\nyes\n#else\nno\n#endif\n"), "no");
+
+  // The operand of defined is not macro expanded.
+  CHECK_EQ(Preprocess("#define X Y\n#if defined(X)\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#define X Y\n#if defined Y\nyes\n#else\nno\n#endif\n"),
+           "no");
+}
+
+static void
+TestIfNot() {
+  CHECK_EQ(Preprocess("#if !defined(X)\nyes\n#else\nno\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#define X\n#if !defined(X)\nyes\n#else\nno\n#endif\n"),
+           "no");
+  CHECK_EQ(Preprocess("#if !defined X\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#if !0\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#if !1\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if !!2\nyes\n#endif\n"), "yes");
+}
+
+static void
+TestIfParen() {
+  CHECK_EQ(Preprocess("#if (1)\nyes\n#else\nno\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#if (0)\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if ((!0))\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#if !(defined(X))\nyes\n#endif\n"), "yes");
+
+  // Malformed expressions are taken as false.
+  CHECK_EQ(Preprocess("#if (1\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if defined(X\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if defined 1\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if\nyes\n#else\nno\n#endif\n"), "no");
+}
+
+static void
+TestIfValues() {
+  CHECK_EQ(Preprocess("#if 0x10\nyes\n#endif\n"), "yes");
+  CHECK_EQ(Preprocess("#define ONE 1\n#if ONE\nyes\n#endif\n"), "yes");
+
+  // Identifiers that are not macros are 0.
+  CHECK_EQ(Preprocess("#if UNDEFINED\nyes\n#else\nno\n#endif\n"), "no");
+  CHECK_EQ(Preprocess("#if 0\na\n#elif defined(X)\nb\n#elif !defined X\nc\n"
+                      "#endif\n"),
+           "c");
+}
+
+static void
+TestIfNotDefinedGuard() {
+  // "#if !defined(G)" around the whole file is an include guard, like
+  // #ifndef G.
+  CHECK_EQ(Preprocess("#if !defined(G)\n#define G\nint x;\n#endif\n"),
+           "int x ; [guarded]");
+  CHECK_EQ(Preprocess("#ifndef G\n#define G\n#endif\n"), "[guarded]");
+  CHECK_EQ(Preprocess("int y;\n#if !defined(G)\n#define G\n#endif\n"),
+           "int y ;");
+  CHECK_EQ(Preprocess("#if !defined(G)\n#define G\n#endif\nint z;\n"),
+           "int z ;");
+}
+
+/* ==========================================================================
+ *  Macro expansion.
+ * ==========================================================================
+ */
+
+static void
+TestExpansionLocations() {
+  TestPreprocessor Test;
+  Test.EnterMainFile(
+      Test.AddFile("/test/main.c", "#define N 42\n#define M N\nint x = M;\n"));
+
+  const SourceManager &SM = Test.SourceMgr;
+  Token Tok;
+  do
+    Test.PP.AdvanceToken(Tok);
+  while (Tok.GetKind() != NumericConstant);
+
+  // 42 is placed at M, on line 3, and spelled in the #define of N.
+  CHECK(Tok.GetLocation().IsMacroID());
+  std::pair<FileID, unsigned> Expansion =
+      SM.GetDecomposedExpansionLoc(Tok.GetLocation());
+  CHECK_EQ(Expansion.first, SM.GetMainFileID());
+  CHECK_EQ(Expansion.second, 33u);
+  std::pair<FileID, unsigned> Spelling =
+      SM.GetDecomposedSpellingLoc(Tok.GetLocation());
+  CHECK_EQ(Spelling.first, SM.GetMainFileID());
+  CHECK_EQ(Spelling.second, 10u);
+  CHECK_EQ(Test.PP.GetSpelling(Tok), "42");
+}
+
+static void
+TestExpansionFromHeader() {
+  // The expansion of a macro from a header stays on the line of its use.
+  TestPreprocessor Test;
+  Test.AddFile("/test/hm.h", "#define HM 42\n");
+  Test.EnterMainFile(
+      Test.AddFile("/test/hm.c", "#include \"hm.h\"\nint x = HM;\n"));
+  std::string Output = Test.PrintPreprocessed();
+  CHECK(Output.find("int x = 42;\n") != std::string::npos);
+}
+
+/* ==========================================================================
+ *  Lazy macro bodies.
+ * ==========================================================================
+ */
+
+static void
+TestLazyMacroBodies() {
+  // Only the body of the expanded macro is lexed. The identical
+  // redefinition of A is compared by spelling, without lexing either body.
+  TestPreprocessor Test;
+  Test.EnterMainFile(Test.AddFile("/test/main.c", "#define A 1 + 2\n"
+                                                  "#define B(x) x x x\n"
+                                                  "#define C (3)\n"
+                                                  "#define A 1 + 2\n"
+                                                  "#define D\n"
+                                                  "A\n"));
+  Token Tok;
+  do
+    Test.PP.AdvanceToken(Tok);
+  while (Tok.GetKind() != Eof);
+
+  CHECK_EQ(Test.PP.GetNumDefined(), 5u);
+  CHECK_EQ(Test.PP.GetNumMacroBodiesLexed(), 1u);
+  CHECK_EQ(Test.PP.GetNumMacroBodyTokens(), 3u);
+  CHECK_EQ(Test.PP.GetNumDeferredBodyBytes(), uint64_t(5 + 5 + 3 + 5));
+  CHECK_EQ(Test.PP.GetNumLexedBodyBytes(), uint64_t(5));
+}
+
+static void
+TestLazyMacroBodyOfRedefinition() {
+  // A redefinition spelled differently has to lex both bodies to compare.
+  TestPreprocessor Test;
+  Test.EnterMainFile(Test.AddFile("/test/main.c", "#define A (1)\n"
+                                                  "#define A ( 1 )\n"));
+  Token Tok;
+  do
+    Test.PP.AdvanceToken(Tok);
+  while (Tok.GetKind() != Eof);
+
+  CHECK_EQ(Test.PP.GetNumMacroBodiesLexed(), 2u);
+  CHECK_EQ(Test.PP.GetNumMacroBodyTokens(), 6u);
+  CHECK_EQ(Test.PP.GetNumLexedBodyBytes(), uint64_t(3 + 5));
+}
+
+/* ==========================================================================
+ *  -E output.
+ * ==========================================================================
+ */
+
+static void
+TestLineMarkersNestedInclude() {
+  // Markers come from entering and leaving files, a.h includes its sibling
+  // b.h and nothing precedes the first #include.
+  TestPreprocessor Test;
+  Test.AddFile("/test/a.h", "#include \"b.h\"\nint a;\n");
+  Test.AddFile("/test/b.h", "int b;\n");
+  Test.EnterMainFile(
+      Test.AddFile("/test/main.c", "#include \"a.h\"\nint m;\n"));
+  CHECK_EQ(Test.PrintPreprocessed(), "# 1 \"/test/main.c\"\n"
+                                     "# 1 \"/test/a.h\" 1\n"
+                                     "# 1 \"/test/b.h\" 1\n"
+                                     "int b;\n"
+                                     "# 2 \"/test/a.h\" 2\n"
+                                     "int a;\n"
+                                     "# 2 \"/test/main.c\" 2\n"
+                                     "int m;\n");
+}
+
+static void
+TestLineMarkersEmptyInclude() {
+  // A file without tokens still gets its markers.
+  TestPreprocessor Test;
+  Test.AddFile("/test/empty.h", "#define E\n");
+  Test.EnterMainFile(
+      Test.AddFile("/test/main.c", "int x;\n#include \"empty.h\"\nint y;\n"));
+  CHECK_EQ(Test.PrintPreprocessed(), "# 1 \"/test/main.c\"\n"
+                                     "int x;\n"
+                                     "# 1 \"/test/empty.h\" 1\n"
+                                     "# 3 \"/test/main.c\" 2\n"
+                                     "int y;\n");
+}
+
+int
+main() {
+  TestSplicedIdentifiers();
+  TestSplicedDirectives();
+  TestIfDefined();
+  TestIfNot();
+  TestIfParen();
+  TestIfValues();
+  TestIfNotDefinedGuard();
+  TestExpansionLocations();
+  TestExpansionFromHeader();
+  TestLazyMacroBodies();
+  TestLazyMacroBodyOfRedefinition();
+  TestLineMarkersNestedInclude();
+  TestLineMarkersEmptyInclude();
+  return NumFailures != 0;
+}
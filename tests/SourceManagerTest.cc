@@ -0,0 +1,111 @@
+/**
+ * Drops content cache buffers and reads them back from their files.
+ */
+
+#include "FileManager.h"
+#include "SourceManager.h"
+#include "Test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+static std::string Dir;
+
+static bool
+WriteFile(const std::string &Path, const std::string &Contents) {
+  std::FILE *Out = std::fopen(Path.c_str(), "wb");
+  if (!Out)
+    return false;
+  bool bWritten =
+      std::fwrite(Contents.data(), 1, Contents.size(), Out) == Contents.size();
+  return std::fclose(Out) == 0 && bWritten;
+}
+
+/** A dropped buffer whose file did not change is read back as it was. */
+static void
+TestReload() {
+  std::string Path = Dir + "/same.h";
+  CHECK(WriteFile(Path, "int x;\n"));
+
+  FileManager FileMgr;
+  SourceManager SourceMgr(true);
+  const FileEntry *File = FileMgr.GetFile(Path);
+  CHECK(File);
+  FileContentCache *Content = SourceMgr.CreateContentCache(File, FileMgr);
+  CHECK(Content);
+
+  SourceMgr.SetContentCacheBudget(0);
+  CHECK_EQ(SourceMgr.GetNumContentCacheEvictions(), 1u);
+  CHECK_EQ(std::string(Content->GetBufferStart()), std::string("int x;\n"));
+  CHECK_EQ(SourceMgr.GetNumContentCacheReloads(), 1u);
+  CHECK(!Content->IsStale());
+  CHECK(SourceMgr.GetStaleFiles().empty());
+
+  ::unlink(Path.c_str());
+}
+
+/**
+ * A dropped buffer whose file changed is reported instead of read, and
+ * keeps its size so that locations into it stay valid.
+ */
+static void
+TestReloadChangedFile() {
+  std::string Path = Dir + "/changed.h";
+  CHECK(WriteFile(Path, "int x;\n"));
+
+  FileManager FileMgr;
+  SourceManager SourceMgr(true);
+  const FileEntry *File = FileMgr.GetFile(Path);
+  CHECK(File);
+  FileContentCache *Content = SourceMgr.CreateContentCache(File, FileMgr);
+  CHECK(Content);
+
+  SourceMgr.SetContentCacheBudget(0);
+  CHECK(WriteFile(Path, "int y;\n"));
+  CHECK_EQ(std::string(Content->GetBufferStart()), std::string(7, ' '));
+  CHECK_EQ(Content->GetSize(), 7u);
+  CHECK(Content->IsStale());
+  CHECK_EQ(SourceMgr.GetStaleFiles().size(), size_t(1));
+  if (!SourceMgr.GetStaleFiles().empty())
+    CHECK(SourceMgr.GetStaleFiles()[0] == File);
+
+  // The blanks cannot be read back, so they are never dropped.
+  SourceMgr.SetContentCacheBudget(0);
+  CHECK_EQ(SourceMgr.GetNumContentCacheEvictions(), 1u);
+  CHECK_EQ(SourceMgr.GetContentCacheBytes(), uint64_t(7));
+
+  // A file that is shorter now is reported the same way.
+  std::string ShortPath = Dir + "/shorter.h";
+  CHECK(WriteFile(ShortPath, "int z;\n"));
+  const FileEntry *ShortFile = FileMgr.GetFile(ShortPath);
+  CHECK(ShortFile);
+  FileContentCache *ShortContent =
+      SourceMgr.CreateContentCache(ShortFile, FileMgr);
+  CHECK(ShortContent);
+  SourceMgr.SetContentCacheBudget(0);
+  CHECK(WriteFile(ShortPath, "int;\n"));
+  CHECK_EQ(std::string(ShortContent->GetBufferStart()), std::string(7, ' '));
+  CHECK(ShortContent->IsStale());
+  CHECK_EQ(SourceMgr.GetStaleFiles().size(), size_t(2));
+
+  ::unlink(Path.c_str());
+  ::unlink(ShortPath.c_str());
+}
+
+int
+main() {
+  char Template[] = "/tmp/SourceManagerTest.XXXXXX";
+  if (!::mkdtemp(Template)) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  Dir = Template;
+
+  TestReload();
+  TestReloadChangedFile();
+
+  ::rmdir(Dir.c_str());
+  return NumFailures != 0;
+}
@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <cstdio>
+
+/** Number of failed checks, the exit status of the test program. */
+inline int NumFailures = 0;
+
+/** Report a failed check, but keep running the others. */
+#define CHECK(Cond)                                                            \
+  do {                                                                         \
+    if (!(Cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,    \
+                   #Cond);                                                     \
+      ++NumFailures;                                                           \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(Actual, Expected)                                             \
+  do {                                                                         \
+    if (!((Actual) == (Expected))) {                                           \
+      std::fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__,        \
+                   __LINE__, #Actual, #Expected);                              \
+      ++NumFailures;                                                           \
+    }                                                                          \
+  } while (0)
+
+#endif